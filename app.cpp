@@ -2,44 +2,176 @@
 
 #include "ext.h"
 #include "const.h"
+#include "specialization.h"
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
 
 void BaseVulkanApplication::initWindow()
 {
+	Logger::get().setLevel(options.logLevel);
+	Logger::get().start();
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);	// hint: no OpenGL context
 	//glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);		// hint: un-resizable window
 
-	window = glfwCreateWindow(APP_WIDTH, APP_HEIGHT, "Vulkan", nullptr, nullptr);
-	glfwSetWindowUserPointer(window, this);
-	glfwSetFramebufferSizeCallback(window, BaseVulkanApplication::framebufferResizedCallback);
+	// sized once: the windows keep pointers to their targets
+	targets = std::vector<util_RenderTarget>(options.windowCount);
+	for (uint32_t i = 0; i < options.windowCount; i++)
+	{
+		auto& target = targets[i];
+		target.id = i;
+		std::string title = options.windowCount > 1 ? "Vulkan " + std::to_string(i) : "Vulkan";
+		target.window = glfwCreateWindow(APP_WIDTH, APP_HEIGHT, title.c_str(), nullptr, nullptr);
+		target.owner = this;
+		glfwSetWindowUserPointer(target.window, &target);
+		glfwSetFramebufferSizeCallback(target.window, BaseVulkanApplication::framebufferResizedCallback);
+		glfwSetWindowIconifyCallback(target.window, BaseVulkanApplication::iconifyCallback);
+
+		// any input or expose is a reason to draw in on-demand mode
+		glfwSetWindowRefreshCallback(target.window, BaseVulkanApplication::inputCallback);
+		glfwSetKeyCallback(target.window, [](GLFWwindow* window, int, int, int, int) { inputCallback(window); });
+		glfwSetMouseButtonCallback(target.window, [](GLFWwindow* window, int, int, int) { inputCallback(window); });
+		glfwSetScrollCallback(target.window, [](GLFWwindow* window, double, double) { inputCallback(window); });
+
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(target.window, &width, &height);
+		target.framebufferWidth = static_cast<uint32_t>(width);
+		target.framebufferHeight = static_cast<uint32_t>(height);
+	}
 }
 
 void BaseVulkanApplication::framebufferResizedCallback(GLFWwindow* window, int width, int height)
 {
-	auto app = reinterpret_cast<BaseVulkanApplication*>(glfwGetWindowUserPointer(window));
-	app->framebufferResized = true;
+	// GLFW only runs on the main thread, the render thread sees the size through the target
+	auto target = reinterpret_cast<util_RenderTarget*>(glfwGetWindowUserPointer(window));
+	target->framebufferWidth = static_cast<uint32_t>(width);
+	target->framebufferHeight = static_cast<uint32_t>(height);
+	target->framebufferResized = true;
+	static_cast<BaseVulkanApplication*>(target->owner)->requestRedraw();
+}
+
+void BaseVulkanApplication::iconifyCallback(GLFWwindow* window, int iconified)
+{
+	auto target = reinterpret_cast<util_RenderTarget*>(glfwGetWindowUserPointer(window));
+	target->minimized = iconified == GLFW_TRUE;
+	static_cast<BaseVulkanApplication*>(target->owner)->requestRedraw();
+}
+
+void BaseVulkanApplication::inputCallback(GLFWwindow* window)
+{
+	auto target = reinterpret_cast<util_RenderTarget*>(glfwGetWindowUserPointer(window));
+	static_cast<BaseVulkanApplication*>(target->owner)->requestRedraw();
 }
 
 
 /**************************************** Init Vulkan ***************************************/
 void BaseVulkanApplication::initVulkan()
 {
-	createInstance(); 
-	setupDebugMessenger();
-	createSurface();
-	pickPhysicalDevice();
-	createLogicalDevice();
-	createSwapChain();
-	createImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
-	createFramebuffers();
-	createCommandPool();
-	createCommandBuffers();
-	createSyncObjects();
+	auto& prof = startupProfiler;
+	prof.start();
+	jobs.init();
+	hostAllocator.init(options.hostAllocMode);
+	allocator = hostAllocator.callbacks();
+	particlesEnabled = options.particleCount > 0;
+	lightingEnabled = options.lightCount > 0;
+	lightsNaive = options.lightsNaive && !options.benchLights;
+	ShaderLibrary::get().setOverrideDir(options.shaderDir);
+
+	prof.time("createInstance", [this] { createInstance(); });
+	prof.time("setupDebugMessenger", [this] { setupDebugMessenger(); });
+	prof.time("createSurface", [this] {
+		for (auto& target : targets)
+			createSurface(target);
+	});
+	prof.time("pickPhysicalDevice", [this] { pickPhysicalDevice(); });
+	prof.time("createLogicalDevice", [this] { createLogicalDevice(); });
+
+	// only need the device: overlap them with the swap chain setup
+	JobCounter shadersReady, setupReady, meshReady;
+	try
+	{
+		jobs.run([this, &prof] {
+			prof.time("loadShaderModules", [this] { loadShaderModules(); });
+		}, &shadersReady);
+		jobs.run([this, &prof] {
+			prof.time("createSceneMesh", [this] { createSceneMesh(); });
+		}, &meshReady);
+		jobs.run([this, &prof] {
+			prof.time("createCommandPool", [this] { createCommandPool(); });
+		}, &setupReady);
+
+		prof.time("createSwapChain", [this] {
+			for (auto& target : targets)
+				createSwapChain(target);
+		});
+		if (postEnabled)
+			prof.time("createPostProcess", [this] { createPostProcess(); });
+		if (particlesEnabled)
+			prof.time("createParticles", [this] { createParticles(); });
+		if (lightingEnabled)
+			prof.time("createLighting", [this] { createLighting(); });
+		if (!dynamicRendering)
+			prof.time("createRenderPass", [this] { createRenderPass(); });
+
+		// the pipeline needs the render pass (if any), shaders and the particle and light set layouts,
+		// but not the image views
+		jobs.run([this, &prof] {
+			prof.time("createGraphicsPipeline", [this] { createGraphicsPipeline(); });
+		}, &setupReady, &shadersReady);
+
+		prof.time("createImageViews", [this] {
+			for (auto& target : targets)
+				createImageViews(target);
+		});
+		prof.time("createAttachmentImages", [this] {
+			for (auto& target : targets)
+				createAttachmentImages(target);
+		});
+		if (!dynamicRendering)
+		{
+			prof.time("createFramebuffers", [this] {
+				for (auto& target : targets)
+					createFramebuffers(target);
+			});
+		}
+		jobs.wait(meshReady);
+		prof.time("createScene", [this] {
+			createScene();
+			publishSnapshot();
+		});
+
+		// the pipeline job only runs (or fails) after the shader job, so this covers all three
+		jobs.wait(setupReady);
+	}
+	catch (...)
+	{
+		// the jobs still reference the counters on this stack frame, let them finish first
+		for (JobCounter* counter : { &meshReady, &setupReady, &shadersReady })
+		{
+			try { jobs.wait(*counter); }
+			catch (...) {}
+		}
+		throw;
+	}
+
+	prof.time("createQueryPool", [this] {
+		for (auto& target : targets)
+			createQueryPool(target);
+	});
+	prof.time("createCommandBuffers", [this] {
+		for (auto& target : targets)
+			createCommandBuffers(target);
+	});
+	prof.time("createSyncObjects", [this] { createSyncObjects(); });
+	if (captureEnabled)
+		prof.time("createFrameCapture", [this] { createFrameCapture(); });
+	prof.time("createMetrics", [this] { createMetrics(); });
 }
 
 auto BaseVulkanApplication::getRequiredExtensions()->std::vector<const char*>
@@ -160,7 +292,7 @@ void BaseVulkanApplication::createInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_3;
 
 	// 2. prepare create info
 	VkInstanceCreateInfo createInfo{};
@@ -183,7 +315,7 @@ void BaseVulkanApplication::createInstance()
 	createInfo.enabledLayerCount = 0;
 #endif // !NDEBUG
 
-	VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+	VkResult result = vkCreateInstance(&createInfo, allocator, &instance);
 	if (result == VK_ERROR_LAYER_NOT_PRESENT)
 		throw std::runtime_error("some layers not present!");
 	else if (result == VK_ERROR_EXTENSION_NOT_PRESENT)
@@ -197,16 +329,16 @@ void BaseVulkanApplication::setupDebugMessenger()
 #ifndef NDEBUG
 	auto createInfo = makeDebugMessengerCreateInfo();
 	if (ext_CreateDebugUtilsMessengerEXT(instance, &createInfo, 
-		nullptr, &debugMessenger) != VK_SUCCESS)
+		allocator, &debugMessenger) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to set up debug messenger!");
 	}
 #endif // NDEBUG
 }
 
-void BaseVulkanApplication::createSurface()
+void BaseVulkanApplication::createSurface(util_RenderTarget& target)
 {
-	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+	if (glfwCreateWindowSurface(instance, target.window, allocator, &target.surface) != VK_SUCCESS)
 		throw std::runtime_error("failed to create window surface");
 }
 
@@ -226,9 +358,15 @@ auto BaseVulkanApplication::findQueueFamilies(VkPhysicalDevice device)->util_Que
 		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
 			indices.graphicsFamily = i;
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-		if (presentSupport)
+		// one present queue serves every window
+		bool presentAll = true;
+		for (const auto& target : targets)
+		{
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, target.surface, &presentSupport);
+			presentAll = presentAll && presentSupport;
+		}
+		if (presentAll)
 			indices.presentFamily = i;
 
 		if (indices.isComplete()) break;
@@ -237,34 +375,24 @@ auto BaseVulkanApplication::findQueueFamilies(VkPhysicalDevice device)->util_Que
 	return indices;
 }
 
-bool BaseVulkanApplication::checkDeviceExtSup(VkPhysicalDevice device)
+bool BaseVulkanApplication::checkDeviceExtSup(VkPhysicalDevice device, const std::vector<const char*>& required)
 {
 	uint32_t extCount = 0;
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, nullptr);
 	std::vector<VkExtensionProperties> validExts(extCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, validExts.data());
 
-	std::set<std::string> queryExts(DEVICE_EXT_REQUIRED.begin(), DEVICE_EXT_REQUIRED.end());
+	std::set<std::string> queryExts(required.begin(), required.end());
 
 	for (const auto& ext : validExts)
 	{
 		queryExts.erase(ext.extensionName);
 	}
 
-#ifndef NDEBUG
-	std::cout << DEBUG_SEGLINE;
-	std::cout << "PhyDevice support ext " << validExts.size() << ":\n";
-	for (const auto& ext_name : DEVICE_EXT_REQUIRED)
-	{
-		auto tag = (queryExts.count(ext_name) == 0) ? 'y' : 'n';
-		std::cout << ext_name << '\t' << tag << '\n';
-	}
-#endif // !NDEBUG
-
 	return queryExts.empty();
 }
 
-auto BaseVulkanApplication::querySurfaceDetails(VkPhysicalDevice device)->util_SurfaceDetails
+auto BaseVulkanApplication::querySurfaceDetails(VkPhysicalDevice device, VkSurfaceKHR surface)->util_SurfaceDetails
 {
 	util_SurfaceDetails details;
 
@@ -291,41 +419,99 @@ auto BaseVulkanApplication::querySurfaceDetails(VkPhysicalDevice device)->util_S
 
 bool BaseVulkanApplication::isDeviceSuitable(VkPhysicalDevice device)
 {
+	auto indices = findQueueFamilies(device);
+	auto extChecked = checkDeviceExtSup(device, DEVICE_EXT_REQUIRED);
+	auto surfaceValid = true;
+	if (extChecked)
+	{
+		for (const auto& target : targets)
+		{
+			auto surfaceDetails = querySurfaceDetails(device, target.surface);
+			surfaceValid = surfaceValid && !surfaceDetails.formats.empty() && !surfaceDetails.presentModes.empty();
+		}
+	}
+	return indices.isComplete() && extChecked && surfaceValid;
+}
+
+auto BaseVulkanApplication::rateDevice(VkPhysicalDevice device, uint32_t index)->util_DeviceScore
+{
+	util_DeviceScore score;
+	score.index = index;
+
 	VkPhysicalDeviceProperties deviceProperties;
 	vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
-#ifndef NDEBUG
-	std::cout << DEBUG_SEGLINE;
-	std::cout << "Device: " << deviceProperties.deviceName << std::endl;
-	std::cout << "Type: " << deviceProperties.deviceType << std::endl;
-	std::cout << "2D Block Shape: " << deviceProperties.sparseProperties.residencyStandard2DBlockShape << std::endl;
-	std::cout << "Aligned Mip Size: " << deviceProperties.sparseProperties.residencyAlignedMipSize << std::endl;
-	std::cout << "3D Block Shape: " << deviceProperties.sparseProperties.residencyStandard3DBlockShape << std::endl;
-#endif 
+	// 0. identity: deviceUUID is core since 1.1
+	if (deviceProperties.apiVersion >= VK_API_VERSION_1_1)
+	{
+		VkPhysicalDeviceIDProperties idProperties{};
+		idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+		VkPhysicalDeviceProperties2 properties2{};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &idProperties;
+		vkGetPhysicalDeviceProperties2(device, &properties2);
+		std::copy(idProperties.deviceUUID, idProperties.deviceUUID + VK_UUID_SIZE, score.uuid);
+	}
 
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	// 1. hard requirements
+	if (!isDeviceSuitable(device))
+	{
+		score.rejectReason = "missing queue, extension or surface support";
+		return score;
+	}
+	const auto& limits = deviceProperties.limits;
+	if (limits.maxImageDimension2D < DEVICE_MIN_IMAGE_DIMENSION_2D
+		|| limits.maxColorAttachments < DEVICE_MIN_COLOR_ATTACHMENTS
+		|| limits.maxPushConstantsSize < DEVICE_MIN_PUSH_CONSTANTS_SIZE)
+	{
+		score.rejectReason = "limits below requirements";
+		return score;
+	}
+	score.suitable = true;
 
-#ifndef NDEBUG
-	std::cout << "Features:\n";
-	std::cout << "\tGeomtry Shader: " << deviceFeatures.geometryShader << std::endl;
-	std::cout << "\tMulti-Viewport: " << deviceFeatures.multiViewport << std::endl;
-	std::cout << "\tFloat64: " << deviceFeatures.shaderFloat64 << std::endl;
-	std::cout << "\tInt16: " << deviceFeatures.shaderInt16 << std::endl;
-	std::cout << "\tInt64: " << deviceFeatures.shaderInt64 << std::endl;
-	std::cout << "\tTessellation Shader: " << deviceFeatures.tessellationShader << std::endl;
-	std::cout << "\tWide Lines: " << deviceFeatures.wideLines << std::endl;
-#endif // !NDBUG
+	// 2. device type: discrete > integrated > virtual > cpu
+	switch (deviceProperties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score.typeScore = DEVICE_SCORE_TYPE_DISCRETE; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score.typeScore = DEVICE_SCORE_TYPE_INTEGRATED; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score.typeScore = DEVICE_SCORE_TYPE_VIRTUAL; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: score.typeScore = DEVICE_SCORE_TYPE_CPU; break;
+	default: score.typeScore = 0; break;
+	}
 
-	auto indices = findQueueFamilies(device);
-	auto extChecked = checkDeviceExtSup(device);
-	auto surfaceValid = true;
-	if (extChecked)
+	// 3. device-local heap size
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++)
 	{
-		auto surfaceDetails = querySurfaceDetails(device);
-		surfaceValid = !surfaceDetails.formats.empty() && !surfaceDetails.presentModes.empty();
+		if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			score.deviceLocalBytes += memProperties.memoryHeaps[i].size;
 	}
-	return indices.isComplete() && extChecked && surfaceValid;
+	score.heapScore = static_cast<uint32_t>(std::min<VkDeviceSize>(DEVICE_SCORE_HEAP_MAX,
+		(score.deviceLocalBytes >> 20) / DEVICE_SCORE_HEAP_MIB_PER_POINT));
+
+	// 4. headroom over the required limits
+	score.limitScore = limits.maxImageDimension2D / DEVICE_MIN_IMAGE_DIMENSION_2D - 1
+		+ limits.maxColorAttachments / DEVICE_MIN_COLOR_ATTACHMENTS - 1
+		+ limits.maxPushConstantsSize / DEVICE_MIN_PUSH_CONSTANTS_SIZE - 1;
+
+	// 5. queue family layout: dedicated transfer (DMA) and async compute families
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+	for (const auto& queueFamily : queueFamilies)
+	{
+		auto flags = queueFamily.queueFlags;
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			score.dedicatedTransfer = true;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+			score.dedicatedCompute = true;
+	}
+	score.queueScore = (score.dedicatedTransfer ? DEVICE_SCORE_DEDICATED_TRANSFER : 0)
+		+ (score.dedicatedCompute ? DEVICE_SCORE_DEDICATED_COMPUTE : 0);
+
+	return score;
 }
 
 void BaseVulkanApplication::pickPhysicalDevice()
@@ -339,22 +525,66 @@ void BaseVulkanApplication::pickPhysicalDevice()
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-#ifndef NDEBUG
-	std::cout << DEBUG_SEGLINE;
-	std::cout << "find available physical devices " << deviceCount << ":\n";
-#endif // !NDEBUG
+	std::vector<VkPhysicalDeviceProperties> properties(deviceCount);
+	std::vector<util_DeviceScore> scores(deviceCount);
+	for (uint32_t i = 0; i < deviceCount; i++)
+	{
+		vkGetPhysicalDeviceProperties(devices[i], &properties[i]);
+		scores[i] = rateDevice(devices[i], i);
+	}
 
-	for (const auto& device : devices)
+	// 1. explicit override wins, but must still be usable
+	int chosen = -1;
+	if (!options.deviceOverride.empty())
 	{
-		if (isDeviceSuitable(device))
+		for (uint32_t i = 0; i < deviceCount; i++)
 		{
-			physicalDevice = device;
+			if (!matchDeviceOverride(options.deviceOverride, i, properties[i], scores[i].uuid))
+				continue;
+			if (!scores[i].suitable)
+				throw std::runtime_error("device override \"" + options.deviceOverride + "\" selects "
+					+ properties[i].deviceName + ", which is unsuitable: " + scores[i].rejectReason);
+			chosen = static_cast<int>(i);
 			break;
 		}
+		if (chosen < 0)
+			throw std::runtime_error("device override \"" + options.deviceOverride + "\" matches no device");
+	}
+	// 2. otherwise the highest score, first enumerated on ties
+	else
+	{
+		for (uint32_t i = 0; i < deviceCount; i++)
+		{
+			if (scores[i].suitable && (chosen < 0 || scores[i].total() > scores[chosen].total()))
+				chosen = static_cast<int>(i);
+		}
 	}
 
-	if (physicalDevice == VK_NULL_HANDLE)
+	if (chosen < 0)
 		throw std::runtime_error("failed to find a suitable GPU");
+	physicalDevice = devices[chosen];
+
+	const auto& score = scores[chosen];
+	std::cout << DEBUG_SEGLINE;
+	std::cout << "Physical Device: " << properties[chosen].deviceName
+		<< " (index " << chosen << " of " << deviceCount
+		<< (options.deviceOverride.empty() ? ", by score)" : ", by override)") << std::endl;
+	std::cout << "UUID: " << formatUUID(score.uuid) << std::endl;
+	std::cout << "Score: " << score.total() << " = type " << score.typeScore
+		<< " + heap " << score.heapScore << " + limits " << score.limitScore
+		<< " + queues " << score.queueScore << std::endl;
+	std::cout << "\tdevice-local: " << (score.deviceLocalBytes >> 20) << " MiB"
+		<< ", dedicated transfer: " << (score.dedicatedTransfer ? 'y' : 'n')
+		<< ", dedicated compute: " << (score.dedicatedCompute ? 'y' : 'n') << std::endl;
+
+	msaaSamples = chooseSampleCount(options.msaaSamples);
+	std::cout << "MSAA: " << msaaSamples << "x (requested " << options.msaaSamples << "x)" << std::endl;
+
+	// depth-only formats first, stencil is never used
+	depthFormat = findSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D24_UNORM_S8_UINT,
+		  VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D16_UNORM },
+		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 }
 
 void BaseVulkanApplication::createLogicalDevice()
@@ -373,15 +603,74 @@ void BaseVulkanApplication::createLogicalDevice()
 		queueCreateInfos.push_back(std::move(queueCreateInfo));
 	}
 
+	// fragment shader invocation counts, to measure overdraw
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	pipelineStatsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+
 	VkPhysicalDeviceFeatures deviceFeatures{};
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+
+	// cached segments execute inside that statistics query, which they have to inherit
+	segmentCacheEnabled = options.segmentCache
+		&& (!pipelineStatsSupported || supportedFeatures.inheritedQueries == VK_TRUE);
+	deviceFeatures.inheritedQueries = segmentCacheEnabled && pipelineStatsSupported ? VK_TRUE : VK_FALSE;
+
+	// the last post-processing pass writes whatever format the swap chain has
+	storageWriteWithoutFormat = options.post && supportedFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+	deviceFeatures.shaderStorageImageWriteWithoutFormat = storageWriteWithoutFormat ? VK_TRUE : VK_FALSE;
+
+	// dynamic rendering: core since 1.3, before that an extension with two dependencies
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	bool renderingCore = properties.apiVersion >= VK_API_VERSION_1_3;
+	bool renderingExt = !renderingCore && checkDeviceExtSup(physicalDevice, DEVICE_EXT_DYNAMIC_RENDERING);
+
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR renderingFeatures{};
+	renderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+	if (options.dynamicRendering && (renderingCore || renderingExt))
+	{
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &renderingFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+	}
+	dynamicRendering = renderingFeatures.dynamicRendering == VK_TRUE;
+
+	// synchronization2 for vkQueueSubmit2, also core since 1.3; submits fall back to vkQueueSubmit
+	bool sync2Ext = !renderingCore && checkDeviceExtSup(physicalDevice, DEVICE_EXT_SYNCHRONIZATION_2);
+	VkPhysicalDeviceSynchronization2FeaturesKHR sync2Features{};
+	sync2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+	if (renderingCore || sync2Ext)
+	{
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &sync2Features;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+	}
+	bool sync2 = sync2Features.synchronization2 == VK_TRUE;
+	sync2Features.pNext = dynamicRendering ? &renderingFeatures : nullptr;
+
+	// per-heap usage and budget, without it there is no pressure to react to
+	bool budgetExt = checkDeviceExtSup(physicalDevice, DEVICE_EXT_MEMORY_BUDGET);
+
+	std::vector<const char*> extensions(DEVICE_EXT_REQUIRED);
+	if (dynamicRendering && renderingExt)
+		extensions.insert(extensions.end(), DEVICE_EXT_DYNAMIC_RENDERING.begin(), DEVICE_EXT_DYNAMIC_RENDERING.end());
+	if (budgetExt)
+		extensions.insert(extensions.end(), DEVICE_EXT_MEMORY_BUDGET.begin(), DEVICE_EXT_MEMORY_BUDGET.end());
+	if (sync2 && sync2Ext)
+		extensions.insert(extensions.end(), DEVICE_EXT_SYNCHRONIZATION_2.begin(), DEVICE_EXT_SYNCHRONIZATION_2.end());
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = sync2 ? static_cast<const void*>(&sync2Features)
+		: dynamicRendering ? &renderingFeatures : nullptr;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXT_REQUIRED.size());
-	createInfo.ppEnabledExtensionNames = DEVICE_EXT_REQUIRED.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 #ifndef NDEBUG
 	createInfo.enabledLayerCount = static_cast<uint32_t>(DEBUG_VALIDATION_LAYERS.size());
@@ -390,24 +679,56 @@ void BaseVulkanApplication::createLogicalDevice()
 	createInfo.enabledLayerCount = 0;
 #endif // !NDEBUG
 
-	VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
+	VkResult result = vkCreateDevice(physicalDevice, &createInfo, allocator, &device);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to create logical device!");
 
 	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+	if (dynamicRendering)
+	{
+		cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)
+			vkGetDeviceProcAddr(device, renderingCore ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR");
+		cmdEndRendering = (PFN_vkCmdEndRenderingKHR)
+			vkGetDeviceProcAddr(device, renderingCore ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR");
+		if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr)
+			throw std::runtime_error("failed to load dynamic rendering commands!");
+	}
+	std::cout << "Rendering: " << (!dynamicRendering ? "render pass"
+		: renderingCore ? "dynamic (core 1.3)" : "dynamic (VK_KHR_dynamic_rendering)") << std::endl;
+
+	memoryBudget.init(physicalDevice, budgetExt);
+	std::cout << "Memory budget: " << (budgetExt ? "VK_EXT_memory_budget" : "not available, no pressure tracking")
+		<< std::endl;
+	// every queue submission of a frame goes through here
+	PFN_vkQueueSubmit2KHR queueSubmit2 = nullptr;
+	if (sync2)
+	{
+		queueSubmit2 = (PFN_vkQueueSubmit2KHR)
+			vkGetDeviceProcAddr(device, renderingCore ? "vkQueueSubmit2" : "vkQueueSubmit2KHR");
+		if (queueSubmit2 == nullptr)
+			throw std::runtime_error("failed to load vkQueueSubmit2!");
+	}
+	graphicsSubmit.init(graphicsQueue, queueSubmit2);
+	std::cout << "Submit: " << (!sync2 ? "vkQueueSubmit"
+		: renderingCore ? "vkQueueSubmit2 (core 1.3)" : "vkQueueSubmit2 (VK_KHR_synchronization2)") << std::endl;
+	std::cout << "Segments: " << (segmentCacheEnabled ? "cached in secondary command buffers"
+		: options.segmentCache ? "recorded inline, queries cannot be inherited" : "recorded inline") << std::endl;
 }
 
-void BaseVulkanApplication::createSwapChain()
+void BaseVulkanApplication::createSwapChain(util_RenderTarget& target)
 {
-	auto surfaceDetails = querySurfaceDetails(physicalDevice);
-	auto surfaceFormat = surfaceDetails.chooseFormat();
+	auto surfaceDetails = querySurfaceDetails(physicalDevice, target.surface);
+	// the first window picks the format, the others have to offer the same one
+	auto surfaceFormat = colorFormat.format == VK_FORMAT_UNDEFINED ? surfaceDetails.chooseFormat()
+		: surfaceDetails.chooseFormat(colorFormat.format, colorFormat.colorSpace);
+	if (colorFormat.format != VK_FORMAT_UNDEFINED && (surfaceFormat->format != colorFormat.format
+		|| surfaceFormat->colorSpace != colorFormat.colorSpace))
+		throw std::runtime_error("window " + std::to_string(target.id) + " does not support the shared surface format");
 	auto presentMode = surfaceDetails.choosePresentMode();
 
-	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
-	auto extent = surfaceDetails.chooseExtent(
-		static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+	auto extent = surfaceDetails.chooseExtent(target.framebufferWidth, target.framebufferHeight);
 
 	uint32_t imageCount = surfaceDetails.capabilities.minImageCount + 1;
 	if (surfaceDetails.capabilities.maxImageCount > 0 &&
@@ -416,7 +737,7 @@ void BaseVulkanApplication::createSwapChain()
 
 	VkSwapchainCreateInfoKHR createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	createInfo.surface = surface;
+	createInfo.surface = target.surface;
 	createInfo.minImageCount = imageCount;
 	createInfo.imageFormat = surfaceFormat->format;
 	createInfo.imageColorSpace = surfaceFormat->colorSpace;
@@ -424,6 +745,43 @@ void BaseVulkanApplication::createSwapChain()
 	createInfo.imageArrayLayers = 1;
 	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+	// readback copies straight out of the primary window's presented image
+	if (target.id == 0)
+	{
+		captureEnabled = options.capture
+			&& (surfaceDetails.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+			&& formatTexelSize(surfaceFormat->format) != 0;
+		if (options.capture && !captureEnabled)
+			std::cout << "Capture: unsupported by the swap chain, disabled" << std::endl;
+		if (captureEnabled)
+			createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+		// post-processing: HDR target the scene can render to and compute can read and write,
+		// then storage writes into the swap chain when it allows them, a blit when not
+		VkFormatProperties hdrProperties, swapProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, PostProcess::HDR_FORMAT, &hdrProperties);
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, surfaceFormat->format, &swapProperties);
+		VkFormatFeatureFlags hdrFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+		auto usage = surfaceDetails.capabilities.supportedUsageFlags;
+		postDirect = (usage & VK_IMAGE_USAGE_STORAGE_BIT)
+			&& (swapProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+		bool postBlit = (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+			&& (swapProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)
+			&& (hdrProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
+		postEnabled = options.post && storageWriteWithoutFormat
+			&& (hdrProperties.optimalTilingFeatures & hdrFeatures) == hdrFeatures && (postDirect || postBlit);
+		if (options.post && !postEnabled)
+			std::cout << "Post: unsupported by the device or swap chain, disabled" << std::endl;
+		sceneFormat = postEnabled ? PostProcess::HDR_FORMAT : surfaceFormat->format;
+	}
+	if (postEnabled)
+	{
+		VkImageUsageFlags postUsage = postDirect ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		if ((surfaceDetails.capabilities.supportedUsageFlags & postUsage) == 0)
+			throw std::runtime_error("window " + std::to_string(target.id) + " does not support the post-processing output");
+		createInfo.imageUsage |= postUsage;
+	}
+
 	auto indices = findQueueFamilies(physicalDevice);
 	auto indexList = indices.toUniqueVector();
 	if (indexList.size() > 1)
@@ -443,20 +801,21 @@ void BaseVulkanApplication::createSwapChain()
 	createInfo.clipped = VK_TRUE;
 	createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-	auto result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
+	auto result = vkCreateSwapchainKHR(device, &createInfo, allocator, &target.swapChain);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to create swap chain!");
 
 	uint32_t realImageCount = 0;
-	vkGetSwapchainImagesKHR(device, swapChain, &realImageCount, nullptr);
-	swapChainImages.resize(realImageCount);
-	vkGetSwapchainImagesKHR(device, swapChain, &realImageCount, swapChainImages.data());
+	vkGetSwapchainImagesKHR(device, target.swapChain, &realImageCount, nullptr);
+	target.images.resize(realImageCount);
+	vkGetSwapchainImagesKHR(device, target.swapChain, &realImageCount, target.images.data());
 
-	swapChainImageFormat = surfaceFormat->format;
-	swapChainExtent = extent;
+	colorFormat = *surfaceFormat;
+	target.extent = extent;
 
 #ifndef NDEBUG
 	std::cout << DEBUG_SEGLINE;
+	std::cout << "Window: " << target.id << std::endl;
 	std::cout << "Pixel Size: " << extent.width << ", " << extent.height << std::endl;
 	std::cout << "Max Pixel Size: " << surfaceDetails.capabilities.maxImageExtent.width
 		<< ", " << surfaceDetails.capabilities.maxImageExtent.height << std::endl;
@@ -472,138 +831,338 @@ void BaseVulkanApplication::createSwapChain()
 
 }
 
-void BaseVulkanApplication::createImageViews()
+void BaseVulkanApplication::createImageViews(util_RenderTarget& target)
+{
+	target.imageViews.resize(target.images.size());
+	for (size_t i = 0; i < target.images.size(); i++)
+		target.imageViews[i] = createImageView(target.images[i], colorFormat.format, VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+uint32_t BaseVulkanApplication::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties,
+	VkMemoryPropertyFlags preferred)
+{
+	return ::findMemoryType(physicalDevice, typeFilter, properties, preferred);
+}
+
+VkFormat BaseVulkanApplication::findSupportedFormat(const std::vector<VkFormat>& candidates,
+	VkImageTiling tiling, VkFormatFeatureFlags features)
 {
-	swapChainImageViews.resize(swapChainImages.size());
-	for (size_t i = 0; i < swapChainImages.size(); i++)
+	for (auto format : candidates)
 	{
-		VkImageViewCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		createInfo.image = swapChainImages[i];
-		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		createInfo.format = swapChainImageFormat;
-		createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-		
-		createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		createInfo.subresourceRange.baseMipLevel = 0;
-		createInfo.subresourceRange.levelCount = 1;
-		createInfo.subresourceRange.baseArrayLayer = 0;
-		createInfo.subresourceRange.layerCount = 1;
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+		auto supported = (tiling == VK_IMAGE_TILING_LINEAR) ? props.linearTilingFeatures : props.optimalTilingFeatures;
+		if ((supported & features) == features)
+			return format;
+	}
+
+	throw std::runtime_error("failed to find supported format!");
+}
 
-		auto result = vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]);
-		if (result != VK_SUCCESS)
-			throw std::runtime_error("failed to create Image Views!");
+auto BaseVulkanApplication::chooseSampleCount(uint32_t requested)->VkSampleCountFlagBits
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// color and depth are both multisampled, so both must support the count
+	VkSampleCountFlags counts = properties.limits.framebufferColorSampleCounts
+		& properties.limits.framebufferDepthSampleCounts;
+	for (uint32_t bit = requested; bit > VK_SAMPLE_COUNT_1_BIT; bit >>= 1)
+	{
+		if (counts & bit)
+			return static_cast<VkSampleCountFlagBits>(bit);
 	}
+	return VK_SAMPLE_COUNT_1_BIT;
+}
+
+void BaseVulkanApplication::createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
+	VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+	VkMemoryPropertyFlags preferred, util_ImageAllocation& image)
+{
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = tiling;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = samples;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(device, &imageInfo, allocator, &image.image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image.image, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, preferred);
+
+	if (vkAllocateMemory(device, &allocInfo, allocator, &image.memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate image memory!");
+
+	vkBindImageMemory(device, image.image, image.memory, 0);
+
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	image.size = memRequirements.size;
+	image.lazy = (memProperties.memoryTypes[allocInfo.memoryTypeIndex].propertyFlags
+		& VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+}
+
+void BaseVulkanApplication::destroyImage(util_ImageAllocation& image)
+{
+	vkDestroyImageView(device, image.view, allocator);
+	vkDestroyImage(device, image.image, allocator);
+	vkFreeMemory(device, image.memory, allocator);
+	image = util_ImageAllocation{};
 }
 
-VkShaderModule BaseVulkanApplication::createShaderModule(const std::vector<char>& code)
+VkImageView BaseVulkanApplication::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect)
+{
+	VkImageViewCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	createInfo.image = image;
+	createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	createInfo.format = format;
+	createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+	createInfo.subresourceRange.aspectMask = aspect;
+	createInfo.subresourceRange.baseMipLevel = 0;
+	createInfo.subresourceRange.levelCount = 1;
+	createInfo.subresourceRange.baseArrayLayer = 0;
+	createInfo.subresourceRange.layerCount = 1;
+
+	VkImageView imageView;
+	auto result = vkCreateImageView(device, &createInfo, allocator, &imageView);
+	if (result != VK_SUCCESS)
+		throw std::runtime_error("failed to create Image Views!");
+	return imageView;
+}
+
+void BaseVulkanApplication::createAttachmentImages(util_RenderTarget& target)
+{
+	// neither attachment is ever stored: transient usage lets tilers keep them on chip
+	// and LAZILY_ALLOCATED memory means they may never get physical backing
+	VkImageUsageFlags transient = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	VkMemoryPropertyFlags lazy = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+	auto& colorAttachment = target.colorAttachment;
+	auto& depthAttachment = target.depthAttachment;
+	if (msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+	{
+		createImage(target.extent.width, target.extent.height, sceneFormat, msaaSamples,
+			VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | transient,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lazy, colorAttachment);
+		colorAttachment.view = createImageView(colorAttachment.image, sceneFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+
+	createImage(target.extent.width, target.extent.height, depthFormat, msaaSamples,
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | transient,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lazy, depthAttachment);
+
+	VkImageAspectFlags aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+	if (depthFormat == VK_FORMAT_D24_UNORM_S8_UINT || depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT)
+		aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	depthAttachment.view = createImageView(depthAttachment.image, depthFormat, aspect);
+
+	Logger::get().write(LogLevel::Debug, Logger::NO_KEY, "Attachments: window %u, %ux, color %.2f MiB%s, depth %.2f MiB%s",
+		target.id, static_cast<uint32_t>(msaaSamples), colorAttachment.size / 1048576.0, colorAttachment.lazy ? " lazy" : "",
+		depthAttachment.size / 1048576.0, depthAttachment.lazy ? " lazy" : "");
+
+	// the HDR scene image and the post-processing chain are sized with the attachments
+	if (postEnabled)
+		postProcess.resize(target.id, target.extent, target.images, target.imageViews);
+}
+
+VkShaderModule BaseVulkanApplication::createShaderModule(const ShaderCode& code)
 {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	createInfo.pCode = code.data();
 
 	VkShaderModule shaderModule;
-	VkResult result = vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
+	VkResult result = vkCreateShaderModule(device, &createInfo, allocator, &shaderModule);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to create shader module");
 	return shaderModule;
 }
 
+void BaseVulkanApplication::loadShaderModules()
+{
+	auto& library = ShaderLibrary::get();
+	auto vertShaderCode = library.load("tri.vert.spv");
+	auto fragShaderCode = library.load("tri.frag.spv");
+	const auto& overrideDir = library.overrideDirectory();
+	Logger::get().write(LogLevel::Info, Logger::NO_KEY, "Shader: %zu/%zu, %zu embedded%s%s", vertShaderCode.size(),
+		fragShaderCode.size(), ShaderLibrary::embeddedCount(), overrideDir.empty() ? "" : ", overrides from ",
+		overrideDir.c_str());
+
+	vertShaderModule = createShaderModule(vertShaderCode);
+	fragShaderModule = createShaderModule(fragShaderCode);
+	if (particlesEnabled)
+		particleShaderModule = createShaderModule(library.load("particle.vert.spv"));
+	if (lightingEnabled)
+		litShaderModule = createShaderModule(library.load("lit.frag.spv"));
+}
+
 void BaseVulkanApplication::createRenderPass()
 {
+	bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	// with --post the pass ends in the HDR image, left in GENERAL for the compute chain
+	VkImageLayout outputLayout = postEnabled ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	// with MSAA the samples stay on chip and only the resolve is stored
 	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapChainImageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.format = sceneFormat;
+	colorAttachment.samples = msaaSamples;
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : outputLayout;
+
+	// depth never leaves the tile: cleared on load, discarded on store
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = depthFormat;
+	depthAttachment.samples = msaaSamples;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription resolveAttachment{};
+	resolveAttachment.format = sceneFormat;
+	resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resolveAttachment.finalLayout = outputLayout;
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentReference depthAttachmentRef{};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference resolveAttachmentRef{};
+	resolveAttachmentRef.attachment = 2;
+	resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+	// the single depth image is shared by all frames in flight, so are the MSAA colour
+	// image and the HDR image the previous frame's compute chain read
 	VkSubpassDependency dependency{};
 	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+		| (postEnabled ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0);
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// the capture copy reads the presented image right after the pass
+	VkSubpassDependency captureDependency{};
+	captureDependency.srcSubpass = 0;
+	captureDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	captureDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	captureDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	captureDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	captureDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	// or the compute chain reads the HDR image, and does the capture's ordering itself
+	VkSubpassDependency postDependency = captureDependency;
+	postDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	postDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkSubpassDependency dependencies[] = { dependency, postEnabled ? postDependency : captureDependency };
+
+	VkAttachmentDescription attachments[] = { colorAttachment, depthAttachment, resolveAttachment };
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
+	renderPassInfo.attachmentCount = multisampled ? 3 : 2;
+	renderPassInfo.pAttachments = attachments;
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = captureEnabled || postEnabled ? 2 : 1;
+	renderPassInfo.pDependencies = dependencies;
 
-	VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
+	VkResult result = vkCreateRenderPass(device, &renderPassInfo, allocator, &renderPass);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to create render pass!");
 }
 
 void BaseVulkanApplication::createGraphicsPipeline()
 {
-	auto vertShaderCode = readFile("shader/tri.vert.spv");
-	auto fragShaderCode = readFile("shader/tri.frag.spv");
-	std::cout << "Shader: " << vertShaderCode.size() << '/' << fragShaderCode.size() << '\n';
-
-	VkShaderModule vertSM = createShaderModule(vertShaderCode);
-	VkShaderModule fragSM = createShaderModule(fragShaderCode);
-
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertSM;
+	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
 	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragSM;
+	fragShaderStageInfo.module = fragShaderModule;
 	fragShaderStageInfo.pName = "main";
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
 	VkPipelineVertexInputStateCreateInfo vertInputInfo{};
 	vertInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertInputInfo.vertexBindingDescriptionCount = 0;
-	vertInputInfo.pVertexBindingDescriptions = nullptr;
-	vertInputInfo.vertexAttributeDescriptionCount = 0;
-	vertInputInfo.pVertexAttributeDescriptions = nullptr;
+	// scene mesh positions: x, y of each x, y, z
+	VkVertexInputBindingDescription vertBinding{};
+	vertBinding.binding = 0;
+	vertBinding.stride = 3 * sizeof(float);
+	vertBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	VkVertexInputAttributeDescription vertAttribute{};
+	vertAttribute.location = 0;
+	vertAttribute.binding = 0;
+	vertAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+	vertAttribute.offset = 0;
+	vertInputInfo.vertexBindingDescriptionCount = 1;
+	vertInputInfo.pVertexBindingDescriptions = &vertBinding;
+	vertInputInfo.vertexAttributeDescriptionCount = 1;
+	vertInputInfo.pVertexAttributeDescriptions = &vertAttribute;
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
 	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
+	// viewport and scissor are dynamic: one pipeline serves windows of any size
 	VkPipelineViewportStateCreateInfo viewportState{};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
 	VkPipelineRasterizationStateCreateInfo rasterizer{};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 	rasterizer.depthClampEnable = VK_FALSE;
@@ -619,12 +1178,22 @@ void BaseVulkanApplication::createGraphicsPipeline()
 	VkPipelineMultisampleStateCreateInfo multisampling{};
 	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
 	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.rasterizationSamples = msaaSamples;
 	multisampling.minSampleShading = 1.0f;
 	multisampling.pSampleMask = nullptr;
 	multisampling.alphaToCoverageEnable = VK_FALSE;
 	multisampling.alphaToOneEnable = VK_FALSE;
 
+	VkPipelineDepthStencilStateCreateInfo depthStencil{};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.minDepthBounds = 0.0f;
+	depthStencil.maxDepthBounds = 1.0f;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
 	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
 	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
 		| VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -648,7 +1217,7 @@ void BaseVulkanApplication::createGraphicsPipeline()
 
 	VkDynamicState dynamicStates[] = {
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 	VkPipelineDynamicStateCreateInfo dynamicState{};
 	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -657,11 +1226,17 @@ void BaseVulkanApplication::createGraphicsPipeline()
 
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
-	pipelineLayoutInfo.pSetLayouts = nullptr;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
-	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout))
+	// with --lights the scene's fragments read the lights and their clusters from set 0
+	VkDescriptorSetLayout lightSetLayout = lightingEnabled ? lighting.descriptorSetLayout() : VK_NULL_HANDLE;
+	pipelineLayoutInfo.setLayoutCount = lightingEnabled ? 1 : 0;
+	pipelineLayoutInfo.pSetLayouts = lightingEnabled ? &lightSetLayout : nullptr;
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(util_DrawCommand);
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &pipelineLayout))
 		throw std::runtime_error("failed to create pipeline layout");
 
 
@@ -676,44 +1251,119 @@ void BaseVulkanApplication::createGraphicsPipeline()
 	pipelineInfo.pViewportState = &viewportState;
 	pipelineInfo.pRasterizationState = &rasterizer;
 	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr;
+	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.pDynamicState = &dynamicState;
+
+	// without a render pass the pipeline only needs the attachment formats
+	VkPipelineRenderingCreateInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &sceneFormat;
+	renderingInfo.depthAttachmentFormat = depthFormat;
+	renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
 
+	pipelineInfo.pNext = dynamicRendering ? &renderingInfo : nullptr;
 	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.renderPass = dynamicRendering ? VK_NULL_HANDLE : renderPass;
 	pipelineInfo.subpass = 0;
 
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 
-	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline);
+	// every variant differs only in its fragment specialization, built in one call;
+	// with --lights each is lit.frag twice, clustered then naive
+	uint32_t pipelineCount = lightingEnabled ? 2 * SCENE_VARIANT_COUNT : SCENE_VARIANT_COUNT;
+	std::vector<SpecializationInfo<util_SceneVariant>> specializations;
+	std::vector<SpecializationInfo<LitVariant>> litSpecializations;
+	specializations.reserve(SCENE_VARIANT_COUNT);
+	litSpecializations.reserve(pipelineCount);
+	std::vector<VkPipelineShaderStageCreateInfo> variantStages(2 * pipelineCount);
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(pipelineCount, pipelineInfo);
+	for (uint32_t i = 0; i < pipelineCount; i++)
+	{
+		const auto& variant = SCENE_VARIANTS[i % SCENE_VARIANT_COUNT];
+		variantStages[2 * i] = vertShaderStageInfo;
+		variantStages[2 * i + 1] = fragShaderStageInfo;
+		if (lightingEnabled)
+		{
+			VkBool32 clustered = i < SCENE_VARIANT_COUNT ? VK_TRUE : VK_FALSE;
+			litSpecializations.emplace_back(LitVariant{ variant.quantizeLevels, variant.intensity, clustered,
+				lighting.grid() });
+			variantStages[2 * i + 1].module = litShaderModule;
+			variantStages[2 * i + 1].pSpecializationInfo = litSpecializations.back().get();
+		}
+		else
+		{
+			specializations.emplace_back(variant);
+			variantStages[2 * i + 1].pSpecializationInfo = specializations.back().get();
+		}
+		pipelineInfos[i].pStages = &variantStages[2 * i];
+	}
+
+	std::vector<VkPipeline> pipelines(pipelineCount, VK_NULL_HANDLE);
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, pipelineCount, pipelineInfos.data(),
+		allocator, pipelines.data());
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to create graphics pipeline!");
+	graphicsPipelines.assign(pipelines.begin(), pipelines.begin() + SCENE_VARIANT_COUNT);
+	naivePipelines.assign(pipelines.begin() + SCENE_VARIANT_COUNT, pipelines.end());
+	if (!particlesEnabled)
+		return;
 
-	vkDestroyShaderModule(device, fragSM, nullptr);
-	vkDestroyShaderModule(device, vertSM, nullptr);
+	// particles: no vertex input, the vertex shader reads them from set 0; the plain
+	// fragment variant, no culling since the quads face either way
+	VkPipelineLayoutCreateInfo particleLayoutInfo = pipelineLayoutInfo;
+	VkDescriptorSetLayout particleSetLayout = particles.descriptorSetLayout();
+	particleLayoutInfo.setLayoutCount = 1;
+	particleLayoutInfo.pSetLayouts = &particleSetLayout;
+	// the draw constants, then the first particle of the live half
+	VkPushConstantRange particlePushRange = pushConstantRange;
+	particlePushRange.size = sizeof(util_DrawCommand) + sizeof(uint32_t);
+	particleLayoutInfo.pPushConstantRanges = &particlePushRange;
+	if (vkCreatePipelineLayout(device, &particleLayoutInfo, allocator, &particlePipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle pipeline layout!");
+
+	VkPipelineShaderStageCreateInfo particleStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+	particleStages[0].module = particleShaderModule;
+	VkPipelineVertexInputStateCreateInfo particleInputInfo{};
+	particleInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	VkPipelineRasterizationStateCreateInfo particleRasterizer = rasterizer;
+	particleRasterizer.cullMode = VK_CULL_MODE_NONE;
+
+	VkGraphicsPipelineCreateInfo particleInfo = pipelineInfo;
+	particleInfo.pStages = particleStages;
+	particleInfo.pVertexInputState = &particleInputInfo;
+	particleInfo.pRasterizationState = &particleRasterizer;
+	particleInfo.layout = particlePipelineLayout;
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &particleInfo, allocator, &particlePipeline) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle pipeline!");
 }
 
-void BaseVulkanApplication::createFramebuffers()
+void BaseVulkanApplication::createFramebuffers(util_RenderTarget& target)
 {
-	swapChainFramebuffers.resize(swapChainImageViews.size());
+	target.framebuffers.resize(target.imageViews.size());
 
-	for (size_t i = 0; i < swapChainImageViews.size(); i++)
+	for (size_t i = 0; i < target.imageViews.size(); i++)
 	{
-		VkImageView attachments[] = {
-			swapChainImageViews[i]
-		};
+		// same order as createRenderPass(): color, depth, resolve
+		VkImageView output = postEnabled ? postProcess.sceneView(target.id) : target.imageViews[i];
+		std::vector<VkImageView> attachments;
+		if (msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+			attachments = { target.colorAttachment.view, target.depthAttachment.view, output };
+		else
+			attachments = { output, target.depthAttachment.view };
+
 		VkFramebufferCreateInfo framebufferInfo{};
 		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = attachments;
-		framebufferInfo.width = swapChainExtent.width;
-		framebufferInfo.height = swapChainExtent.height;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferInfo.pAttachments = attachments.data();
+		framebufferInfo.width = target.extent.width;
+		framebufferInfo.height = target.extent.height;
 		framebufferInfo.layers = 1;
 
-		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
+		if (vkCreateFramebuffer(device, &framebufferInfo, allocator, &target.framebuffers[i]) != VK_SUCCESS)
 			throw std::runtime_error("failed to create framebuffer");
 	}
 }
@@ -724,215 +1374,1424 @@ void BaseVulkanApplication::createCommandPool()
 	VkCommandPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-	poolInfo.flags = 0;
+	// primaries are recorded again every frame from the newest snapshot, segments when they change
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	VkResult result = vkCreateCommandPool(device, &poolInfo, allocator, &commandPool);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed create command pool!");
+
+	if (segmentCacheEnabled)
+	{
+		segments.init(device, commandPool,
+			std::vector<std::string>(SCENE_PASS_NAMES, SCENE_PASS_NAMES + SCENE_PASS_COUNT), MAX_FRAMES_IN_FLIGHT);
+	}
+}
+
+void BaseVulkanApplication::createScene()
+{
+	cullPath = cullSupportedPath();
+	std::cout << "Culling: " << cullPathName(cullPath) << std::endl;
+
+	// generated back to front, the worst case for overdraw
+	opaqueDraws.resize(SCENE_OPAQUE_DRAWS);
+	for (uint32_t i = 0; i < SCENE_OPAQUE_DRAWS; i++)
+	{
+		float t = static_cast<float>(i) / static_cast<float>(SCENE_OPAQUE_DRAWS - 1);
+		auto& draw = opaqueDraws[i];
+		draw.offset[0] = -0.3f + 0.6f * t;
+		draw.offset[1] = -0.15f + 0.3f * t;
+		draw.depth = 0.9f - 0.8f * t;
+		draw.scale = 1.6f - 0.8f * t;
+	}
+
+	// variants in depth bands, nearest first: sorting by pipeline then keeps front to back
+	opaquePipelines.resize(SCENE_OPAQUE_DRAWS);
+	for (uint32_t i = 0; i < SCENE_OPAQUE_DRAWS; i++)
+		opaquePipelines[i] = (SCENE_OPAQUE_DRAWS - 1 - i) * SCENE_VARIANT_COUNT / SCENE_OPAQUE_DRAWS;
+
+	// backdrop: two rows of triangles behind everything, they never animate
+	backdropDraws.resize(SCENE_BACKDROP_DRAWS);
+	uint32_t columns = (SCENE_BACKDROP_DRAWS + 1) / 2;
+	for (uint32_t i = 0; i < SCENE_BACKDROP_DRAWS; i++)
+	{
+		auto& draw = backdropDraws[i];
+		draw.offset[0] = -0.7f + 1.4f * static_cast<float>(i % columns) / static_cast<float>(std::max(columns - 1, 1u));
+		draw.offset[1] = i < columns ? -0.5f : 0.5f;
+		draw.depth = 0.98f;
+		draw.scale = 0.9f;
+	}
+
+	// hierarchy: the camera is the root, moving it moves everything under it
+	cameraNode = transforms.create(TransformHierarchy::NONE, TransformMatrix::identity());
+	drawNodes.clear();
+	for (const auto* draws : { &opaqueDraws, &backdropDraws })
+	{
+		for (const auto& draw : *draws)
+		{
+			drawNodes.push_back(transforms.create(cameraNode,
+				TransformMatrix::translateScale(draw.offset[0], draw.offset[1], draw.depth, draw.scale)));
+		}
+	}
+	drawLods.assign(drawNodes.size(), 0);
+}
+
+void BaseVulkanApplication::createSceneMesh()
+{
+	// 1. outline of the triangle with rounded corners: shrunk towards its incentre by
+	// the corner radius, then grown back by arcs around the shrunk corners
+	const float corners[3][2] = { { 0.0f, -0.5f }, { 0.5f, 0.5f }, { -0.5f, 0.5f } };
+	float sides[3], perimeter = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		const float* a = corners[(i + 1) % 3];
+		const float* b = corners[(i + 2) % 3];
+		sides[i] = std::hypot(b[0] - a[0], b[1] - a[1]);
+		perimeter += sides[i];
+	}
+	float center[2] = {};
+	for (int i = 0; i < 3; i++)
+	{
+		center[0] += sides[i] * corners[i][0] / perimeter;
+		center[1] += sides[i] * corners[i][1] / perimeter;
+	}
+	float area = 0.5f * std::fabs((corners[1][0] - corners[0][0]) * (corners[2][1] - corners[0][1])
+		- (corners[2][0] - corners[0][0]) * (corners[1][1] - corners[0][1]));
+	float inradius = 2.0f * area / perimeter;
+	float shrink = (inradius - SCENE_MESH_CORNER_RADIUS) / inradius;
+	auto shrunk = [&](int i, int axis) { return center[axis] + (corners[i][axis] - center[axis]) * shrink; };
+	// outward normal of the side from corner a to corner b
+	auto normalAngle = [&](int a, int b) {
+		float nx = corners[b][1] - corners[a][1], ny = corners[a][0] - corners[b][0];
+		float mx = 0.5f * (corners[a][0] + corners[b][0]) - center[0];
+		float my = 0.5f * (corners[a][1] + corners[b][1]) - center[1];
+		return nx * mx + ny * my < 0.0f ? std::atan2(-ny, -nx) : std::atan2(ny, nx);
+	};
+
+	std::vector<float> outline;
+	for (int i = 0; i < 3; i++)
+	{
+		// the arc turns the short way from one side's normal to the next one's
+		const float pi = 3.14159265f;
+		float begin = normalAngle((i + 2) % 3, i), end = normalAngle(i, (i + 1) % 3);
+		if (end - begin > pi) end -= 2.0f * pi;
+		if (begin - end > pi) end += 2.0f * pi;
+		for (uint32_t s = 0; s <= SCENE_MESH_ARC_SEGMENTS; s++)
+		{
+			float angle = begin + (end - begin) * s / SCENE_MESH_ARC_SEGMENTS;
+			outline.push_back(shrunk(i, 0) + SCENE_MESH_CORNER_RADIUS * std::cos(angle));
+			outline.push_back(shrunk(i, 1) + SCENE_MESH_CORNER_RADIUS * std::sin(angle));
+		}
+		// the straight side on to the next arc
+		size_t arcEnd = outline.size() - 2;
+		float dx = shrunk((i + 1) % 3, 0) - shrunk(i, 0), dy = shrunk((i + 1) % 3, 1) - shrunk(i, 1);
+		for (uint32_t s = 1; s < SCENE_MESH_EDGE_SEGMENTS; s++)
+		{
+			float t = static_cast<float>(s) / SCENE_MESH_EDGE_SEGMENTS;
+			outline.push_back(outline[arcEnd] + dx * t);
+			outline.push_back(outline[arcEnd + 1] + dy * t);
+		}
+	}
+
+	// 2. the centre, then rings scaled from it to the outline; same winding as the
+	// corners, which are clockwise on screen
+	auto count = static_cast<uint32_t>(outline.size() / 2);
+	std::vector<float> positions = { center[0], center[1], 0.0f };
+	for (uint32_t ring = 1; ring <= SCENE_MESH_RINGS; ring++)
+	{
+		float t = static_cast<float>(ring) / SCENE_MESH_RINGS;
+		for (uint32_t j = 0; j < count; j++)
+		{
+			positions.push_back(center[0] + (outline[2 * j] - center[0]) * t);
+			positions.push_back(center[1] + (outline[2 * j + 1] - center[1]) * t);
+			positions.push_back(0.0f);
+		}
+	}
+	auto vertex = [count](uint32_t ring, uint32_t j) { return 1 + (ring - 1) * count + j % count; };
+	std::vector<uint32_t> indices;
+	for (uint32_t j = 0; j < count; j++)
+	{
+		indices.insert(indices.end(), { 0u, vertex(1, j), vertex(1, j + 1) });
+		for (uint32_t ring = 1; ring < SCENE_MESH_RINGS; ring++)
+		{
+			indices.insert(indices.end(), { vertex(ring, j), vertex(ring + 1, j), vertex(ring + 1, j + 1),
+				vertex(ring, j), vertex(ring + 1, j + 1), vertex(ring, j + 1) });
+		}
+	}
+
+	// 3. LOD chain, what a mesh converter would store along with the mesh
+	sceneMesh = buildLodChain(std::move(positions), std::move(indices), LOD_MAX_LEVELS);
+	std::ostringstream levels;
+	for (const auto& level : sceneMesh.levels)
+		levels << (levels.tellp() > 0 ? "/" : "") << level.indexCount / 3;
+	std::cout << "LOD: " << sceneMesh.levels.size() << " levels, " << levels.str() << " triangles"
+		<< (options.lod ? "" : ", off") << std::endl;
+
+	// 4. one buffer for all of it, written once: host visible, device local if there is such memory
+	VkDeviceSize vertexBytes = sceneMesh.positions.size() * sizeof(float);
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = vertexBytes + sceneMesh.indices.size() * sizeof(uint32_t);
+	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &sceneBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create scene buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, sceneBuffer, &memRequirements);
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkAllocateMemory(device, &allocInfo, allocator, &sceneMemory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate scene buffer memory!");
+	vkBindBufferMemory(device, sceneBuffer, sceneMemory, 0);
+
+	void* data = nullptr;
+	if (vkMapMemory(device, sceneMemory, 0, bufferInfo.size, 0, &data) != VK_SUCCESS)
+		throw std::runtime_error("failed to map scene buffer memory!");
+	std::memcpy(data, sceneMesh.positions.data(), vertexBytes);
+	std::memcpy(static_cast<char*>(data) + vertexBytes, sceneMesh.indices.data(),
+		sceneMesh.indices.size() * sizeof(uint32_t));
+	vkUnmapMemory(device, sceneMemory);
+	sceneIndexOffset = vertexBytes;
 }
 
-void BaseVulkanApplication::createCommandBuffers()
+void BaseVulkanApplication::createQueryPool(util_RenderTarget& target)
 {
-	commandBuffers.resize(swapChainFramebuffers.size());
+	auto imageCount = static_cast<uint32_t>(target.images.size());
+
+	// 1. fragment shader invocations, one query per swap chain image
+	if (pipelineStatsSupported)
+	{
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		queryPoolInfo.queryCount = imageCount;
+		queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, allocator, &target.statsQueryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create query pool!");
+	}
+
+	// 2. GPU frame time, a begin/end timestamp pair per swap chain image
+	auto graphicsFamily = findQueueFamilies(physicalDevice).graphicsFamily.value();
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[graphicsFamily].timestampValidBits;
+	if (validBits > 0)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * imageCount;
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, allocator, &target.timingQueryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create query pool!");
+	}
+}
+
+void BaseVulkanApplication::createCommandBuffers(util_RenderTarget& target)
+{
+	target.commandBuffers.resize(target.images.size());
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+	allocInfo.commandBufferCount = (uint32_t)target.commandBuffers.size();
 
-	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data());
+	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, target.commandBuffers.data());
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to allocate command buffers");
+}
+
+void BaseVulkanApplication::recordCommandBuffer(util_RenderTarget& target, const util_FrameSnapshot& snapshot)
+{
+	// the image's previous submission has finished, so its command buffer can be reused
+	size_t i = target.imageIndex;
+	VkCommandBuffer commandBuffer = target.commandBuffers[i];
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording cmd buffers");
+
+	auto query = static_cast<uint32_t>(i);
+	if (target.statsQueryPool != VK_NULL_HANDLE)
+		vkCmdResetQueryPool(commandBuffer, target.statsQueryPool, query, 1);
+	if (target.timingQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, target.timingQueryPool, 2 * query, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, target.timingQueryPool, 2 * query);
+	}
 
-	for (size_t i = 0; i < commandBuffers.size(); i++)
+	// the query spans the render pass: a pass of secondaries cannot hold other commands
+	if (target.statsQueryPool != VK_NULL_HANDLE)
+		vkCmdBeginQuery(commandBuffer, target.statsQueryPool, query, 0);
+	recordBeginRendering(target, commandBuffer, i);
+	bindTracker.reset();
+	if (segmentCacheEnabled)
+	{
+		// the primary only stitches the passes together, each one replayed from its
+		// segment and recorded again only when its draws changed
+		VkCommandBufferInheritanceRenderingInfoKHR renderingInheritance{};
+		renderingInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		renderingInheritance.colorAttachmentCount = 1;
+		renderingInheritance.pColorAttachmentFormats = &sceneFormat;
+		renderingInheritance.depthAttachmentFormat = depthFormat;
+		renderingInheritance.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+		renderingInheritance.rasterizationSamples = msaaSamples;
+
+		// no framebuffer: a segment serves every swap chain image of the window
+		VkCommandBufferInheritanceInfo inheritance{};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.pNext = dynamicRendering ? &renderingInheritance : nullptr;
+		inheritance.renderPass = dynamicRendering ? VK_NULL_HANDLE : renderPass;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = VK_NULL_HANDLE;
+		inheritance.pipelineStatistics = target.statsQueryPool != VK_NULL_HANDLE
+			? VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT : 0;
+
+		VkCommandBuffer passBuffers[SCENE_PASS_COUNT];
+		uint32_t passCount = 0;
+		for (uint32_t pass = 0; pass < SCENE_PASS_COUNT; pass++)
+		{
+			if (pass == SCENE_PASS_PARTICLES && !particlesEnabled)
+				continue;
+			// the particle draw writes this frame's timestamps and live half, it is recorded every frame
+			uint64_t version = pass == SCENE_PASS_PARTICLES ? frameCounter : snapshot.passVersion[pass];
+			passBuffers[passCount++] = segments.get(target.id, pass, version, frameCounter, inheritance,
+				[&](VkCommandBuffer secondary) { recordPass(target, secondary, snapshot, pass); });
+		}
+		vkCmdExecuteCommands(commandBuffer, passCount, passBuffers);
+	}
+	else
 	{
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0;
-		beginInfo.pInheritanceInfo = nullptr;
-		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-			throw std::runtime_error("failed to begin recording cmd buffers");
+		for (uint32_t pass = 0; pass < SCENE_PASS_COUNT; pass++)
+		{
+			if (pass != SCENE_PASS_PARTICLES || particlesEnabled)
+				recordPass(target, commandBuffer, snapshot, pass);
+		}
+	}
+	recordEndRendering(target, commandBuffer, i);
+	if (target.statsQueryPool != VK_NULL_HANDLE)
+		vkCmdEndQuery(commandBuffer, target.statsQueryPool, query);
+	if (postEnabled)
+		postProcess.record(commandBuffer, target.id, target.imageIndex, captureEnabled && target.id == 0);
+	if (target.timingQueryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, target.timingQueryPool, 2 * query + 1);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record cmd buffers");
+}
+
+void BaseVulkanApplication::recordBeginRendering(const util_RenderTarget& target,
+	VkCommandBuffer commandBuffer, size_t imageIndex)
+{
+	VkClearValue clearValues[2]{};
+	clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
+	clearValues[1].depthStencil = { 1.0f, 0 };
 
+	VkRect2D renderArea{};
+	renderArea.offset = { 0, 0 };
+	renderArea.extent = target.extent;
+
+	if (!dynamicRendering)
+	{
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = swapChainExtent;
+		renderPassInfo.framebuffer = target.framebuffers[imageIndex];
+		renderPassInfo.renderArea = renderArea;
+		renderPassInfo.clearValueCount = 2;
+		renderPassInfo.pClearValues = clearValues;
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+			segmentCacheEnabled ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+		return;
+	}
+
+	bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+	// 1. the layout transitions the render pass did implicitly, old contents discarded
+	VkImageMemoryBarrier barriers[3]{};
+	uint32_t barrierCount = 0;
+	auto transition = [&](VkImage image, VkImageAspectFlags aspect, VkAccessFlags srcAccess,
+		VkAccessFlags dstAccess, VkImageLayout layout) {
+		auto& barrier = barriers[barrierCount++];
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { aspect, 0, 1, 0, 1 };
+	};
+	// the swap chain image is ordered by the acquire semaphore, the shared attachments
+	// by the previous frame's writes; with --post the HDR image takes the swap chain
+	// image's place and was last read by the previous frame's compute chain
+	VkImage output = postEnabled ? postProcess.sceneImage(target.id) : target.images[imageIndex];
+	VkImageView outputView = postEnabled ? postProcess.sceneView(target.id) : target.imageViews[imageIndex];
+	transition(output, VK_IMAGE_ASPECT_COLOR_BIT, 0,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	if (multisampled)
+		transition(target.colorAttachment.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+	if (depthFormat == VK_FORMAT_D24_UNORM_S8_UINT || depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT)
+		depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	transition(target.depthAttachment.image, depthAspect, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+		| (postEnabled ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0),
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, barrierCount, barriers);
+
+	// 2. render straight into the image views, same load/store ops as the render pass
+	VkRenderingAttachmentInfoKHR colorInfo{};
+	colorInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	colorInfo.imageView = multisampled ? target.colorAttachment.view : outputView;
+	colorInfo.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorInfo.resolveMode = multisampled ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE;
+	colorInfo.resolveImageView = multisampled ? outputView : VK_NULL_HANDLE;
+	colorInfo.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorInfo.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorInfo.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+	colorInfo.clearValue = clearValues[0];
+
+	VkRenderingAttachmentInfoKHR depthInfo{};
+	depthInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	depthInfo.imageView = target.depthAttachment.view;
+	depthInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthInfo.resolveMode = VK_RESOLVE_MODE_NONE;
+	depthInfo.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthInfo.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthInfo.clearValue = clearValues[1];
+
+	VkRenderingInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	renderingInfo.flags = segmentCacheEnabled ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+	renderingInfo.renderArea = renderArea;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorInfo;
+	renderingInfo.pDepthAttachment = &depthInfo;
+
+	cmdBeginRendering(commandBuffer, &renderingInfo);
+}
 
-		VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
+void BaseVulkanApplication::recordPass(const util_RenderTarget& target, VkCommandBuffer commandBuffer,
+	const util_FrameSnapshot& snapshot, uint32_t pass)
+{
+	// dynamic state does not carry over into a secondary, every pass sets its own
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)target.extent.width;
+	viewport.height = (float)target.extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = target.extent;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-		vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-		vkCmdEndRenderPass(commandBuffers[i]);
+	// one indirect draw whose instance count the simulation wrote, timed in window 0
+	if (pass == SCENE_PASS_PARTICLES)
+	{
+		util_DrawCommand draw{};
+		draw.offset[0] = -snapshot.camera[0];
+		draw.offset[1] = -snapshot.camera[1];
+		draw.depth = PARTICLE_DEPTH;
+		draw.scale = PARTICLE_SIZE;
+		bindTracker.unbind();
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particlePipeline);
+		vkCmdPushConstants(commandBuffer, particlePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+			0, sizeof(util_DrawCommand), &draw);
+		particles.recordDraw(commandBuffer, particlePipelineLayout, static_cast<uint32_t>(currentFrame), target.id == 0);
+		return;
+	}
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-			throw std::runtime_error("failed to record cmd buffers");
+	// the list is sorted by pass first, so this pass is one contiguous run
+	bindTracker.unbind();
+	// the set never changes, what it holds is rewritten ahead of every frame
+	if (lightingEnabled)
+	{
+		VkDescriptorSet lightSet = lighting.descriptorSet();
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &lightSet,
+			0, nullptr);
 	}
+	const auto& pipelines = lightsNaive ? naivePipelines : graphicsPipelines;
+	for (const auto& entry : snapshot.drawList.items())
+	{
+		if (DrawKey::pass(entry.key) != pass) continue;
+		// pipeline ids index graphicsPipelines, one per SCENE_VARIANTS entry
+		uint32_t pipeline = DrawKey::pipeline(entry.key);
+		if (bindTracker.pipeline(pipeline))
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[pipeline]);
+		if (bindTracker.vertexBuffer(0))
+		{
+			VkDeviceSize vertexOffset = 0;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &sceneBuffer, &vertexOffset);
+			vkCmdBindIndexBuffer(commandBuffer, sceneBuffer, sceneIndexOffset, VK_INDEX_TYPE_UINT32);
+		}
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+			0, sizeof(util_DrawCommand), &snapshot.draws[entry.draw]);
+		// every draw is the scene mesh, at the level its key carries
+		const auto& level = sceneMesh.levels[DrawKey::material(entry.key)];
+		vkCmdDrawIndexed(commandBuffer, level.indexCount, 1, level.firstIndex, 0, 0);
+	}
+}
+
+void BaseVulkanApplication::recordEndRendering(const util_RenderTarget& target,
+	VkCommandBuffer commandBuffer, size_t imageIndex)
+{
+	if (!dynamicRendering)
+	{
+		vkCmdEndRenderPass(commandBuffer);
+		return;
+	}
+
+	cmdEndRendering(commandBuffer);
+
+	// hand the HDR image to the compute chain, which does the presenting side itself
+	if (postEnabled)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = postProcess.sceneImage(target.id);
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+
+	// hand the image to present, or to the capture copy that runs first
+	bool captured = captureEnabled && target.id == 0;
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = captured ? VK_ACCESS_TRANSFER_READ_BIT : 0;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = target.images[imageIndex];
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		captured ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void BaseVulkanApplication::createSyncObjects()
 {
-	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
-
-	VkSemaphoreCreateInfo semaphoreInfo{};
-	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
 	VkFenceCreateInfo fenceInfo{};
 	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS
-			|| vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS
-			|| vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+		if (vkCreateFence(device, &fenceInfo, allocator, &inFlightFences[i]) != VK_SUCCESS)
 			throw std::runtime_error("failed to create synchronization objects!");
+
+	for (auto& target : targets)
+		createTargetSyncObjects(target);
 }
 
-void BaseVulkanApplication::cleanup()
+void BaseVulkanApplication::createTargetSyncObjects(util_RenderTarget& target)
 {
-	cleanupSwapChain();
+	target.imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	target.renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	target.imagesInFlight.resize(target.images.size(), VK_NULL_HANDLE);
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		if (vkCreateSemaphore(device, &semaphoreInfo, allocator, &target.imageAvailableSemaphores[i]) != VK_SUCCESS
+			|| vkCreateSemaphore(device, &semaphoreInfo, allocator, &target.renderFinishedSemaphores[i]) != VK_SUCCESS)
+			throw std::runtime_error("failed to create synchronization objects!");
+}
+
+void BaseVulkanApplication::createFrameCapture()
+{
+	auto indices = findQueueFamilies(physicalDevice);
+	capture.init(physicalDevice, device, indices.graphicsFamily.value(), CAPTURE_SLOTS, allocator);
+	capture.resize(targets.front().extent, colorFormat.format);
+
+	// poll() hands each ready frame over from the render loop, a job consumes it
+	capture.setConsumer([this](const CapturedFrame& frame) {
+		jobs.run([this, frame] { consumeCapturedFrame(frame); }, &captureJobs);
+	});
+
+	// the readback ring is the one thing here that can give memory back: one slot
+	// less on a warning, a single slot when critical, the full ring once it recovers
+	memoryBudget.subscribe([this](uint32_t heapIndex, const MemoryBudget::Heap& heap) {
+		if (heapIndex != capture.memoryHeap()) return;
+		uint32_t slots = heap.pressure == MemoryPressure::Critical ? 1
+			: heap.pressure == MemoryPressure::Warning ? CAPTURE_SLOTS - 1 : CAPTURE_SLOTS;
+		capture.setSlotCount(slots);
+		Logger::get().write(LogLevel::Warning, Logger::NO_KEY, "Budget: heap %u %s, capture ring now %u slot(s)",
+			heapIndex, MemoryBudget::pressureName(heap.pressure), capture.currentSlotCount());
+	});
+}
+
+void BaseVulkanApplication::createPostProcess()
+{
+	auto indices = findQueueFamilies(physicalDevice);
+	bool encodeSrgb = !formatIsSrgb(colorFormat.format);
+	postProcess.init(physicalDevice, device, indices.graphicsFamily.value(), postDirect, encodeSrgb, allocator);
+	std::cout << "Post: HDR scene, compute chain " << (postDirect ? "writes the swap chain" : "blitted to the swap chain")
+		<< std::endl;
+}
+
+void BaseVulkanApplication::createParticles()
+{
+	auto indices = findQueueFamilies(physicalDevice);
+	particles.init(physicalDevice, device, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, allocator);
+	particles.resize(options.benchParticles ? PARTICLE_BENCH_COUNTS[0] : options.particleCount);
+	std::cout << "Particles: " << particles.capacity() << " simulated in compute, drawn indirect";
+	if (options.benchParticles)
+		std::cout << ", benchmark over " << PARTICLE_BENCH_STEPS << " counts of " << STATS_REPORT_FRAMES << " frames";
+	std::cout << std::endl;
+}
+
+void BaseVulkanApplication::createLighting()
+{
+	auto indices = findQueueFamilies(physicalDevice);
+	lighting.init(physicalDevice, device, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, allocator);
+	lighting.setLightCount(options.benchLights ? LIGHT_BENCH_COUNTS[0] : options.lightCount);
+	const auto& grid = lighting.grid();
+	std::cout << "Lighting: " << lighting.lightCount() << " lights, " << grid.x << 'x' << grid.y << 'x' << grid.z
+		<< " clusters of up to " << grid.capacity << ", " << (lightsNaive ? "naive loop" : "clustered");
+	if (options.benchLights)
+		std::cout << ", benchmark over " << LIGHT_BENCH_STEPS << " steps of " << STATS_REPORT_FRAMES << " frames";
+	std::cout << std::endl;
+}
+
+void BaseVulkanApplication::createMetrics()
+{
+	// 1. frame pacing and the fence wait inside it, in seconds
+	metricFrames = metrics.counter("basevk_frames_total", "Frames submitted");
+	metricFrameTime = metrics.histogram("basevk_frame_interval_seconds", "Time between two frame starts",
+		{ 0.002, 0.004, 0.008, 0.0125, 0.0167, 0.025, 0.0333, 0.05, 0.1, 0.25 });
+	metricFenceWait = metrics.histogram("basevk_fence_wait_seconds", "Wait for the frame in flight fence",
+		{ 0.0001, 0.0005, 0.001, 0.002, 0.004, 0.008, 0.0167, 0.0333 });
+
+	// 2. present results per swap chain and what they led to
+	const char* presentHelp = "vkQueuePresentKHR results per swap chain";
+	metricPresentSuccess = metrics.counter("basevk_present_results_total", presentHelp, R"(result="success")");
+	metricPresentSuboptimal = metrics.counter("basevk_present_results_total", presentHelp, R"(result="suboptimal")");
+	metricPresentOutOfDate = metrics.counter("basevk_present_results_total", presentHelp, R"(result="out_of_date")");
+	metricRecreations = metrics.counter("basevk_swapchain_recreations_total", "Swap chains rebuilt");
+
+	// 3. memory: device heaps as VK_EXT_memory_budget sees them, driver host allocations
+	const auto& heaps = memoryBudget.heapStates();
+	for (uint32_t i = 0; i < heaps.size(); i++)
 	{
-		vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-		vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(device, inFlightFences[i], nullptr);
+		std::string labels = "heap=\"" + std::to_string(i) + "\",device_local=\""
+			+ (heaps[i].deviceLocal ? "true" : "false") + "\"";
+		metricHeapUsage.push_back(metrics.gauge("basevk_heap_usage_bytes", "Device memory heap usage", labels));
+		metricHeapBudget.push_back(metrics.gauge("basevk_heap_budget_bytes", "Device memory heap budget", labels));
 	}
+	metricHostLive = metrics.gauge("basevk_host_live_bytes", "Driver host memory live through the allocation callbacks");
 
-	vkDestroyCommandPool(device, commandPool, nullptr);
+	// 4. queue submission: CPU time of the frame's flush, batches it carried
+	metricSubmitTime = metrics.histogram("basevk_submit_seconds", "CPU time of the frame's queue submit",
+		{ 0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.002 });
+	metricSubmitBatches = metrics.counter("basevk_submit_batches_total", "Batches handed to the graphics queue");
 
-	vkDestroyDevice(device, nullptr);
+	// 5. command buffer segments recorded again, or replayed as they were
+	if (segmentCacheEnabled)
+	{
+		for (uint32_t pass = 0; pass < SCENE_PASS_COUNT; pass++)
+		{
+			std::string labels = std::string("segment=\"") + SCENE_PASS_NAMES[pass] + "\"";
+			segments.countInto(pass,
+				metrics.counter("basevk_segment_records_total", "Segments recorded into their secondary", labels),
+				metrics.counter("basevk_segment_reuses_total", "Segments replayed without recording", labels));
+		}
+	}
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	metricsExporter.start(metrics, options.metricsFile, options.metricsSocket);
+}
+
+void BaseVulkanApplication::consumeCapturedFrame(const CapturedFrame& frame)
+{
+	// stand-in consumer: touch every row so the readback cost is real
+	uint32_t checksum = 0;
+	for (uint32_t y = 0; y < frame.height; y++)
+		checksum += frame.data[static_cast<size_t>(y) * frame.rowPitch];
+	(void)checksum;
+	capture.release(frame);
+	captureConsumed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BaseVulkanApplication::cleanup()
+{
+	metricsExporter.stop();
+	jobs.wait(captureJobs);
+	capture.destroy();
+	postProcess.destroy();
+	particles.destroy();
+	lighting.destroy();
+
+	for (auto& target : targets)
+	{
+		cleanupSwapChain(target);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			vkDestroySemaphore(device, target.renderFinishedSemaphores[i], allocator);
+			vkDestroySemaphore(device, target.imageAvailableSemaphores[i], allocator);
+		}
+	}
+
+	for (auto pipeline : graphicsPipelines)
+		vkDestroyPipeline(device, pipeline, allocator);
+	for (auto pipeline : naivePipelines)
+		vkDestroyPipeline(device, pipeline, allocator);
+	vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	vkDestroyPipeline(device, particlePipeline, allocator);
+	vkDestroyPipelineLayout(device, particlePipelineLayout, allocator);
+	vkDestroyRenderPass(device, renderPass, allocator);
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		vkDestroyFence(device, inFlightFences[i], allocator);
+
+	segments.destroy();
+	vkDestroyCommandPool(device, commandPool, allocator);
+	vkDestroyBuffer(device, sceneBuffer, allocator);
+	vkFreeMemory(device, sceneMemory, allocator);
+
+	vkDestroyShaderModule(device, fragShaderModule, allocator);
+	vkDestroyShaderModule(device, vertShaderModule, allocator);
+	vkDestroyShaderModule(device, particleShaderModule, allocator);
+	vkDestroyShaderModule(device, litShaderModule, allocator);
+
+	vkDestroyDevice(device, allocator);
+
+	for (auto& target : targets)
+		vkDestroySurfaceKHR(instance, target.surface, allocator);
 
 #ifndef NDEBUG
-	ext_DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+	ext_DestroyDebugUtilsMessengerEXT(instance, debugMessenger, allocator);
 #endif // !NDEBUG
 
-	vkDestroyInstance(instance, nullptr);
+	vkDestroyInstance(instance, allocator);
 
-	glfwDestroyWindow(window);
+	for (auto& target : targets)
+		glfwDestroyWindow(target.window);
 
 	glfwTerminate();
+	jobs.shutdown();
+	Logger::get().stop();
 }
 
 /**************************************** Runtime **************************************/
 void BaseVulkanApplication::drawFrame()
 {
+	auto frameBegin = util_StartupProfiler::Clock::now();
 	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-	// 1. draw 
-	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, 
-		imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	auto fenceEnd = util_StartupProfiler::Clock::now();
+	metricFenceWait->observe(std::chrono::duration<double>(fenceEnd - frameBegin).count());
+	if (lastFrameBegin.time_since_epoch().count() != 0)
+		metricFrameTime->observe(std::chrono::duration<double>(frameBegin - lastFrameBegin).count());
+	lastFrameBegin = frameBegin;
+
+	memoryBudget.update();
+	const auto& heaps = memoryBudget.heapStates();
+	for (size_t i = 0; i < heaps.size(); i++)
 	{
-		recreateSwapChain();
-		return;
+		metricHeapUsage[i]->set(static_cast<double>(heaps[i].usage));
+		metricHeapBudget[i]->set(static_cast<double>(heaps[i].budget));
 	}
-	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
-		throw std::runtime_error("failed to acquire swap chain image");
-	
-	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
-		vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
-
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame] };
-	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	if (allocator)
+		metricHostLive->set(static_cast<double>(hostAllocator.totals().liveBytes));
+	if (captureEnabled)
+	{
+		capture.complete(inFlightFences[currentFrame]);
+		capture.poll();
+	}
+	if (particlesEnabled)
+		particles.collect(static_cast<uint32_t>(currentFrame));
+	if (lightingEnabled)
+		lighting.collect(static_cast<uint32_t>(currentFrame));
+	// the newest state the update thread published; unchanged if it has not ticked since
+	if (snapshots.acquire())
+		statFreshFrames++;
+	const auto& snapshot = snapshots.front();
+
+	// 1. acquire from every window, one that is out of date is rebuilt and sits this frame out
+	size_t targetCount = targets.size();
+	std::vector<util_RenderTarget*> ready;
+	std::vector<VkSemaphore> signalSemaphores;
+	std::vector<VkSwapchainKHR> swapChains;
+	std::vector<uint32_t> imageIndices;
+	ready.reserve(targetCount);
+
+	for (auto& target : targets)
+	{
+		// a minimized window has nothing to present to
+		if (target.minimized || target.framebufferWidth == 0 || target.framebufferHeight == 0)
+			continue;
 
+		VkResult result = vkAcquireNextImageKHR(device, target.swapChain, UINT64_MAX,
+			target.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &target.imageIndex);
+
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			recreateSwapChain(target);
+			continue;
+		}
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			throw std::runtime_error("failed to acquire swap chain image");
+
+		if (target.imagesInFlight[target.imageIndex] != VK_NULL_HANDLE)
+		{
+			vkWaitForFences(device, 1, &target.imagesInFlight[target.imageIndex], VK_TRUE, UINT64_MAX);
+			collectFrameStats(target);
+		}
+		target.imagesInFlight[target.imageIndex] = inFlightFences[currentFrame];
+
+		// the particle simulation goes once, ahead of the first window that draws them;
+		// recorded first too, the draws read the half it leaves live
+		if (particlesEnabled && ready.empty())
+			graphicsSubmit.enqueue(particles.record(static_cast<uint32_t>(currentFrame)));
+		// so do the lights, at the snapshot's time and relative to its camera
+		if (lightingEnabled && ready.empty())
+			graphicsSubmit.enqueue(lighting.record(static_cast<uint32_t>(currentFrame), snapshot.time,
+				snapshot.camera, !lightsNaive));
+		recordCommandBuffer(target, snapshot);
+
+		// each window is its own batch: it waits for its own image only, and presents
+		// without waiting on the others; with --post the scene renders before the
+		// swap chain image is needed
+		ready.push_back(&target);
+		SubmitSemaphore acquired{ target.imageAvailableSemaphores[currentFrame],
+			postEnabled ? postProcess.outputStage() : VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT };
+		SubmitSemaphore rendered{ target.renderFinishedSemaphores[currentFrame], VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT };
+
+		// the capture copy reads the image before it is presented, so it joins the window's batch
+		VkCommandBuffer copy = VK_NULL_HANDLE;
+		if (captureEnabled && target.id == 0)
+			copy = capture.record(target.images[target.imageIndex], inFlightFences[currentFrame], frameCounter);
+		if (copy == VK_NULL_HANDLE)
+			graphicsSubmit.enqueue(target.commandBuffers[target.imageIndex], { acquired }, { rendered });
+		else
+		{
+			graphicsSubmit.enqueue(target.commandBuffers[target.imageIndex], { acquired });
+			graphicsSubmit.enqueue(copy, {}, { rendered });
+		}
+		signalSemaphores.push_back(target.renderFinishedSemaphores[currentFrame]);
+		swapChains.push_back(target.swapChain);
+		imageIndices.push_back(target.imageIndex);
+	}
+	if (ready.empty()) return;
+
+	// 2. one submit for all windows
 	vkResetFences(device, 1, &inFlightFences[currentFrame]);
-	result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
+	VkResult result = graphicsSubmit.flush(inFlightFences[currentFrame]);
 	if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to submit draw cmd buffers");
+	metricSubmitTime->observe(graphicsSubmit.lastFlushSeconds());
+	metricSubmitBatches->add(graphicsSubmit.lastBatchCount());
 
-	// 2. present
+	// 3. present every window with a single call, results come back per swap chain
+	std::vector<VkResult> presentResults(ready.size(), VK_SUCCESS);
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
-
-	VkSwapchainKHR swapChains[] = { swapChain };
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &imageIndex;
-	presentInfo.pResults = nullptr;
+	presentInfo.waitSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	presentInfo.pWaitSemaphores = signalSemaphores.data();
+	presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+	presentInfo.pSwapchains = swapChains.data();
+	presentInfo.pImageIndices = imageIndices.data();
+	presentInfo.pResults = presentResults.data();
 
 	result = vkQueuePresentKHR(presentQueue, &presentInfo);
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+	if (!startupProfiler.isFinished())
 	{
-		framebufferResized = false;
-		recreateSwapChain();
+		startupProfiler.record("firstFrame", frameBegin, util_StartupProfiler::Clock::now());
+		startupProfiler.finish();
+		std::ostringstream report;
+		startupProfiler.report(report);
+		Logger::get().write(LogLevel::Info, report.str());
 	}
-	else if (result != VK_SUCCESS)
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)
 		throw std::runtime_error("failed to present swap chain image");
+	for (size_t i = 0; i < ready.size(); i++)
+	{
+		auto& target = *ready[i];
+		if (presentResults[i] == VK_SUCCESS) metricPresentSuccess->add();
+		else if (presentResults[i] == VK_SUBOPTIMAL_KHR) metricPresentSuboptimal->add();
+		else if (presentResults[i] == VK_ERROR_OUT_OF_DATE_KHR) metricPresentOutOfDate->add();
+
+		if (presentResults[i] == VK_ERROR_OUT_OF_DATE_KHR || presentResults[i] == VK_SUBOPTIMAL_KHR
+			|| target.framebufferResized)
+		{
+			recreateSwapChain(target);
+		}
+		else if (presentResults[i] != VK_SUCCESS)
+			throw std::runtime_error("failed to present swap chain image");
+	}
 	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	frameCounter++;
+	framesPresented.fetch_add(1, std::memory_order_relaxed);
+	metricFrames->add();
+
+	statDrawsVisible += snapshot.drawList.size();
+	statDrawsTotal += snapshot.draws.size();
+	statTriangles += snapshot.triangles;
+	if (statFrames++ == 0)
+	{
+		statBegin = frameBegin;
+		statTickBegin = simTick.load(std::memory_order_relaxed);
+		for (uint32_t scope = 0; scope < HostAllocator::SCOPE_COUNT; scope++)
+			statHostBegin[scope] = hostAllocator.totals(static_cast<VkSystemAllocationScope>(scope));
+	}
+	if (statFrames >= STATS_REPORT_FRAMES)
+		reportFrameStats();
+}
+
+void BaseVulkanApplication::collectFrameStats(util_RenderTarget& target)
+{
+	target.statFrames++;
+	if (postEnabled)
+		postProcess.collect(target.id, target.imageIndex);
+
+	uint64_t fragments = 0;
+	if (target.statsQueryPool != VK_NULL_HANDLE
+		&& vkGetQueryPoolResults(device, target.statsQueryPool, target.imageIndex, 1, sizeof(fragments),
+			&fragments, sizeof(fragments), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		target.statFragments += fragments;
+
+	uint64_t timestamps[2] = {};
+	if (target.timingQueryPool != VK_NULL_HANDLE
+		&& vkGetQueryPoolResults(device, target.timingQueryPool, 2 * target.imageIndex, 2, sizeof(timestamps),
+			timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		target.statGpuNs += ((timestamps[1] - timestamps[0]) & timestampMask) * static_cast<double>(timestampPeriod);
 }
 
-void BaseVulkanApplication::cleanupSwapChain()
+void BaseVulkanApplication::reportFrameStats()
 {
-	for (auto framebuffer : swapChainFramebuffers)
-		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	// formatted here, written by the logger thread
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(3);
+
+	// 1. per window
+	double totalGpuMs = 0.0;
+	VkDeviceSize totalCommitted = 0;
+	for (auto& target : targets)
+	{
+		if (target.statFrames == 0) continue;
+
+		double gpuMs = target.statGpuNs / target.statFrames / 1e6;
+		double perFrame = static_cast<double>(target.statFragments) / target.statFrames;
+		double pixels = static_cast<double>(target.extent.width) * target.extent.height;
+		out << "Frame: window " << target.id << ", " << gpuMs << " ms GPU at " << msaaSamples << "x MSAA";
+		if (target.statsQueryPool != VK_NULL_HANDLE)
+		{
+			out << ", fragments " << static_cast<uint64_t>(perFrame) << ", overdraw "
+				<< perFrame / pixels << 'x' << (options.sortOpaque ? " (front to back)" : " (unsorted)");
+		}
+		// lazily allocated attachments only get backing when the driver spills them
+		VkDeviceSize committed = 0;
+		for (const auto* image : { &target.colorAttachment, &target.depthAttachment })
+		{
+			VkDeviceSize bytes = 0;
+			if (image->lazy)
+				vkGetDeviceMemoryCommitment(device, image->memory, &bytes);
+			else
+				bytes = image->size;
+			committed += bytes;
+		}
+		out << ", attachments " << committed / 1048576.0 << " MiB committed" << '\n';
+
+		totalGpuMs += gpuMs;
+		totalCommitted += committed;
+		target.statFragments = 0;
+		target.statGpuNs = 0.0;
+		target.statFrames = 0;
+	}
+
+	// 2. all windows: wall clock per batched present and summed GPU time
+	std::chrono::duration<double, std::milli> elapsed = util_StartupProfiler::Clock::now() - statBegin;
+	double frameMs = elapsed.count() / statFrames;
+	out << "Frames: " << targets.size() << " window(s), " << frameMs << " ms per present ("
+		<< 1000.0 / frameMs << " fps), " << totalGpuMs << " ms GPU, attachments "
+		<< totalCommitted / 1048576.0 << " MiB committed, binds per frame " << bindTracker.issuedCount()
+		<< " issued " << bindTracker.elidedCount() << " elided, " << statTriangles / statFrames
+		<< " triangles (" << (options.lod ? "LOD" : "full detail") << ")";
+	if (captureEnabled)
+	{
+		out << ", captured " << capture.capturedCount() << " consumed " << captureConsumed.load()
+			<< " dropped " << capture.droppedCount();
+	}
+	out << '\n';
+
+	// 3. update thread, on its own clock: ticks since the first frame of this report
+	uint64_t ticks = simTick.load(std::memory_order_relaxed) - statTickBegin;
+	out << "Update: " << ticks * 1000.0 / elapsed.count() << " ticks/s (target " << SIM_TICK_HZ
+		<< "), " << statFreshFrames << " of " << statFrames << " frames took a new snapshot, "
+		<< static_cast<double>(statDrawsVisible) / statFrames << " of "
+		<< static_cast<double>(statDrawsTotal) / statFrames << " draws visible (" << cullPathName(cullPath)
+		<< " culling)\n";
+
+	// 4. driver host allocations per frame, by scope, and what is live now
+	if (allocator)
+	{
+		uint64_t allocations = 0, bytes = 0, arenaHits = 0;
+		std::ostringstream scopes;
+		for (uint32_t scope = 0; scope < HostAllocator::SCOPE_COUNT; scope++)
+		{
+			auto now = hostAllocator.totals(static_cast<VkSystemAllocationScope>(scope));
+			uint64_t count = now.allocations - statHostBegin[scope].allocations;
+			allocations += count;
+			bytes += now.bytes - statHostBegin[scope].bytes;
+			arenaHits += now.arenaHits - statHostBegin[scope].arenaHits;
+			if (count > 0)
+				scopes << ", " << HostAllocator::scopeName(scope) << ' ' << static_cast<double>(count) / statFrames;
+		}
+		out << "Host: " << static_cast<double>(allocations) / statFrames << " driver allocations per frame ("
+			<< static_cast<double>(bytes) / statFrames << " B)" << scopes.str() << ", "
+			<< (allocations > 0 ? 100.0 * arenaHits / allocations : 0.0) << "% from arenas, "
+			<< hostAllocator.totals().liveBytes / 1024.0 << " KiB live\n";
+	}
+
+	// 5. device memory per heap against its budget, with the peaks of earlier reports
+	memoryBudget.report(out);
+
+	// 6. GPU time of each post-processing pass
+	if (postEnabled)
+		postProcess.report(out);
+
+	// 7. segments recorded against replayed, and the recording that saved
+	if (segmentCacheEnabled)
+		segments.report(out, statFrames);
+
+	// 8. queue submissions and their CPU cost
+	graphicsSubmit.report(out, statFrames);
+
+	// 9. GPU time of the particle simulation and of their draw in window 0
+	if (particlesEnabled)
+		particles.report(out);
+
+	// 10. the lights, their path and the GPU time of their upload and binning
+	if (lightingEnabled)
+		lighting.report(out, !lightsNaive);
+	Logger::get().write(LogLevel::Info, out.str());
+	statFrames = 0;
+	statFreshFrames = 0;
+	statDrawsVisible = 0;
+	statDrawsTotal = 0;
+	statTriangles = 0;
+
+	// --bench-particles: the next count once this one is reported, done after the last
+	if (options.benchParticles)
+	{
+		if (++particleBenchStep < PARTICLE_BENCH_STEPS)
+		{
+			vkDeviceWaitIdle(device);
+			particles.resize(PARTICLE_BENCH_COUNTS[particleBenchStep]);
+		}
+		else
+		{
+			renderRunning = false;
+			glfwPostEmptyEvent();
+		}
+	}
+
+	// --bench-lights: each count clustered, then naive; cached passes bind the old
+	// pipelines and light set, so every window records them again
+	if (options.benchLights)
+	{
+		if (++lightBenchStep < LIGHT_BENCH_STEPS)
+		{
+			vkDeviceWaitIdle(device);
+			uint32_t count = LIGHT_BENCH_COUNTS[lightBenchStep / 2];
+			if (count != lighting.lightCount())
+				lighting.setLightCount(count);
+			lightsNaive = lightBenchStep % 2 == 1;
+			if (segmentCacheEnabled)
+			{
+				for (const auto& target : targets)
+					segments.invalidate(target.id);
+			}
+		}
+		else
+		{
+			renderRunning = false;
+			glfwPostEmptyEvent();
+		}
+	}
+}
+
+void BaseVulkanApplication::cleanupSwapChain(util_RenderTarget& target)
+{
+	for (auto framebuffer : target.framebuffers)
+		vkDestroyFramebuffer(device, framebuffer, allocator);
+	target.framebuffers.clear();
 	
-	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(target.commandBuffers.size()),
+		target.commandBuffers.data());
+
+	vkDestroyQueryPool(device, target.statsQueryPool, allocator);
+	vkDestroyQueryPool(device, target.timingQueryPool, allocator);
+	target.statsQueryPool = VK_NULL_HANDLE;
+	target.timingQueryPool = VK_NULL_HANDLE;
+	target.statFragments = 0;
+	target.statGpuNs = 0.0;
+	target.statFrames = 0;
 
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
+	destroyImage(target.colorAttachment);
+	destroyImage(target.depthAttachment);
 
-	for (auto imageView : swapChainImageViews)
-		vkDestroyImageView(device, imageView, nullptr);
+	for (auto imageView : target.imageViews)
+		vkDestroyImageView(device, imageView, allocator);
+
+	vkDestroySwapchainKHR(device, target.swapChain, allocator);
+}
+
+void BaseVulkanApplication::recreateSwapChain(util_RenderTarget& target)
+{
+	// minimized: keep the old swap chain, the window is skipped until it comes back
+	// with a size and the resize flag set again
+	if (target.framebufferWidth == 0 || target.framebufferHeight == 0)
+		return;
+	target.framebufferResized = false;
+	metricRecreations->add();
 
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	vkDeviceWaitIdle(device);
+	auto begin = util_StartupProfiler::Clock::now();
+	auto hostBegin = hostAllocator.totals();
+
+	// render pass and pipeline are shared and size independent, only this window's objects go
+	cleanupSwapChain(target);
+
+	createSwapChain(target);
+	createImageViews(target);
+	createAttachmentImages(target);
+	if (!dynamicRendering)
+		createFramebuffers(target);
+	createQueryPool(target);
+	createCommandBuffers(target);
+	segments.invalidate(target.id);
+	if (target.id == 0 && captureEnabled)
+		capture.resize(target.extent, colorFormat.format);
+
+	target.imagesInFlight.assign(target.images.size(), VK_NULL_HANDLE);
+
+	// render pass path rebuilds a framebuffer per image on every resize
+	std::chrono::duration<double, std::milli> elapsed = util_StartupProfiler::Clock::now() - begin;
+	size_t passObjects = target.framebuffers.size();
+	auto hostEnd = hostAllocator.totals();
+	Logger::get().write(LogLevel::Info, Logger::NO_KEY,
+		"Resize: window %u, %ux%u in %.3f ms, %zu framebuffer objects rebuilt%s, %llu driver host allocations (%.1f KiB)",
+		target.id, target.extent.width, target.extent.height, elapsed.count(), passObjects,
+		dynamicRendering ? " (dynamic rendering)" : " (render pass)",
+		static_cast<unsigned long long>(hostEnd.allocations - hostBegin.allocations),
+		(hostEnd.bytes - hostBegin.bytes) / 1024.0);
 }
 
-void BaseVulkanApplication::recreateSwapChain()
+/**************************************** Main loop **************************************/
+void BaseVulkanApplication::mainLoop()
 {
-	int width = 0, height = 0;
-	glfwGetFramebufferSize(window, &width, &height);
-	while (width == 0 || height == 0)
+	using Clock = util_StartupProfiler::Clock;
+	const auto tick = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / SIM_TICK_HZ));
+	const double dt = 1.0 / SIM_TICK_HZ;
+
+	auto shouldClose = [this] {
+		for (const auto& target : targets)
+			if (glfwWindowShouldClose(target.window)) return true;
+		return false;
+	};
+
+	frameLimiter.setTarget(options.targetFps);
+	cpuReportBegin = Clock::now();
+	cpuReportSeconds = processCpuSeconds();
+	renderRunning = true;
+	renderThread = std::thread(&BaseVulkanApplication::renderLoop, this);
+
+	// the main thread owns GLFW: it handles events and runs fixed-rate updates,
+	// a blocked present on the render thread no longer holds either of them up
+	auto nextTick = Clock::now() + tick;
+	bool idle = false;
+	while (renderRunning && !shouldClose())
 	{
-		glfwGetFramebufferSize(window, &width, &height);
-		glfwWaitEvents();
+		// 1. wait for events: not at all when minimized, up to the next tick while
+		// something moves, and a long while when an on-demand scene is at rest
+		if (allMinimized())
+		{
+			glfwWaitEvents();
+			nextTick = Clock::now();
+		}
+		else if (idle)
+		{
+			glfwWaitEventsTimeout(ON_DEMAND_IDLE_TIMEOUT);
+			nextTick = Clock::now();
+		}
+		else
+		{
+			std::chrono::duration<double> untilTick = nextTick - Clock::now();
+			if (untilTick.count() > 0.0)
+				glfwWaitEventsTimeout(untilTick.count());
+			else
+				glfwPollEvents();
+		}
+
+		// 2. the ticks that are due; too far behind, drop the backlog rather than spiral
+		uint32_t ticks = 0;
+		bool changed = false;
+		while (Clock::now() >= nextTick && ticks < SIM_MAX_CATCHUP_TICKS)
+		{
+			changed |= updateSimulation(dt);
+			nextTick += tick;
+			ticks++;
+		}
+		if (Clock::now() >= nextTick)
+			nextTick = Clock::now() + tick;
+
+		// 3. a changed scene is the reason to draw in on-demand mode
+		if (changed)
+		{
+			publishSnapshot();
+			requestRedraw();
+		}
+		if (ticks > 0)
+			idle = options.onDemand && !changed;
+
+		reportCpuUsage();
 	}
 
+	stopRendering();
+	renderThread.join();
 	vkDeviceWaitIdle(device);
+	if (renderError)
+		std::rethrow_exception(renderError);
+}
 
-	cleanupSwapChain();
+void BaseVulkanApplication::renderLoop()
+{
+	try
+	{
+		while (waitForRedraw())
+		{
+			frameLimiter.wait();
+			drawFrame();
+		}
+	}
+	catch (...)
+	{
+		renderError = std::current_exception();
+		renderRunning = false;
+		glfwPostEmptyEvent();
+	}
+}
 
-	createSwapChain();
-	createImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
-	createFramebuffers();
-	createCommandBuffers();
+bool BaseVulkanApplication::allMinimized() const
+{
+	for (const auto& target : targets)
+	{
+		if (!target.minimized && target.framebufferWidth != 0 && target.framebufferHeight != 0)
+			return false;
+	}
+	return true;
 }
 
-/**************************************** Main loop **************************************/
-void BaseVulkanApplication::mainLoop()
+void BaseVulkanApplication::requestRedraw()
+{
+	std::lock_guard<std::mutex> lock(redrawLock);
+	redrawRequests++;
+	redrawWake.notify_one();
+}
+
+bool BaseVulkanApplication::waitForRedraw()
 {
-	while (!glfwWindowShouldClose(window))
+	// minimized windows suspend the render thread, on-demand mode also waits for a request
+	std::unique_lock<std::mutex> lock(redrawLock);
+	redrawWake.wait(lock, [this] {
+		return !renderRunning || (!allMinimized() && (!options.onDemand || redrawRequests > 0));
+	});
+	redrawRequests = 0;
+	return renderRunning;
+}
+
+void BaseVulkanApplication::stopRendering()
+{
+	std::lock_guard<std::mutex> lock(redrawLock);
+	renderRunning = false;
+	redrawWake.notify_one();
+}
+
+void BaseVulkanApplication::reportCpuUsage()
+{
+	auto now = util_StartupProfiler::Clock::now();
+	std::chrono::duration<double> elapsed = now - cpuReportBegin;
+	if (elapsed.count() < CPU_REPORT_SECONDS) return;
+
+	double cpuSeconds = processCpuSeconds();
+	uint64_t frames = framesPresented.load(std::memory_order_relaxed);
+	uint64_t ticks = simTick.load(std::memory_order_relaxed);
+
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(1);
+	line << "Power: " << (options.onDemand ? "on-demand" : "continuous");
+	if (options.targetFps > 0)
+		line << " capped at " << options.targetFps << " fps";
+	line << ", CPU " << 100.0 * (cpuSeconds - cpuReportSeconds) / elapsed.count() << "% of one core, "
+		<< (frames - cpuReportFrames) / elapsed.count() << " frames/s, "
+		<< (ticks - cpuReportTicks) / elapsed.count() << " ticks/s"
+		<< (allMinimized() ? " (minimized)" : "");
+	Logger::get().write(LogLevel::Info, line.str());
+
+	cpuReportBegin = now;
+	cpuReportSeconds = cpuSeconds;
+	cpuReportFrames = frames;
+	cpuReportTicks = ticks;
+}
+
+bool BaseVulkanApplication::updateSimulation(double dt)
+{
+	// 1. input: arrow keys pan the camera over all windows
+	float pan[2] = {};
+	for (const auto& target : targets)
 	{
-		glfwPollEvents();
-		drawFrame();
+		if (glfwGetKey(target.window, GLFW_KEY_LEFT) == GLFW_PRESS) pan[0] = -1.0f;
+		if (glfwGetKey(target.window, GLFW_KEY_RIGHT) == GLFW_PRESS) pan[0] = 1.0f;
+		if (glfwGetKey(target.window, GLFW_KEY_UP) == GLFW_PRESS) pan[1] = -1.0f;
+		if (glfwGetKey(target.window, GLFW_KEY_DOWN) == GLFW_PRESS) pan[1] = 1.0f;
 	}
-	vkDeviceWaitIdle(device);
+	camera[0] += pan[0] * SIM_CAMERA_SPEED * static_cast<float>(dt);
+	camera[1] += pan[1] * SIM_CAMERA_SPEED * static_cast<float>(dt);
+	simTick.fetch_add(1, std::memory_order_relaxed);
+
+	// 2. advance the clock the scene animates on; an on-demand scene holds still
+	// so that only input changes it
+	if (options.onDemand)
+		return pan[0] != 0.0f || pan[1] != 0.0f;
+	simTime += dt;
+	return true;
+}
+
+void BaseVulkanApplication::publishSnapshot()
+{
+	auto& snapshot = snapshots.back();
+	snapshot.tick = simTick.load(std::memory_order_relaxed);
+	snapshot.time = simTime;
+	snapshot.camera[0] = camera[0];
+	snapshot.camera[1] = camera[1];
+
+	// 0. versions of what changed: the render thread re-records only those passes
+	bool cameraMoved = camera[0] != publishedCamera[0] || camera[1] != publishedCamera[1];
+	bool animated = simTime != publishedTime;
+	if (cameraMoved || animated)
+		passVersion[SCENE_PASS_ANIMATED]++;
+	if (cameraMoved)
+		passVersion[SCENE_PASS_BACKDROP]++;
+	publishedTime = simTime;
+	publishedCamera[0] = camera[0];
+	publishedCamera[1] = camera[1];
+
+	// 1. instance data: the triangles sway around where the scene put them, the backdrop
+	// after them only follows the camera; only what moved is recomputed
+	if (cameraMoved)
+		transforms.setLocal(cameraNode, TransformMatrix::translateScale(-camera[0], -camera[1], 0.0f, 1.0f));
+	if (animated)
+	{
+		for (size_t i = 0; i < opaqueDraws.size(); i++)
+		{
+			float phase = static_cast<float>(simTime) + 0.7f * static_cast<float>(i);
+			const auto& draw = opaqueDraws[i];
+			float depth = std::min(std::max(draw.depth + 0.05f * std::sin(0.5f * phase), 0.0f), 1.0f);
+			transforms.setLocal(drawNodes[i], TransformMatrix::translateScale(draw.offset[0] + 0.05f * std::sin(phase),
+				draw.offset[1] + 0.05f * std::cos(phase), depth, draw.scale));
+		}
+	}
+	transforms.update(&jobs);
+
+	snapshot.draws.resize(drawNodes.size());
+	for (size_t i = 0; i < drawNodes.size(); i++)
+	{
+		const auto& world = transforms.world(drawNodes[i]);
+		auto& draw = snapshot.draws[i];
+		draw.offset[0] = world.translation(0);
+		draw.offset[1] = world.translation(1);
+		draw.depth = world.translation(2);
+		draw.scale = world.m[0];
+	}
+
+	// 2. frustum culling: a triangle's bounding sphere is around its offset, the
+	// corners are half its scale away on both axes
+	auto drawCount = static_cast<uint32_t>(snapshot.draws.size());
+	cullBounds.resize(drawCount);
+	for (uint32_t i = 0; i < drawCount; i++)
+	{
+		const auto& draw = snapshot.draws[i];
+		cullBounds.set(i, draw.offset[0], draw.offset[1], draw.depth, 0.7072f * draw.scale);
+	}
+	cullParallel(jobs, cullPath, CullFrustum::clipSpace(), cullBounds, visibleDraws);
+
+	// 3. draw list of what is left: by pass, pipeline variant, LOD, then front to back so
+	// early depth testing rejects hidden fragments before shading. Only the survivors get
+	// a LOD, from how many pixels a mesh unit covers in the largest window
+	int pixels = 0;
+	for (const auto& target : targets)
+	{
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(target.window, &width, &height);
+		pixels = std::max({ pixels, width, height });
+	}
+	float pixelsPerUnit = 0.5f * static_cast<float>(pixels);		// clip space is 2 units across
+	snapshot.drawList.clear();
+	snapshot.triangles = 0;
+	for (uint32_t i : visibleDraws)
+	{
+		const auto& draw = snapshot.draws[i];
+		bool backdrop = i >= opaqueDraws.size();		// drawn posterized
+		uint32_t pass = backdrop ? SCENE_PASS_BACKDROP : SCENE_PASS_ANIMATED;
+		uint32_t lod = options.lod
+			? sceneMesh.select(pixelsPerUnit * draw.scale, LOD_ERROR_PIXELS, LOD_HYSTERESIS, drawLods[i]) : 0;
+		if (lod != drawLods[i])
+		{
+			drawLods[i] = lod;
+			passVersion[pass]++;		// a window resize can change the backdrop's levels
+		}
+		snapshot.triangles += sceneMesh.levels[lod].indexCount / 3;
+
+		uint32_t depth = options.sortOpaque ? DrawKey::depthBucket(draw.depth) : 0;
+		snapshot.drawList.add(DrawKey::make(pass, backdrop ? 1 : opaquePipelines[i], lod, depth), i);
+	}
+	snapshot.drawList.sort();
+	for (uint32_t pass = 0; pass < SCENE_PASS_COUNT; pass++)
+		snapshot.passVersion[pass] = passVersion[pass];
+
+	snapshots.publish();
 }
 
 
@@ -944,10 +2803,28 @@ VKAPI_ATTR VkBool32 VKAPI_CALL BaseVulkanApplication::debugCallback(
 	const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
 	void* pUserData)
 {
-	//if (messageSeverity < VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
-	//	return VK_FALSE;
-
-	std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+	// performance warnings can fire every frame: queue them, rate limited per message id,
+	// or per message text for the ones without an id
+	LogLevel level = LogLevel::Debug;
+	if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+		level = LogLevel::Error;
+	else if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+		level = LogLevel::Warning;
+
+	if (!Logger::get().enabled(level))
+		return VK_FALSE;
+
+	int64_t key = pCallbackData->messageIdNumber;
+	if (key == 0)
+	{
+		// FNV-1a
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (const char* c = pCallbackData->pMessage; *c; c++)
+			hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3ull;
+		key = static_cast<int64_t>(hash >> 1);
+	}
+	// messages routinely run past a log record, the per-line path splits them
+	Logger::get().write(level, std::string("validation layer: ") + pCallbackData->pMessage, key);
 
 	return VK_FALSE;
 }
@@ -959,6 +2836,10 @@ VkDebugUtilsMessengerCreateInfoEXT BaseVulkanApplication::makeDebugMessengerCrea
 	createInfo.messageSeverity =
 		VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT |
 		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+	// the chatty severities only when --log-level debug would show them anyway
+	if (Logger::get().enabled(LogLevel::Debug))
+		createInfo.messageSeverity |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
 	createInfo.messageType =
 		VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
 		VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
@@ -9,14 +9,37 @@
 #include <iostream>
 #include <stdexcept>
 #include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #include "util.h"
+#include "capture.h"
+#include "culling.h"
+#include "drawlist.h"
+#include "hostalloc.h"
+#include "jobs.h"
+#include "lighting.h"
+#include "lod.h"
+#include "log.h"
+#include "membudget.h"
+#include "metrics.h"
+#include "particles.h"
+#include "postprocess.h"
+#include "segments.h"
+#include "shaders.h"
+#include "submit.h"
+#include "transforms.h"
+#include "triplebuffer.h"
 
 class BaseVulkanApplication
 {
 public:
-	void run()
+	void run(const util_LaunchOptions& launchOptions)
 	{
+		options = launchOptions;
 		initWindow();
 		initVulkan();
 		mainLoop();
@@ -37,77 +60,252 @@ private:	// vulkan
 
 	void setupDebugMessenger();
 
-	void createSurface();
+	void createSurface(util_RenderTarget& target);
 
 	auto findQueueFamilies(VkPhysicalDevice device)->util_QueueFamilyIndices;
-	bool checkDeviceExtSup(VkPhysicalDevice device);
-	auto querySurfaceDetails(VkPhysicalDevice device)->util_SurfaceDetails;
+	bool checkDeviceExtSup(VkPhysicalDevice device, const std::vector<const char*>& required);
+	auto querySurfaceDetails(VkPhysicalDevice device, VkSurfaceKHR surface)->util_SurfaceDetails;
 	bool isDeviceSuitable(VkPhysicalDevice device);
+	auto rateDevice(VkPhysicalDevice device, uint32_t index)->util_DeviceScore;
 	void pickPhysicalDevice();
 
 	void createLogicalDevice();
 
-	void createSwapChain();
+	void createSwapChain(util_RenderTarget& target);
 
-	void createImageViews();
+	void createImageViews(util_RenderTarget& target);
 
-	VkShaderModule createShaderModule(const std::vector<char>& code);
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferred = 0);
+	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
+	auto chooseSampleCount(uint32_t requested)->VkSampleCountFlagBits;
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
+		VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkMemoryPropertyFlags preferred, util_ImageAllocation& image);
+	void destroyImage(util_ImageAllocation& image);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect);
+	void createAttachmentImages(util_RenderTarget& target);
+
+	VkShaderModule createShaderModule(const ShaderCode& code);
+	void loadShaderModules();
 	void createRenderPass();
 	void createGraphicsPipeline();
 
-	void createFramebuffers();
+	void createFramebuffers(util_RenderTarget& target);
 
 	void createCommandPool();
 
-	void createCommandBuffers();
+	void createScene();
+	void createSceneMesh();
+	void createQueryPool(util_RenderTarget& target);
+	void createCommandBuffers(util_RenderTarget& target);
+	void recordCommandBuffer(util_RenderTarget& target, const util_FrameSnapshot& snapshot);
+	void recordBeginRendering(const util_RenderTarget& target, VkCommandBuffer commandBuffer, size_t imageIndex);
+	void recordEndRendering(const util_RenderTarget& target, VkCommandBuffer commandBuffer, size_t imageIndex);
+	void recordPass(const util_RenderTarget& target, VkCommandBuffer commandBuffer,
+		const util_FrameSnapshot& snapshot, uint32_t pass);
 
 	void createSyncObjects();
+	void createTargetSyncObjects(util_RenderTarget& target);
+
+	void createFrameCapture();
+	void consumeCapturedFrame(const CapturedFrame& frame);
+
+	void createPostProcess();
+
+	void createParticles();
+
+	void createLighting();
+
+	void createMetrics();
 
 private:	// runtime
 
+	bool updateSimulation(double dt);
+	void publishSnapshot();
+	void renderLoop();
+	bool allMinimized() const;
+	void requestRedraw();
+	bool waitForRedraw();
+	void stopRendering();
+	void reportCpuUsage();
+
 	void drawFrame();
+	void collectFrameStats(util_RenderTarget& target);
+	void reportFrameStats();
 	
-	void cleanupSwapChain();
+	void cleanupSwapChain(util_RenderTarget& target);
 
-	void recreateSwapChain();
+	void recreateSwapChain(util_RenderTarget& target);
 
 	static void framebufferResizedCallback(GLFWwindow*, int w, int h);
+	static void iconifyCallback(GLFWwindow*, int iconified);
+	static void inputCallback(GLFWwindow* window);
 
 private:
-	GLFWwindow* window;
+	util_LaunchOptions options;
+
+	// every create/destroy goes through it so the driver's host memory is counted
+	HostAllocator hostAllocator;
+	const VkAllocationCallbacks* allocator = nullptr;
+	HostAllocator::Totals statHostBegin[HostAllocator::SCOPE_COUNT];		// per scope at statBegin
+
+	// per-heap usage against VK_EXT_memory_budget, read every frame on the render thread
+	MemoryBudget memoryBudget;
+
 	VkInstance instance;
 
-	VkSurfaceKHR surface;
+	// one per window, target 0 is the primary: device selection and capture use it
+	std::vector<util_RenderTarget> targets;
 
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	
 	VkDevice device;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
-
-	VkSwapchainKHR swapChain;
-	std::vector<VkImage> swapChainImages;
-	VkFormat swapChainImageFormat;
-	VkExtent2D swapChainExtent;
-
-	std::vector<VkImageView> swapChainImageViews;
-
-	VkRenderPass renderPass;
+	SubmitQueue graphicsSubmit;		// render thread: all of a frame's work, submitted at once
+
+	// shared by every target so one render pass and pipeline serve them all
+	VkSurfaceFormatKHR colorFormat{ VK_FORMAT_UNDEFINED, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkFormat depthFormat;
+	VkFormat sceneFormat = VK_FORMAT_UNDEFINED;		// what the scene renders to: colorFormat, or HDR with --post
+
+	// --post: the scene goes to an HDR image per window, a compute chain writes the swap chain
+	bool postEnabled = false;
+	bool postDirect = false;						// storage writes to the swap chain, else a blit
+	bool storageWriteWithoutFormat = false;
+	PostProcess postProcess;
+
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule;
+
+	// --particles: simulated by their own command buffer ahead of the frame's windows,
+	// drawn by the particle pass of each of them
+	bool particlesEnabled = false;
+	ParticleSystem particles;
+	VkShaderModule particleShaderModule = VK_NULL_HANDLE;
+	VkPipelineLayout particlePipelineLayout = VK_NULL_HANDLE;
+	VkPipeline particlePipeline = VK_NULL_HANDLE;
+	uint32_t particleBenchStep = 0;					// --bench-particles: index into PARTICLE_BENCH_COUNTS
+
+	// --lights: binned by their own command buffer ahead of the frame's windows, the
+	// scene pipelines shade with lit.frag and read them from set 0
+	bool lightingEnabled = false;
+	bool lightsNaive = false;						// every fragment loops over every light, nothing binned
+	ClusteredLighting lighting;
+	VkShaderModule litShaderModule = VK_NULL_HANDLE;
+	std::vector<VkPipeline> naivePipelines;			// graphicsPipelines with the naive loop
+	uint32_t lightBenchStep = 0;					// --bench-lights: count LIGHT_BENCH_COUNTS[step / 2], naive when odd
+
+	// dynamic rendering replaces the render pass and framebuffers when available
+	bool dynamicRendering = false;
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+
+	VkRenderPass renderPass = VK_NULL_HANDLE;
 	VkPipelineLayout pipelineLayout;
-	VkPipeline graphicsPipeline;
-
-	std::vector<VkFramebuffer> swapChainFramebuffers;
+	std::vector<VkPipeline> graphicsPipelines;		// by DrawKey pipeline id, see SCENE_VARIANTS
 
 	VkCommandPool commandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
 
-	std::vector<VkSemaphore> imageAvailableSemaphores;
-	std::vector<VkSemaphore> renderFinishedSemaphores;
+	// scene as created; the simulation animates copies of it
+	std::vector<util_DrawCommand> opaqueDraws;
+	std::vector<uint32_t> opaquePipelines;			// variant of each draw
+	std::vector<util_DrawCommand> backdropDraws;
+	BindTracker bindTracker;
+
+	// the one mesh every draw uses, its whole LOD chain in one buffer: vertices, then indices
+	LodChain sceneMesh;
+	VkBuffer sceneBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory sceneMemory = VK_NULL_HANDLE;
+	VkDeviceSize sceneIndexOffset = 0;
+	std::vector<uint32_t> drawLods;					// main thread: each draw's last level, for the hysteresis
+
+	// main thread: every draw is a node under the camera, the snapshot's draws are
+	// read back from their world matrices
+	TransformHierarchy transforms;
+	uint32_t cameraNode = TransformHierarchy::NONE;
+	std::vector<uint32_t> drawNodes;				// opaque then backdrop, like the snapshot's draws
+
+	// main thread: the snapshot's draws outside the clip volume never reach the draw list
+	CullPath cullPath = CullPath::Scalar;
+	CullBounds cullBounds;
+	std::vector<uint32_t> visibleDraws;
+
+	// each draw list pass is a segment, replayed from a secondary until its version changes;
+	// off when pipeline statistics are used but cannot be inherited by secondaries
+	bool segmentCacheEnabled = false;
+	SegmentCache segments;
+
+	// main thread: events and fixed-rate updates, published as snapshots
+	double simTime = 0.0;
+	float camera[2] = {};
+	std::atomic<uint64_t> simTick{ 0 };
+	uint64_t passVersion[SCENE_PASS_COUNT] = {};
+	double publishedTime = -1.0;						// what the last snapshot showed
+	float publishedCamera[2] = {};
+	TripleBuffer<util_FrameSnapshot> snapshots;
+
+	// render thread: takes the newest snapshot each frame, records and presents
+	std::thread renderThread;
+	std::atomic<bool> renderRunning{ false };
+	std::exception_ptr renderError;
+	std::atomic<uint64_t> framesPresented{ 0 };
+	util_FrameLimiter frameLimiter;
+
+	// wakes the render thread: on-demand redraws, restore from minimized, shutdown
+	std::mutex redrawLock;
+	std::condition_variable redrawWake;
+	uint32_t redrawRequests = 1;		// the first frame
+
+	util_StartupProfiler::Clock::time_point cpuReportBegin;
+	double cpuReportSeconds = 0.0;
+	uint64_t cpuReportFrames = 0;
+	uint64_t cpuReportTicks = 0;
+
+	bool pipelineStatsSupported = false;
+	uint64_t timestampMask = 0;
+	float timestampPeriod = 0.0f;
+	uint32_t statFrames = 0;
+	uint32_t statFreshFrames = 0;		// frames that picked up a new snapshot
+	uint64_t statDrawsVisible = 0;		// summed over the frames, after culling
+	uint64_t statDrawsTotal = 0;
+	uint64_t statTriangles = 0;
+	uint64_t statTickBegin = 0;
+	util_StartupProfiler::Clock::time_point statBegin;
+
+	// registered in createMetrics, updated by the render thread, exported by their own
+	MetricsRegistry metrics;
+	MetricsExporter metricsExporter;
+	MetricCounter* metricFrames = nullptr;
+	MetricHistogram* metricFrameTime = nullptr;
+	MetricHistogram* metricFenceWait = nullptr;
+	MetricCounter* metricPresentSuccess = nullptr;
+	MetricCounter* metricPresentSuboptimal = nullptr;
+	MetricCounter* metricPresentOutOfDate = nullptr;
+	MetricCounter* metricRecreations = nullptr;
+	MetricHistogram* metricSubmitTime = nullptr;
+	MetricCounter* metricSubmitBatches = nullptr;
+	std::vector<MetricGauge*> metricHeapUsage;
+	std::vector<MetricGauge*> metricHeapBudget;
+	MetricGauge* metricHostLive = nullptr;
+	util_StartupProfiler::Clock::time_point lastFrameBegin{};
+
+	bool captureEnabled = false;
+	FrameCapture capture;
+	JobCounter captureJobs;
+	std::atomic<uint64_t> captureConsumed{ 0 };
+	uint64_t frameCounter = 0;
+
+	// one submit covers every target, so the in-flight fences are shared
 	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
 	size_t currentFrame = 0;
 
-	bool framebufferResized = false;
+	util_StartupProfiler startupProfiler;
+
+	// initVulkan() calls init() on the main thread, which becomes worker 0 and only
+	// runs jobs while waiting on them; the render thread submits through the shared queue
+	JobSystem jobs;
 private:	// debug
 #ifndef NDEBUG
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
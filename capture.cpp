@@ -0,0 +1,319 @@
+#include "capture.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void FrameCapture::init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t slotCount,
+	const VkAllocationCallbacks* allocator)
+{
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+	this->allocator = allocator;
+	this->slotCount = std::min(slotCount, MAX_SLOTS);
+
+	// slots are re-recorded every time they are reused
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, allocator, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create capture command pool!");
+}
+
+void FrameCapture::resize(VkExtent2D extent, VkFormat format)
+{
+	// caller has idled the device, so every in-flight copy is done
+	poll();
+
+	this->extent = extent;
+	this->format = format;
+	texelSize = formatTexelSize(format);
+	if (texelSize == 0)
+		throw std::runtime_error("frame capture does not support the swap chain format");
+
+	for (auto& slot : slots)
+	{
+		if (slot->state.load(std::memory_order_acquire) == SLOT_FREE)
+			destroySlot(*slot);
+		else
+			orphans.push_back(std::move(slot));
+	}
+	slots.clear();
+
+	for (uint32_t i = 0; i < slotCount; i++)
+	{
+		slots.push_back(std::make_unique<Slot>());
+		createSlot(*slots.back());
+	}
+	nextSlot = 0;
+}
+
+void FrameCapture::setSlotCount(uint32_t count)
+{
+	count = std::min(std::max(count, 1u), MAX_SLOTS);
+	if (count == slotCount) return;
+	slotCount = count;
+	if (slots.empty()) return;		// resize() creates them
+
+	// 1. shrinking: surplus slots become orphans, freed by poll() once their frame is done
+	while (slots.size() > slotCount)
+	{
+		orphans.push_back(std::move(slots.back()));
+		slots.pop_back();
+	}
+
+	// 2. growing: new slots at the current size
+	while (slots.size() < slotCount)
+	{
+		slots.push_back(std::make_unique<Slot>());
+		createSlot(*slots.back());
+	}
+	nextSlot %= slotCount;
+	poll();
+}
+
+void FrameCapture::destroy()
+{
+	for (auto& slot : slots)
+		destroySlot(*slot);
+	for (auto& slot : orphans)
+		destroySlot(*slot);
+	slots.clear();
+	orphans.clear();
+
+	vkDestroyCommandPool(device, commandPool, allocator);
+	commandPool = VK_NULL_HANDLE;
+}
+
+void FrameCapture::createSlot(Slot& slot)
+{
+	VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * texelSize;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &slot.buffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create capture buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, slot.buffer, &memRequirements);
+
+	// host-cached makes the CPU reads fast, any host-visible type is the fallback;
+	// a non-coherent one is invalidated before reading
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	uint32_t memoryType = findMemoryType(physicalDevice, memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+	coherent = (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+	heapIndex = memProperties.memoryTypes[memoryType].heapIndex;
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	if (vkAllocateMemory(device, &allocInfo, allocator, &slot.memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate capture memory!");
+	vkBindBufferMemory(device, slot.buffer, slot.memory, 0);
+
+	// persistently mapped for the lifetime of the slot
+	if (vkMapMemory(device, slot.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped) != VK_SUCCESS)
+		throw std::runtime_error("failed to map capture memory!");
+
+	VkCommandBufferAllocateInfo cmdInfo{};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.commandPool = commandPool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(device, &cmdInfo, &slot.commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate capture command buffer!");
+
+	slot.frame = CapturedFrame{};
+	slot.frame.data = static_cast<const uint8_t*>(slot.mapped);
+	slot.frame.size = size;
+	slot.frame.width = extent.width;
+	slot.frame.height = extent.height;
+	slot.frame.rowPitch = extent.width * texelSize;
+	slot.frame.format = format;
+	slot.frame.handle = &slot;
+}
+
+void FrameCapture::destroySlot(Slot& slot)
+{
+	if (slot.commandBuffer != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(device, commandPool, 1, &slot.commandBuffer);
+	if (slot.mapped != nullptr)
+		vkUnmapMemory(device, slot.memory);
+	vkDestroyBuffer(device, slot.buffer, allocator);
+	vkFreeMemory(device, slot.memory, allocator);
+	slot.commandBuffer = VK_NULL_HANDLE;
+	slot.mapped = nullptr;
+	slot.buffer = VK_NULL_HANDLE;
+	slot.memory = VK_NULL_HANDLE;
+}
+
+VkCommandBuffer FrameCapture::record(VkImage image, VkFence frameFence, uint64_t frameNumber)
+{
+	// 1. take the next slot in ring order, drop the frame if the consumer still holds it
+	if (slots.empty()) return VK_NULL_HANDLE;
+	Slot& slot = *slots[nextSlot];
+	if (slot.state.load(std::memory_order_acquire) != SLOT_FREE)
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return VK_NULL_HANDLE;
+	}
+	nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+
+	// 2. present layout -> copy -> present layout, then make the copy visible to the host;
+	// the frame hands the image over with a dependency whose destination is the transfer stage
+	VkCommandBuffer cmd = slot.commandBuffer;
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording capture buffer");
+
+	VkImageMemoryBarrier toTransfer{};
+	toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toTransfer.srcAccessMask = 0;
+	toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = image;
+	toTransfer.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { extent.width, extent.height, 1 };
+	vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+	VkImageMemoryBarrier toPresent = toTransfer;
+	toPresent.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	toPresent.dstAccessMask = 0;
+	toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	VkBufferMemoryBarrier toHost{};
+	toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toHost.buffer = slot.buffer;
+	toHost.offset = 0;
+	toHost.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		0, 0, nullptr, 1, &toHost, 1, &toPresent);
+
+	if (vkEndCommandBuffer(cmd) != VK_SUCCESS)
+		throw std::runtime_error("failed to record capture buffer");
+
+	slot.fence = frameFence;
+	slot.frame.frameNumber = frameNumber;
+	slot.state.store(SLOT_IN_FLIGHT, std::memory_order_release);
+	return cmd;
+}
+
+void FrameCapture::complete(VkFence signaledFence)
+{
+	for (auto* ring : { &slots, &orphans })
+	{
+		for (auto& slot : *ring)
+		{
+			if (slot->state.load(std::memory_order_acquire) == SLOT_IN_FLIGHT && slot->fence == signaledFence)
+				finish(*slot);
+		}
+	}
+}
+
+void FrameCapture::poll()
+{
+	for (auto* ring : { &slots, &orphans })
+	{
+		for (auto& slot : *ring)
+		{
+			if (slot->state.load(std::memory_order_acquire) == SLOT_IN_FLIGHT
+				&& vkGetFenceStatus(device, slot->fence) == VK_SUCCESS)
+				finish(*slot);
+		}
+	}
+
+	// orphans go away once their copy is done and the consumer gives them back
+	for (auto it = orphans.begin(); it != orphans.end();)
+	{
+		if ((*it)->state.load(std::memory_order_acquire) == SLOT_FREE)
+		{
+			destroySlot(**it);
+			it = orphans.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void FrameCapture::finish(Slot& slot)
+{
+	if (!coherent)
+	{
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = slot.memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(device, 1, &range);
+	}
+
+	slot.fence = VK_NULL_HANDLE;
+	slot.state.store(SLOT_READY, std::memory_order_release);
+	captured.fetch_add(1, std::memory_order_relaxed);
+
+	// the callback owns the frame until it calls release(), possibly from another thread
+	if (consumer)
+	{
+		consumer(slot.frame);
+		return;
+	}
+
+	// cannot overflow: at most MAX_SLOTS slots are ever outstanding
+	uint32_t tail = queueTail.load(std::memory_order_relaxed);
+	queue[tail % QUEUE_SIZE] = &slot;
+	queueTail.store(tail + 1, std::memory_order_release);
+}
+
+void FrameCapture::setConsumer(std::function<void(const CapturedFrame&)> callback)
+{
+	consumer = std::move(callback);
+}
+
+bool FrameCapture::tryAcquire(CapturedFrame& frame)
+{
+	uint32_t head = queueHead.load(std::memory_order_relaxed);
+	if (head == queueTail.load(std::memory_order_acquire))
+		return false;
+
+	frame = queue[head % QUEUE_SIZE]->frame;
+	queueHead.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+void FrameCapture::release(const CapturedFrame& frame)
+{
+	auto slot = static_cast<Slot*>(frame.handle);
+	slot->state.store(SLOT_FREE, std::memory_order_release);
+}
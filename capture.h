@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef XZ_CAPTURE_H
+#define XZ_CAPTURE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+struct CapturedFrame
+{
+	const uint8_t* data = nullptr;
+	VkDeviceSize size = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t rowPitch = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint64_t frameNumber = 0;
+	void* handle = nullptr;			// pass back to release()
+};
+
+// Copies presented swap chain images into a ring of host-visible buffers.
+// The render thread records and polls, it never waits on a copy: a frame
+// whose slot is still held by the consumer is dropped and counted.
+// Ready frames go to the consumer callback, or else to a single-producer
+// single-consumer queue drained with tryAcquire(); either way the slot is
+// held until release().
+class FrameCapture
+{
+public:
+	static const uint32_t MAX_SLOTS = 16;
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t slotCount,
+		const VkAllocationCallbacks* allocator = nullptr);
+	void resize(VkExtent2D extent, VkFormat format);
+	// ring depth, e.g. shrunk under memory pressure; held and in-flight slots finish first
+	void setSlotCount(uint32_t count);
+	void destroy();
+
+	// render thread
+	VkCommandBuffer record(VkImage image, VkFence frameFence, uint64_t frameNumber);
+	void complete(VkFence signaledFence);
+	void poll();
+	void setConsumer(std::function<void(const CapturedFrame&)> callback);
+
+	// consumer thread
+	bool tryAcquire(CapturedFrame& frame);
+	void release(const CapturedFrame& frame);
+
+	uint64_t capturedCount() const { return captured.load(std::memory_order_relaxed); }
+	uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+	uint32_t currentSlotCount() const { return slotCount; }
+	uint32_t memoryHeap() const { return heapIndex; }		// where the slots live
+
+private:
+	enum SlotState : uint32_t { SLOT_FREE, SLOT_IN_FLIGHT, SLOT_READY };
+
+	struct Slot
+	{
+		std::atomic<uint32_t> state{ SLOT_FREE };
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = nullptr;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		CapturedFrame frame;
+	};
+
+	void createSlot(Slot& slot);
+	void destroySlot(Slot& slot);
+	void finish(Slot& slot);
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	uint32_t slotCount = 0;
+	bool coherent = true;
+	uint32_t heapIndex = 0;
+
+	VkExtent2D extent{};
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t texelSize = 0;
+
+	std::vector<std::unique_ptr<Slot>> slots;
+	std::vector<std::unique_ptr<Slot>> orphans;		// resized or trimmed away while in flight or held
+	uint32_t nextSlot = 0;
+
+	std::function<void(const CapturedFrame&)> consumer;
+
+	// ready queue, capacity is a power of two above MAX_SLOTS
+	static const uint32_t QUEUE_SIZE = 32;
+	Slot* queue[QUEUE_SIZE] = {};
+	std::atomic<uint32_t> queueHead{ 0 };		// consumer
+	std::atomic<uint32_t> queueTail{ 0 };		// render thread
+
+	std::atomic<uint64_t> captured{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+};
+
+#endif // !XZ_CAPTURE_H
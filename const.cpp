@@ -8,4 +8,20 @@ const std::vector<const char*> DEBUG_VALIDATION_LAYERS = {
 
 const std::vector<const char*> DEVICE_EXT_REQUIRED = {
 	"VK_KHR_swapchain"
-};
\ No newline at end of file
+};
+
+const std::vector<const char*> DEVICE_EXT_DYNAMIC_RENDERING = {
+	"VK_KHR_dynamic_rendering",
+	"VK_KHR_depth_stencil_resolve",
+	"VK_KHR_create_renderpass2"
+};
+
+const std::vector<const char*> DEVICE_EXT_MEMORY_BUDGET = {
+	"VK_EXT_memory_budget"
+};
+
+const std::vector<const char*> DEVICE_EXT_SYNCHRONIZATION_2 = {
+	"VK_KHR_synchronization2"
+};
+
+const char* const SCENE_PASS_NAMES[SCENE_PASS_COUNT] = { "scene", "backdrop", "particles" };
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 const uint32_t APP_WIDTH = 800;
 const uint32_t APP_HEIGHT = 600;
+const uint32_t APP_MAX_WINDOWS = 8;
 
 static const char* APP_NAME = "Base Vulkan";
 
@@ -18,10 +19,146 @@ const float RENDER_QUEUE_PRIORITY_GRAPHICS = 1.0f;
 const float RENDER_QUEUE_PRIORITY_PRESENT = 1.0f;
 
 extern const std::vector<const char*> DEVICE_EXT_REQUIRED;
+extern const std::vector<const char*> DEVICE_EXT_DYNAMIC_RENDERING;	// pre-1.3 devices only
+extern const std::vector<const char*> DEVICE_EXT_MEMORY_BUDGET;		// optional
+extern const std::vector<const char*> DEVICE_EXT_SYNCHRONIZATION_2;	// optional, pre-1.3 devices only
 
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// physical device selection: environment override, overridden again by --device
+const char* const APP_ENV_DEVICE = "BASEVK_DEVICE";
+
+const uint32_t DEVICE_SCORE_TYPE_DISCRETE = 1000;
+const uint32_t DEVICE_SCORE_TYPE_INTEGRATED = 500;
+const uint32_t DEVICE_SCORE_TYPE_VIRTUAL = 250;
+const uint32_t DEVICE_SCORE_TYPE_CPU = 10;
+const uint32_t DEVICE_SCORE_HEAP_MIB_PER_POINT = 256;
+const uint32_t DEVICE_SCORE_HEAP_MAX = 200;
+const uint32_t DEVICE_SCORE_DEDICATED_TRANSFER = 50;
+const uint32_t DEVICE_SCORE_DEDICATED_COMPUTE = 50;
+
+const uint32_t DEVICE_MIN_IMAGE_DIMENSION_2D = 4096;
+const uint32_t DEVICE_MIN_COLOR_ATTACHMENTS = 1;
+const uint32_t DEVICE_MIN_PUSH_CONSTANTS_SIZE = 128;
+
+// demo scene: overlapping opaque triangles at increasing depth
+const uint32_t SCENE_OPAQUE_DRAWS = 8;
+// and a static backdrop behind them, only the camera moves it
+const uint32_t SCENE_BACKDROP_DRAWS = 6;
+// draw list passes, each recorded as its own cached segment: the animated
+// triangles first, then the backdrop they mostly cover, then the GPU particles
+// in front of both, which are never in the draw list
+const uint32_t SCENE_PASS_ANIMATED = 0;
+const uint32_t SCENE_PASS_BACKDROP = 1;
+const uint32_t SCENE_PASS_PARTICLES = 2;
+const uint32_t SCENE_PASS_COUNT = 3;
+extern const char* const SCENE_PASS_NAMES[SCENE_PASS_COUNT];
+// the mesh every draw uses: the triangle with rounded corners, tessellated far
+// finer than needed so that its LOD chain has something to take away
+const uint32_t SCENE_MESH_ARC_SEGMENTS = 48;		// per rounded corner
+const uint32_t SCENE_MESH_EDGE_SEGMENTS = 32;		// per straight side
+const uint32_t SCENE_MESH_RINGS = 12;				// around the centre, out to the outline
+const float SCENE_MESH_CORNER_RADIUS = 0.08f;
+
+// LOD selection: the coarsest level whose error covers at most LOD_ERROR_PIXELS
+// on screen; moving to a coarser level takes a margin of LOD_HYSTERESIS of that
+const uint32_t LOD_MAX_LEVELS = 8;
+const float LOD_ERROR_PIXELS = 1.0f;
+const float LOD_HYSTERESIS = 0.25f;
+
+// --particles: default capacity, seconds the longest lived particle lasts, and
+// gravity and launch speed in clip units; the emitter sits below the centre
+const uint32_t PARTICLE_DEFAULT_COUNT = 1048576;
+const float PARTICLE_LIFETIME = 2.0f;
+const float PARTICLE_GRAVITY = 1.5f;
+const float PARTICLE_SPEED = 1.2f;
+const float PARTICLE_EMITTER_Y = 0.5f;
+// half the quad's side, and the depth it is drawn at, in front of the scene
+const float PARTICLE_SIZE = 0.004f;
+const float PARTICLE_DEPTH = 0.05f;
+// capacities --bench-particles steps through, one stats report each
+static const uint32_t PARTICLE_BENCH_COUNTS[] = { 65536, 262144, 1048576, 4194304 };
+const uint32_t PARTICLE_BENCH_STEPS = sizeof(PARTICLE_BENCH_COUNTS) / sizeof(PARTICLE_BENCH_COUNTS[0]);
+
+// --lights: default count, the froxel grid over the clip volume and how many
+// lights one cluster lists at most
+const uint32_t LIGHT_DEFAULT_COUNT = 1024;
+const uint32_t LIGHT_CLUSTERS_X = 16;
+const uint32_t LIGHT_CLUSTERS_Y = 9;
+const uint32_t LIGHT_CLUSTERS_Z = 24;
+const uint32_t LIGHT_CLUSTER_CAPACITY = 256;
+// light centres within LIGHT_SPREAD of the origin in x and y, radii in clip units,
+// the share of spot lights, and the unlit level of the scene
+const float LIGHT_SPREAD = 1.5f;
+const float LIGHT_RADIUS_MIN = 0.03f;
+const float LIGHT_RADIUS_MAX = 0.1f;
+const float LIGHT_SPOT_FRACTION = 0.5f;
+const float LIGHT_AMBIENT = 0.1f;
+// counts --bench-lights steps through, each clustered then naive, one stats report each
+static const uint32_t LIGHT_BENCH_COUNTS[] = { 16, 64, 256, 1024, 4096, 16384 };
+const uint32_t LIGHT_BENCH_STEPS = 2 * sizeof(LIGHT_BENCH_COUNTS) / sizeof(LIGHT_BENCH_COUNTS[0]);
+
+// fixed update rate of the simulation thread, and how many late ticks it may
+// run back to back before it gives up catching up
+const uint32_t SIM_TICK_HZ = 120;
+const uint32_t SIM_MAX_CATCHUP_TICKS = 5;
+const float SIM_CAMERA_SPEED = 0.5f;		// arrow keys, NDC units per second
+
+// --on-demand: how long an idle main thread sleeps on events before checking again
+const double ON_DEMAND_IDLE_TIMEOUT = 0.5;
+// frame limiter busy-waits at least this long before each frame slot
+const uint32_t FRAME_LIMITER_MIN_SPIN_US = 500;
+// seconds between two CPU utilization reports
+const uint32_t CPU_REPORT_SECONDS = 5;
+
+// logger: messages with the same key past LOG_RATE_LIMIT per window are dropped
+const uint32_t LOG_RATE_LIMIT = 3;
+const uint32_t LOG_RATE_WINDOW_MS = 1000;
+const uint32_t LOG_FLUSH_INTERVAL_MS = 10;
+
+// frames between two statistics reports
+const uint32_t STATS_REPORT_FRAMES = 600;
+
+// --metrics-file/--metrics-socket: export period, and how often the socket is
+// checked for clients in between
+const uint32_t METRICS_EXPORT_INTERVAL_MS = 1000;
+const uint32_t METRICS_SOCKET_POLL_MS = 100;
+
+// frame readback ring depth, one more than the frames in flight
+const uint32_t CAPTURE_SLOTS = 3;
+
+// VK_EXT_memory_budget: heap usage as a fraction of its budget that raises the
+// pressure level, and how far below it has to fall to lower it again
+const float MEMORY_BUDGET_WARNING = 0.85f;
+const float MEMORY_BUDGET_CRITICAL = 0.95f;
+const float MEMORY_BUDGET_HYSTERESIS = 0.05f;
+// past report intervals kept per heap
+const uint32_t MEMORY_BUDGET_HISTORY = 8;
+
+// --post: bloom mip chain depth and its smallest level, the prefilter threshold in
+// HDR scene units, then what the tonemap and sharpen passes apply
+const uint32_t POST_BLOOM_LEVELS = 5;
+const uint32_t POST_BLOOM_MIN_SIZE = 8;
+const float POST_BLOOM_THRESHOLD = 0.8f;
+const float POST_BLOOM_INTENSITY = 0.6f;
+const float POST_EXPOSURE = 1.0f;
+const float POST_SHARPNESS = 0.3f;
+// gaussian taps either side of the centre, a specialization constant of post_blur
+const uint32_t POST_BLUR_RADIUS = 4;
+
+// default draw count of --bench-sort
+const uint32_t BENCH_SORT_DRAWS = 1000000;
+// default sphere count of --bench-cull
+const uint32_t BENCH_CULL_OBJECTS = 1000000;
+
+// objects per culling job, a multiple of the widest SIMD vector
+const uint32_t CULL_JOB_GRAIN = 16384;
+// default node count of --bench-transforms
+const uint32_t BENCH_TRANSFORM_NODES = 1000000;
+// nodes of one hierarchy level per transform job
+const uint32_t TRANSFORM_JOB_GRAIN = 4096;
+
 
 
 
@@ -0,0 +1,369 @@
+#include "culling.h"
+
+#include "const.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define XZ_CULL_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif // _MSC_VER
+#include <immintrin.h>
+#endif // x86
+
+// MSVC compiles any intrinsic anywhere, GCC and Clang need the ISA per function
+#if defined(XZ_CULL_X86) && !defined(_MSC_VER)
+#define XZ_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define XZ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define XZ_TARGET_SSE41
+#define XZ_TARGET_AVX2
+#endif
+
+namespace
+{
+	// lane masks to compacting shuffles: the set lanes' indices moved to the front
+	struct PackTables
+	{
+		uint8_t sse[16][16];		// pshufb control, 4 lanes
+		uint32_t avx2[256][8];		// vpermd control, 8 lanes
+		uint8_t popcount[256];
+
+		PackTables()
+		{
+			for (uint32_t mask = 0; mask < 256; mask++)
+			{
+				uint32_t n = 0;
+				for (uint32_t lane = 0; lane < 8; lane++)
+				{
+					if (mask & (1u << lane))
+						avx2[mask][n++] = lane;
+				}
+				popcount[mask] = static_cast<uint8_t>(n);
+				for (uint32_t lane = n; lane < 8; lane++)
+					avx2[mask][lane] = 0;
+			}
+			for (uint32_t mask = 0; mask < 16; mask++)
+			{
+				uint32_t n = 0;
+				for (uint32_t lane = 0; lane < 4; lane++)
+				{
+					if ((mask & (1u << lane)) == 0) continue;
+					for (uint32_t byte = 0; byte < 4; byte++)
+						sse[mask][4 * n + byte] = static_cast<uint8_t>(4 * lane + byte);
+					n++;
+				}
+				for (uint32_t byte = 4 * n; byte < 16; byte++)
+					sse[mask][byte] = 0x80;
+			}
+		}
+	};
+
+	const PackTables& packTables()
+	{
+		static const PackTables tables;
+		return tables;
+	}
+
+	uint32_t cullScalar(const CullFrustum& frustum, const CullBounds& bounds, uint32_t begin, uint32_t end,
+		uint32_t* out)
+	{
+		const float* xs = bounds.x();
+		const float* ys = bounds.y();
+		const float* zs = bounds.z();
+		const float* radii = bounds.radius();
+		uint32_t n = 0;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (const auto& plane : frustum.planes)
+			{
+				float distance = plane[0] * xs[i] + plane[1] * ys[i] + plane[2] * zs[i] + plane[3];
+				inside &= distance + radii[i] >= 0.0f;
+			}
+			out[n] = i;
+			n += inside ? 1 : 0;
+		}
+		return n;
+	}
+
+#ifdef XZ_CULL_X86
+	XZ_TARGET_SSE41
+	uint32_t cullSse41(const CullFrustum& frustum, const CullBounds& bounds, uint32_t begin, uint32_t end,
+		uint32_t* out)
+	{
+		const auto& tables = packTables();
+		__m128 planes[6][4];
+		for (int p = 0; p < 6; p++)
+			for (int c = 0; c < 4; c++)
+				planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+
+		const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+		const __m128 zero = _mm_setzero_ps();
+		uint32_t n = 0;
+		for (uint32_t i = begin; i < end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(bounds.x() + i);
+			__m128 y = _mm_loadu_ps(bounds.y() + i);
+			__m128 z = _mm_loadu_ps(bounds.z() + i);
+			__m128 r = _mm_loadu_ps(bounds.radius() + i);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 d = _mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y));
+				d = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+			}
+
+			// compaction: every index stored, the next store starts after the visible ones
+			int mask = _mm_movemask_ps(inside);
+			__m128i indices = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), lanes);
+			__m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.sse[mask]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n), _mm_shuffle_epi8(indices, control));
+			n += tables.popcount[mask];
+		}
+		return n;
+	}
+
+	XZ_TARGET_AVX2
+	uint32_t cullAvx2(const CullFrustum& frustum, const CullBounds& bounds, uint32_t begin, uint32_t end,
+		uint32_t* out)
+	{
+		const auto& tables = packTables();
+		__m256 planes[6][4];
+		for (int p = 0; p < 6; p++)
+			for (int c = 0; c < 4; c++)
+				planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256 zero = _mm256_setzero_ps();
+		uint32_t n = 0;
+		for (uint32_t i = begin; i < end; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(bounds.x() + i);
+			__m256 y = _mm256_loadu_ps(bounds.y() + i);
+			__m256 z = _mm256_loadu_ps(bounds.z() + i);
+			__m256 r = _mm256_loadu_ps(bounds.radius() + i);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 d = _mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y));
+				d = _mm256_add_ps(d, _mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(inside);
+			__m256i indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), lanes);
+			__m256i control = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tables.avx2[mask]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), _mm256_permutevar8x32_epi32(indices, control));
+			n += tables.popcount[mask];
+		}
+		return n;
+	}
+
+	void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+		for (int i = 0; i < 4; i++)
+			regs[i] = static_cast<uint32_t>(info[i]);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif // _MSC_VER
+	}
+
+	uint64_t xgetbv0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif // _MSC_VER
+	}
+
+	CullPath detectPath()
+	{
+		uint32_t regs[4];
+		cpuid(0, 0, regs);
+		uint32_t maxLeaf = regs[0];
+		if (maxLeaf < 1) return CullPath::Scalar;
+
+		// 1. SSE4.1, with SSSE3 for the shuffle
+		cpuid(1, 0, regs);
+		bool ssse3 = (regs[2] & (1u << 9)) != 0;
+		bool sse41 = (regs[2] & (1u << 19)) != 0;
+		bool osxsave = (regs[2] & (1u << 27)) != 0;
+		bool avx = (regs[2] & (1u << 28)) != 0;
+		if (!ssse3 || !sse41) return CullPath::Scalar;
+
+		// 2. AVX2 needs the OS to save the upper halves of the registers too
+		if (!osxsave || !avx || (xgetbv0() & 0x6) != 0x6 || maxLeaf < 7)
+			return CullPath::Sse41;
+		cpuid(7, 0, regs);
+		return (regs[1] & (1u << 5)) != 0 ? CullPath::Avx2 : CullPath::Sse41;
+	}
+#else
+	CullPath detectPath()
+	{
+		return CullPath::Scalar;
+	}
+#endif // XZ_CULL_X86
+}
+
+
+///// CullBounds
+void CullBounds::resize(uint32_t count)
+{
+	this->count = count;
+	uint32_t padded = (count + LANES - 1) / LANES * LANES;
+	xs.resize(padded);
+	ys.resize(padded);
+	zs.resize(padded);
+	radii.resize(padded);
+	for (uint32_t i = count; i < padded; i++)
+		set(i, 0.0f, 0.0f, 0.0f, -std::numeric_limits<float>::infinity());
+}
+
+
+///// CullFrustum
+CullFrustum CullFrustum::clipSpace()
+{
+	return { {
+		{ 1.0f, 0.0f, 0.0f, 1.0f },		// x >= -1
+		{ -1.0f, 0.0f, 0.0f, 1.0f },	// x <= 1
+		{ 0.0f, 1.0f, 0.0f, 1.0f },		// y >= -1
+		{ 0.0f, -1.0f, 0.0f, 1.0f },	// y <= 1
+		{ 0.0f, 0.0f, 1.0f, 0.0f },		// depth >= 0
+		{ 0.0f, 0.0f, -1.0f, 1.0f },	// depth <= 1
+	} };
+}
+
+
+///// culling
+CullPath cullSupportedPath()
+{
+	static const CullPath path = detectPath();
+	return path;
+}
+
+const char* cullPathName(CullPath path)
+{
+	switch (path)
+	{
+	case CullPath::Sse41: return "SSE4.1";
+	case CullPath::Avx2: return "AVX2";
+	default: return "scalar";
+	}
+}
+
+uint32_t cullRange(CullPath path, const CullFrustum& frustum, const CullBounds& bounds,
+	uint32_t begin, uint32_t end, uint32_t* out)
+{
+	// the padding makes whole vectors of the last partial one
+	end = std::min((end + CullBounds::LANES - 1) / CullBounds::LANES * CullBounds::LANES, bounds.paddedSize());
+#ifdef XZ_CULL_X86
+	if (path == CullPath::Avx2)
+		return cullAvx2(frustum, bounds, begin, end, out);
+	if (path == CullPath::Sse41)
+		return cullSse41(frustum, bounds, begin, end, out);
+#endif // XZ_CULL_X86
+	return cullScalar(frustum, bounds, begin, end, out);
+}
+
+void cullParallel(JobSystem& jobs, CullPath path, const CullFrustum& frustum, const CullBounds& bounds,
+	std::vector<uint32_t>& visible)
+{
+	uint32_t count = bounds.size();
+	visible.resize(bounds.paddedSize() + CullBounds::LANES);
+	if (count <= CULL_JOB_GRAIN)
+	{
+		visible.resize(cullRange(path, frustum, bounds, 0, count, visible.data()));
+		return;
+	}
+
+	// 1. every chunk compacts into its own part of the output
+	uint32_t chunks = (count + CULL_JOB_GRAIN - 1) / CULL_JOB_GRAIN;
+	std::vector<uint32_t> chunkVisible(chunks);
+	JobCounter counter;
+	jobs.parallelFor(count, CULL_JOB_GRAIN, [&](uint32_t begin, uint32_t end) {
+		chunkVisible[begin / CULL_JOB_GRAIN] = cullRange(path, frustum, bounds, begin, end, visible.data() + begin);
+	}, &counter);
+	jobs.wait(counter);
+
+	// 2. then the parts move down to close the gaps, always to lower addresses
+	uint32_t n = chunkVisible[0];
+	for (uint32_t chunk = 1; chunk < chunks; chunk++)
+	{
+		const uint32_t* part = visible.data() + chunk * CULL_JOB_GRAIN;
+		std::copy(part, part + chunkVisible[chunk], visible.data() + n);
+		n += chunkVisible[chunk];
+	}
+	visible.resize(n);
+}
+
+
+///// benchmark
+void benchmarkCulling(uint32_t objectCount, std::ostream& out)
+{
+	using Clock = std::chrono::steady_clock;
+	const uint32_t RUNS = 10;
+
+	// 1. spheres scattered around the clip volume, about a third of them inside
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-2.0f, 2.0f), depth(-0.5f, 1.5f), radius(0.0f, 0.05f);
+	CullBounds bounds;
+	bounds.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+		bounds.set(i, position(rng), position(rng), depth(rng), radius(rng));
+	auto frustum = CullFrustum::clipSpace();
+
+	out << std::fixed << std::setprecision(3);
+	out << "Cull: " << objectCount << " spheres against 6 planes, best path " << cullPathName(cullSupportedPath())
+		<< ", mean of " << RUNS << " runs" << std::endl;
+
+	// 2. each supported path on one thread, checked against the scalar result
+	std::vector<uint32_t> reference(bounds.paddedSize() + CullBounds::LANES);
+	uint32_t referenceCount = cullRange(CullPath::Scalar, frustum, bounds, 0, objectCount, reference.data());
+	std::vector<uint32_t> visible(reference.size());
+	for (auto path : { CullPath::Scalar, CullPath::Sse41, CullPath::Avx2 })
+	{
+		if (static_cast<int>(path) > static_cast<int>(cullSupportedPath()))
+		{
+			out << "\t" << cullPathName(path) << ": not supported" << std::endl;
+			continue;
+		}
+		uint32_t n = 0;
+		auto t0 = Clock::now();
+		for (uint32_t run = 0; run < RUNS; run++)
+			n = cullRange(path, frustum, bounds, 0, objectCount, visible.data());
+		auto t1 = Clock::now();
+		double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / RUNS;
+		bool same = n == referenceCount && std::equal(reference.begin(), reference.begin() + n, visible.begin());
+		out << "\t" << cullPathName(path) << ": " << ns / 1e6 << " ms, " << objectCount / ns << " objects/ns, "
+			<< n << " visible" << (same ? "" : " (differs from scalar)") << std::endl;
+	}
+
+	// 3. the best path over every worker, as the app runs it
+	JobSystem jobs;
+	jobs.init();
+	std::vector<uint32_t> parallel;
+	auto t0 = Clock::now();
+	for (uint32_t run = 0; run < RUNS; run++)
+		cullParallel(jobs, cullSupportedPath(), frustum, bounds, parallel);
+	auto t1 = Clock::now();
+	double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / RUNS;
+	bool same = parallel.size() == referenceCount && std::equal(parallel.begin(), parallel.end(), reference.begin());
+	out << "\t" << cullPathName(cullSupportedPath()) << " on " << jobs.workerCount() << " workers: " << ns / 1e6
+		<< " ms, " << objectCount / ns << " objects/ns" << (same ? "" : " (differs from scalar)") << std::endl;
+	out << std::defaultfloat;
+}
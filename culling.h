@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef XZ_CULLING_H
+#define XZ_CULLING_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "jobs.h"
+
+// Bounding spheres as structure of arrays, so one SIMD load brings the same
+// coordinate of 4 or 8 objects. Storage is padded to whole AVX2 vectors with
+// spheres of radius -inf that never pass a plane, the loops need no tail.
+class CullBounds
+{
+public:
+	static const uint32_t LANES = 8;		// widest vector, padding granularity
+
+	void resize(uint32_t count);
+	void set(uint32_t i, float x, float y, float z, float radius)
+	{
+		xs[i] = x; ys[i] = y; zs[i] = z; radii[i] = radius;
+	}
+
+	uint32_t size() const { return count; }
+	uint32_t paddedSize() const { return static_cast<uint32_t>(xs.size()); }
+	const float* x() const { return xs.data(); }
+	const float* y() const { return ys.data(); }
+	const float* z() const { return zs.data(); }
+	const float* radius() const { return radii.data(); }
+
+private:
+	uint32_t count = 0;
+	std::vector<float> xs, ys, zs, radii;
+};
+
+// Six planes (a, b, c, d), a point p is inside when a*p.x + b*p.y + c*p.z + d >= 0
+// for all of them; a sphere when that is at least -radius.
+struct CullFrustum
+{
+	float planes[6][4];
+
+	// the clip volume the draws are placed in: x and y in [-1, 1], depth in [0, 1]
+	static CullFrustum clipSpace();
+};
+
+enum class CullPath { Scalar, Sse41, Avx2 };
+
+// the fastest path this CPU and OS run, detected once
+CullPath cullSupportedPath();
+const char* cullPathName(CullPath path);
+
+// visible indices of [begin, end) written to out in order, returns their count;
+// begin is a multiple of LANES and out has room for end - begin + LANES
+uint32_t cullRange(CullPath path, const CullFrustum& frustum, const CullBounds& bounds,
+	uint32_t begin, uint32_t end, uint32_t* out);
+// every object, in chunks of CULL_JOB_GRAIN over the job system, compacted into visible
+// in index order; small sets stay on the calling thread
+void cullParallel(JobSystem& jobs, CullPath path, const CullFrustum& frustum, const CullBounds& bounds,
+	std::vector<uint32_t>& visible);
+
+// --bench-cull: scalar, SSE4.1 and AVX2 throughput over objectCount spheres
+void benchmarkCulling(uint32_t objectCount, std::ostream& out);
+
+#endif // !XZ_CULLING_H
@@ -0,0 +1,196 @@
+#include "drawlist.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+///// DrawKey
+uint64_t DrawKey::make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t depth)
+{
+	const uint64_t passMask = (1ull << PASS_BITS) - 1;
+	const uint64_t pipelineMask = (1ull << PIPELINE_BITS) - 1;
+	const uint64_t materialMask = (1ull << MATERIAL_BITS) - 1;
+
+	return ((pass & passMask) << (PIPELINE_BITS + MATERIAL_BITS + DEPTH_BITS))
+		| ((pipeline & pipelineMask) << (MATERIAL_BITS + DEPTH_BITS))
+		| ((material & materialMask) << DEPTH_BITS)
+		| depth;
+}
+
+uint32_t DrawKey::depthBucket(float depth)
+{
+	float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+	return static_cast<uint32_t>(static_cast<double>(clamped) * 4294967295.0);
+}
+
+uint32_t DrawKey::pass(uint64_t key)
+{
+	return static_cast<uint32_t>(key >> (PIPELINE_BITS + MATERIAL_BITS + DEPTH_BITS));
+}
+
+uint32_t DrawKey::pipeline(uint64_t key)
+{
+	return static_cast<uint32_t>(key >> (MATERIAL_BITS + DEPTH_BITS)) & ((1u << PIPELINE_BITS) - 1);
+}
+
+uint32_t DrawKey::material(uint64_t key)
+{
+	return static_cast<uint32_t>(key >> DEPTH_BITS) & ((1u << MATERIAL_BITS) - 1);
+}
+
+uint32_t DrawKey::depth(uint64_t key)
+{
+	return static_cast<uint32_t>(key);
+}
+
+
+///// DrawList
+void DrawList::sort()
+{
+	const size_t count = entries.size();
+	if (count < 2) return;
+
+	// 1. one scan builds the histograms of all eight key bytes
+	static const uint32_t PASSES = 8;
+	std::vector<uint32_t> histograms(PASSES * 256, 0);
+	for (const auto& entry : entries)
+	{
+		for (uint32_t p = 0; p < PASSES; p++)
+			histograms[p * 256 + ((entry.key >> (8 * p)) & 0xff)]++;
+	}
+
+	// 2. scatter byte by byte, least significant first; a byte that is the same
+	// for every key (unused pipeline bits, a single pass) costs nothing
+	scratch.resize(count);
+	for (uint32_t p = 0; p < PASSES; p++)
+	{
+		uint32_t* histogram = &histograms[p * 256];
+		uint32_t firstKeyByte = (entries[0].key >> (8 * p)) & 0xff;
+		if (histogram[firstKeyByte] == count) continue;
+
+		uint32_t offset = 0;
+		for (uint32_t b = 0; b < 256; b++)
+		{
+			uint32_t n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+		for (const auto& entry : entries)
+			scratch[histogram[(entry.key >> (8 * p)) & 0xff]++] = entry;
+		entries.swap(scratch);
+	}
+}
+
+
+///// BindTracker
+void BindTracker::reset()
+{
+	unbind();
+	issued = 0;
+	elided = 0;
+}
+
+void BindTracker::unbind()
+{
+	boundPipeline = NONE;
+	boundMaterial = NONE;
+	boundVertexBuffer = NONE;
+}
+
+bool BindTracker::check(uint32_t& bound, uint32_t id)
+{
+	if (bound == id)
+	{
+		elided++;
+		return false;
+	}
+	bound = id;
+	issued++;
+	return true;
+}
+
+
+///// benchmark
+void benchmarkDrawList(uint32_t drawCount, std::ostream& out)
+{
+	using Clock = std::chrono::steady_clock;
+	const uint32_t PASSES = 4, PIPELINES = 32, MATERIALS = 1024, RUNS = 5;
+
+	// 1. synthetic scene, fixed seed so runs compare; meshes follow materials
+	struct Draw { uint32_t pass, pipeline, material, mesh; float depth; };
+	std::mt19937 rng(42);
+	std::vector<Draw> draws(drawCount);
+	for (auto& draw : draws)
+	{
+		draw.pass = rng() % PASSES;
+		draw.pipeline = rng() % PIPELINES;
+		draw.material = rng() % MATERIALS;
+		draw.mesh = draw.material / 8;
+		draw.depth = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+	}
+
+	auto countBinds = [&](const DrawList& list, BindTracker& tracker) {
+		tracker.reset();
+		for (const auto& entry : list.items())
+		{
+			const auto& draw = draws[entry.draw];
+			tracker.pipeline(draw.pipeline);
+			tracker.material(draw.material);
+			tracker.vertexBuffer(draw.mesh);
+		}
+	};
+
+	// 2. build, sort and time; the list is rebuilt every run like a real frame
+	DrawList list;
+	list.reserve(drawCount);
+	double buildMs = 0.0, radixMs = 0.0, stdMs = 0.0;
+	BindTracker unsorted, sorted;
+	for (uint32_t run = 0; run < RUNS; run++)
+	{
+		auto t0 = Clock::now();
+		list.clear();
+		for (uint32_t i = 0; i < drawCount; i++)
+		{
+			const auto& draw = draws[i];
+			list.add(DrawKey::make(draw.pass, draw.pipeline, draw.material, DrawKey::depthBucket(draw.depth)), i);
+		}
+		auto t1 = Clock::now();
+		if (run == 0) countBinds(list, unsorted);
+
+		auto reference = list.items();
+		auto t2 = Clock::now();
+		list.sort();
+		auto t3 = Clock::now();
+		std::stable_sort(reference.begin(), reference.end(),
+			[](const DrawList::Entry& a, const DrawList::Entry& b) { return a.key < b.key; });
+		auto t4 = Clock::now();
+
+		if (run == 0)
+		{
+			countBinds(list, sorted);
+			for (size_t i = 0; i < reference.size(); i++)
+			{
+				if (reference[i].draw != list.items()[i].draw)
+				{
+					out << "Sort: radix order differs from std::stable_sort at " << i << std::endl;
+					break;
+				}
+			}
+		}
+		buildMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		radixMs += std::chrono::duration<double, std::milli>(t3 - t2).count();
+		stdMs += std::chrono::duration<double, std::milli>(t4 - t3).count();
+	}
+
+	// 3. report
+	out << std::fixed << std::setprecision(3);
+	out << "Draws: " << drawCount << " (" << PASSES << " passes, " << PIPELINES << " pipelines, "
+		<< MATERIALS << " materials), mean of " << RUNS << " runs" << std::endl;
+	out << "\tbuild keys: " << buildMs / RUNS << " ms" << std::endl;
+	out << "\tradix sort: " << radixMs / RUNS << " ms" << std::endl;
+	out << "\tstd::stable_sort: " << stdMs / RUNS << " ms" << std::endl;
+	out << "\tbinds unsorted: " << unsorted.issuedCount() << " issued, " << unsorted.elidedCount() << " elided" << std::endl;
+	out << "\tbinds sorted: " << sorted.issuedCount() << " issued, " << sorted.elidedCount() << " elided" << std::endl;
+	out << std::defaultfloat;
+}
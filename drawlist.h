@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef XZ_DRAWLIST_H
+#define XZ_DRAWLIST_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// 64-bit draw sort key, most significant field first:
+//   | pass 4 | pipeline 12 | material 16 | depth 32 |
+// Sorting the keys groups draws by pass, then pipeline, then material, and
+// orders each group front to back.
+struct DrawKey
+{
+	static const uint32_t PASS_BITS = 4;
+	static const uint32_t PIPELINE_BITS = 12;
+	static const uint32_t MATERIAL_BITS = 16;
+	static const uint32_t DEPTH_BITS = 32;
+
+	static uint64_t make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t depth);
+	// depth in [0, 1] quantized over the depth field, larger is farther
+	static uint32_t depthBucket(float depth);
+
+	static uint32_t pass(uint64_t key);
+	static uint32_t pipeline(uint64_t key);
+	static uint32_t material(uint64_t key);
+	static uint32_t depth(uint64_t key);
+};
+
+// Per-frame list of keyed draws. sort() is an LSD radix sort over the keys,
+// stable, so draws with equal keys keep their submission order.
+class DrawList
+{
+public:
+	struct Entry
+	{
+		uint64_t key;
+		uint32_t draw;		// index into the caller's draw array
+	};
+
+	void clear() { entries.clear(); }
+	void reserve(size_t count) { entries.reserve(count); scratch.reserve(count); }
+	void add(uint64_t key, uint32_t draw) { entries.push_back({ key, draw }); }
+	void sort();
+
+	const std::vector<Entry>& items() const { return entries; }
+	size_t size() const { return entries.size(); }
+
+private:
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+};
+
+// Remembers what the recorder last bound; each call says whether the bind is
+// actually needed and counts the ones it saved.
+class BindTracker
+{
+public:
+	static const uint32_t NONE = ~0u;
+
+	void reset();			// new frame: nothing bound, counts cleared
+	void unbind();			// nothing bound, e.g. in a new secondary command buffer
+	bool pipeline(uint32_t id) { return check(boundPipeline, id); }
+	bool material(uint32_t id) { return check(boundMaterial, id); }
+	bool vertexBuffer(uint32_t id) { return check(boundVertexBuffer, id); }
+
+	uint64_t issuedCount() const { return issued; }
+	uint64_t elidedCount() const { return elided; }
+
+private:
+	bool check(uint32_t& bound, uint32_t id);
+
+	uint32_t boundPipeline = NONE;
+	uint32_t boundMaterial = NONE;
+	uint32_t boundVertexBuffer = NONE;
+	uint64_t issued = 0;
+	uint64_t elided = 0;
+};
+
+// --bench-sort: sort and bind statistics for a synthetic list of drawCount draws
+void benchmarkDrawList(uint32_t drawCount, std::ostream& out);
+
+#endif // !XZ_DRAWLIST_H
@@ -0,0 +1,224 @@
+#include "hostalloc.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// sits right before every pointer handed to the driver
+struct HostAllocator::Header
+{
+	void* block;			// what to give back: malloc'd memory or a pool block
+	size_t size;			// as requested, for reallocation and live bytes
+	uint32_t scope;
+	uint32_t sizeClass;		// CLASS_COUNT for malloc'd memory
+};
+
+namespace
+{
+	const size_t MAX_POOL_ALIGNMENT = 64;
+
+	uintptr_t alignUp(uintptr_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	}
+}
+
+
+///// HostAllocator
+HostAllocator::~HostAllocator()
+{
+	for (void* chunk : chunks)
+		std::free(chunk);
+}
+
+void HostAllocator::init(HostAllocMode allocMode)
+{
+	mode = allocMode;
+	vkCallbacks.pUserData = this;
+	vkCallbacks.pfnAllocation = &HostAllocator::allocation;
+	vkCallbacks.pfnReallocation = &HostAllocator::reallocation;
+	vkCallbacks.pfnFree = &HostAllocator::deallocation;
+	vkCallbacks.pfnInternalAllocation = &HostAllocator::internalAllocation;
+	vkCallbacks.pfnInternalFree = &HostAllocator::internalFree;
+}
+
+HostAllocator::Totals HostAllocator::totals(VkSystemAllocationScope scope) const
+{
+	const Scope& counters = scopes[scope];
+	Totals result;
+	result.allocations = counters.allocations.load(std::memory_order_relaxed);
+	result.bytes = counters.bytes.load(std::memory_order_relaxed);
+	result.arenaHits = counters.arenaHits.load(std::memory_order_relaxed);
+	result.internalAllocations = counters.internalAllocations.load(std::memory_order_relaxed);
+	result.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+	return result;
+}
+
+HostAllocator::Totals HostAllocator::totals() const
+{
+	Totals result;
+	for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+	{
+		Totals part = totals(static_cast<VkSystemAllocationScope>(scope));
+		result.allocations += part.allocations;
+		result.bytes += part.bytes;
+		result.arenaHits += part.arenaHits;
+		result.internalAllocations += part.internalAllocations;
+		result.liveBytes += part.liveBytes;
+	}
+	return result;
+}
+
+bool HostAllocator::parseMode(const std::string& name, HostAllocMode& allocMode)
+{
+	if (name == "off") allocMode = HostAllocMode::Off;
+	else if (name == "count") allocMode = HostAllocMode::Count;
+	else if (name == "arena") allocMode = HostAllocMode::Arena;
+	else return false;
+	return true;
+}
+
+const char* HostAllocator::scopeName(uint32_t scope)
+{
+	static const char* names[SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+	return scope < SCOPE_COUNT ? names[scope] : "unknown";
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (size == 0) return nullptr;
+	alignment = std::max(alignment, alignof(Header));
+	size_t needed = sizeof(Header) + alignment - 1 + size;
+
+	// 1. arena mode: short-lived scopes take a block of the smallest class that fits
+	uint32_t sizeClass = CLASS_COUNT;
+	if (mode == HostAllocMode::Arena && alignment <= MAX_POOL_ALIGNMENT
+		&& (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND || scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT))
+	{
+		for (uint32_t c = 0; c < CLASS_COUNT; c++)
+		{
+			if (needed <= (size_t(1) << (MIN_CLASS_SHIFT + c)))
+			{
+				sizeClass = c;
+				break;
+			}
+		}
+	}
+
+	void* block = sizeClass < CLASS_COUNT ? takeBlock(sizeClass) : std::malloc(needed);
+	if (!block) return nullptr;
+
+	// 2. header right before the aligned pointer
+	auto memory = alignUp(reinterpret_cast<uintptr_t>(block) + sizeof(Header), alignment);
+	auto header = reinterpret_cast<Header*>(memory) - 1;
+	header->block = block;
+	header->size = size;
+	header->scope = scope;
+	header->sizeClass = sizeClass;
+
+	Scope& counters = scopes[scope];
+	counters.allocations.fetch_add(1, std::memory_order_relaxed);
+	counters.bytes.fetch_add(size, std::memory_order_relaxed);
+	counters.liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+	if (sizeClass < CLASS_COUNT)
+		counters.arenaHits.fetch_add(1, std::memory_order_relaxed);
+	return reinterpret_cast<void*>(memory);
+}
+
+void* HostAllocator::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (!original) return allocate(size, alignment, scope);
+	if (size == 0)
+	{
+		release(original);
+		return nullptr;
+	}
+
+	// the spec allows moving, so always take fresh memory of the new size
+	void* memory = allocate(size, alignment, scope);
+	if (!memory) return nullptr;
+	auto header = reinterpret_cast<Header*>(original) - 1;
+	std::memcpy(memory, original, std::min(size, header->size));
+	release(original);
+	return memory;
+}
+
+void HostAllocator::release(void* memory)
+{
+	if (!memory) return;
+	auto header = reinterpret_cast<Header*>(memory) - 1;
+	scopes[header->scope].liveBytes.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+
+	if (header->sizeClass < CLASS_COUNT)
+		giveBlock(header->sizeClass, header->block);
+	else
+		std::free(header->block);
+}
+
+void* HostAllocator::takeBlock(uint32_t sizeClass)
+{
+	SizeClass& pool = classes[sizeClass];
+	std::lock_guard<std::mutex> lock(pool.lock);
+
+	// an empty class carves a new chunk into blocks
+	if (!pool.freeList)
+	{
+		void* chunk = std::malloc(CHUNK_SIZE);
+		if (!chunk) return nullptr;
+		{
+			std::lock_guard<std::mutex> chunkGuard(chunkLock);
+			chunks.push_back(chunk);
+		}
+		size_t blockSize = size_t(1) << (MIN_CLASS_SHIFT + sizeClass);
+		auto bytes = static_cast<uint8_t*>(chunk);
+		for (size_t offset = 0; offset + blockSize <= CHUNK_SIZE; offset += blockSize)
+		{
+			*reinterpret_cast<void**>(bytes + offset) = pool.freeList;
+			pool.freeList = bytes + offset;
+		}
+	}
+
+	void* block = pool.freeList;
+	pool.freeList = *reinterpret_cast<void**>(block);
+	return block;
+}
+
+void HostAllocator::giveBlock(uint32_t sizeClass, void* block)
+{
+	SizeClass& pool = classes[sizeClass];
+	std::lock_guard<std::mutex> lock(pool.lock);
+	*reinterpret_cast<void**>(block) = pool.freeList;
+	pool.freeList = block;
+}
+
+void* VKAPI_CALL HostAllocator::allocation(void* user, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	return static_cast<HostAllocator*>(user)->allocate(size, alignment, scope);
+}
+
+void* VKAPI_CALL HostAllocator::reallocation(void* user, void* original, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+	return static_cast<HostAllocator*>(user)->reallocate(original, size, alignment, scope);
+}
+
+void VKAPI_CALL HostAllocator::deallocation(void* user, void* memory)
+{
+	static_cast<HostAllocator*>(user)->release(memory);
+}
+
+void VKAPI_CALL HostAllocator::internalAllocation(void* user, size_t size, VkInternalAllocationType /*type*/,
+	VkSystemAllocationScope scope)
+{
+	// the driver allocated this itself (executable memory); count, nothing to serve
+	auto& counters = static_cast<HostAllocator*>(user)->scopes[scope];
+	counters.internalAllocations.fetch_add(1, std::memory_order_relaxed);
+	counters.liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
+
+void VKAPI_CALL HostAllocator::internalFree(void* user, size_t size, VkInternalAllocationType /*type*/,
+	VkSystemAllocationScope scope)
+{
+	auto& counters = static_cast<HostAllocator*>(user)->scopes[scope];
+	counters.liveBytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
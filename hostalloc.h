@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef XZ_HOSTALLOC_H
+#define XZ_HOSTALLOC_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+enum class HostAllocMode : uint32_t
+{
+	Off,		// nullptr callbacks, the driver's own allocator
+	Count,		// malloc/free, counted per scope
+	Arena,		// counted, command and object scope served from pooled size classes
+};
+
+// VkAllocationCallbacks that count what the driver allocates on the host, per
+// VkSystemAllocationScope. In arena mode the short-lived command and object
+// scope allocations come from per-size-class free lists carved out of large
+// chunks, instead of a malloc per call. Callable from any thread.
+class HostAllocator
+{
+public:
+	static const uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+	struct Totals
+	{
+		uint64_t allocations = 0;		// allocations and reallocations
+		uint64_t bytes = 0;
+		uint64_t arenaHits = 0;
+		uint64_t internalAllocations = 0;
+		int64_t liveBytes = 0;
+	};
+
+	~HostAllocator();
+
+	void init(HostAllocMode mode);
+	// nullptr when off, pass to every vkCreate*/vkDestroy*/vkAllocate*/vkFree*
+	const VkAllocationCallbacks* callbacks() const { return mode == HostAllocMode::Off ? nullptr : &vkCallbacks; }
+	HostAllocMode allocMode() const { return mode; }
+
+	Totals totals(VkSystemAllocationScope scope) const;
+	Totals totals() const;		// all scopes
+
+	static bool parseMode(const std::string& name, HostAllocMode& mode);
+	static const char* scopeName(uint32_t scope);
+
+private:
+	static const uint32_t CLASS_COUNT = 8;				// 32 B .. 4 KiB
+	static const uint32_t MIN_CLASS_SHIFT = 5;
+	static const size_t CHUNK_SIZE = 64 * 1024;
+
+	struct Header;
+
+	struct SizeClass
+	{
+		std::mutex lock;
+		void* freeList = nullptr;
+	};
+
+	struct Scope
+	{
+		std::atomic<uint64_t> allocations{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> arenaHits{ 0 };
+		std::atomic<uint64_t> internalAllocations{ 0 };
+		std::atomic<int64_t> liveBytes{ 0 };
+	};
+
+	void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void release(void* memory);
+	void* takeBlock(uint32_t sizeClass);
+	void giveBlock(uint32_t sizeClass, void* block);
+
+	static void* VKAPI_CALL allocation(void* user, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static void* VKAPI_CALL reallocation(void* user, void* original, size_t size, size_t alignment,
+		VkSystemAllocationScope scope);
+	static void VKAPI_CALL deallocation(void* user, void* memory);
+	static void VKAPI_CALL internalAllocation(void* user, size_t size, VkInternalAllocationType type,
+		VkSystemAllocationScope scope);
+	static void VKAPI_CALL internalFree(void* user, size_t size, VkInternalAllocationType type,
+		VkSystemAllocationScope scope);
+
+	HostAllocMode mode = HostAllocMode::Off;
+	VkAllocationCallbacks vkCallbacks{};
+
+	Scope scopes[SCOPE_COUNT];
+	SizeClass classes[CLASS_COUNT];
+	std::mutex chunkLock;
+	std::vector<void*> chunks;
+};
+
+#endif // !XZ_HOSTALLOC_H
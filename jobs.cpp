@@ -0,0 +1,439 @@
+#include "jobs.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+struct Job
+{
+	JobSystem::Function fn;
+	JobCounter* counter;
+};
+
+namespace
+{
+	// worker slot of the calling thread in the system that owns it
+	thread_local JobSystem* tlsSystem = nullptr;
+	thread_local uint32_t tlsWorker = 0;
+
+	const uint32_t IDLE_SPINS = 64;
+}
+
+
+///// WorkStealingDeque
+bool WorkStealingDeque::push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= CAPACITY) return false;
+
+	ring[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Job* WorkStealingDeque::pop()
+{
+	// 1. claim the bottom slot before looking at top
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	// 2. the last job races with thieves, whoever moves top wins it
+	Job* job = ring[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* WorkStealingDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+
+	Job* job = ring[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+
+///// JobSystem
+void JobSystem::init(uint32_t workerCount)
+{
+	if (!workers.empty()) return;
+	// the calling thread only runs jobs while it waits, so keep one dedicated worker
+	if (workerCount == 0) workerCount = std::max(2u, std::thread::hardware_concurrency());
+
+	stopping = false;
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		workers.push_back(std::make_unique<Worker>());
+		workers.back()->rng = 0x9e3779b9u * (i + 1);
+	}
+
+	// the calling thread is worker 0, the rest get their own thread
+	tlsSystem = this;
+	tlsWorker = 0;
+	for (uint32_t i = 1; i < workerCount; i++)
+		workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+}
+
+void JobSystem::shutdown()
+{
+	if (workers.empty()) return;
+
+	// 1. drain what is left so no counter is left hanging
+	while (runOne());
+
+	// 2. stop and join the workers
+	stopping = true;
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+		wake.notify_all();
+	}
+	for (auto& worker : workers)
+	{
+		if (worker->thread.joinable()) worker->thread.join();
+	}
+	workers.clear();
+	if (tlsSystem == this) tlsSystem = nullptr;
+}
+
+void JobSystem::run(Function fn, JobCounter* counter, JobCounter* dependency)
+{
+	if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+	Job* job = new Job{ std::move(fn), counter };
+
+	// park the job on its dependency; whoever finishes the dependency schedules it
+	std::exception_ptr error;
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->lock);
+		if (dependency->pending.load(std::memory_order_acquire) != 0)
+		{
+			dependency->waiters.push_back(job);
+			return;
+		}
+		error = dependency->error;
+	}
+	if (error)
+		cancel(job, error);
+	else
+		schedule(job);
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn,
+	JobCounter* counter)
+{
+	// the chunks share one copy of fn, the caller's may be gone before they run
+	auto body = std::make_shared<std::function<void(uint32_t, uint32_t)>>(fn);
+	grain = std::max(1u, grain);
+	for (uint32_t begin = 0; begin < count; begin += grain)
+	{
+		uint32_t end = std::min(count, begin + grain);
+		run([body, begin, end]() { (*body)(begin, end); }, counter);
+	}
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	// help instead of blocking; the counter's jobs may well be in our own deque
+	while (!counter.done())
+	{
+		if (!runOne()) std::this_thread::yield();
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter.lock);
+		std::swap(error, counter.error);
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+void JobSystem::workerLoop(uint32_t index)
+{
+	tlsSystem = this;
+	tlsWorker = index;
+
+	uint32_t idle = 0;
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		// read before looking, a job published after this changes it
+		uint64_t seen = published.load();
+		if (runOne())
+		{
+			idle = 0;
+			continue;
+		}
+		if (++idle < IDLE_SPINS)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// either schedule() sees us sleeping and notifies under the lock, or its
+		// bump of published comes first and the predicate sees it
+		sleeping.fetch_add(1);
+		{
+			std::unique_lock<std::mutex> lock(sleepLock);
+			wake.wait(lock, [&] { return stopping.load() || published.load() != seen; });
+		}
+		sleeping.fetch_sub(1);
+		idle = 0;
+	}
+	tlsSystem = nullptr;
+}
+
+void JobSystem::schedule(Job* job)
+{
+	// 1. workers push to their own deque; a full deque runs the job right away
+	if (tlsSystem == this)
+	{
+		if (!workers[tlsWorker]->deque.push(job))
+		{
+			execute(job);
+			return;
+		}
+	}
+	// 2. everyone else goes through the shared queue
+	else
+	{
+		std::lock_guard<std::mutex> lock(injectLock);
+		injected.push_back(job);
+		injectedCount.fetch_add(1, std::memory_order_release);
+	}
+
+	published.fetch_add(1);
+	if (sleeping.load() != 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+		wake.notify_one();
+	}
+}
+
+bool JobSystem::runOne()
+{
+	Job* job = findJob();
+	if (!job) return false;
+	execute(job);
+	return true;
+}
+
+Job* JobSystem::findJob()
+{
+	const uint32_t count = static_cast<uint32_t>(workers.size());
+	bool isWorker = tlsSystem == this;
+
+	// 1. own deque, newest first for cache warmth
+	if (isWorker)
+	{
+		if (Job* job = workers[tlsWorker]->deque.pop()) return job;
+	}
+
+	// 2. steal the oldest job of another worker, starting at a random victim
+	uint32_t start = 0;
+	if (isWorker)
+	{
+		uint32_t& rng = workers[tlsWorker]->rng;
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		start = rng;
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t victim = (start + i) % count;
+		if (isWorker && victim == tlsWorker) continue;
+		if (Job* job = workers[victim]->deque.steal()) return job;
+	}
+
+	// 3. jobs from threads outside the system
+	if (injectedCount.load(std::memory_order_acquire) != 0)
+	{
+		std::lock_guard<std::mutex> lock(injectLock);
+		if (!injected.empty())
+		{
+			Job* job = injected.front();
+			injected.pop_front();
+			injectedCount.fetch_sub(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::execute(Job* job)
+{
+	JobCounter* counter = job->counter;
+	try
+	{
+		job->fn();
+	}
+	catch (...)
+	{
+		// nobody waits on a job without a counter, rethrowing would terminate the worker
+		if (counter)
+		{
+			std::lock_guard<std::mutex> lock(counter->lock);
+			if (!counter->error) counter->error = std::current_exception();
+		}
+		else
+		{
+			try
+			{
+				throw;
+			}
+			catch (const std::exception& e)
+			{
+				Logger::get().write(LogLevel::Error, Logger::NO_KEY, "Job failed: %s", e.what());
+			}
+			catch (...)
+			{
+				Logger::get().write(LogLevel::Error, Logger::NO_KEY, "Job failed: unknown exception");
+			}
+		}
+	}
+	delete job;
+	finish(counter);
+}
+
+void JobSystem::cancel(Job* job, std::exception_ptr error)
+{
+	// a failed dependency fails its dependents without running them
+	JobCounter* counter = job->counter;
+	delete job;
+	if (!counter) return;
+	{
+		std::lock_guard<std::mutex> lock(counter->lock);
+		if (!counter->error) counter->error = error;
+	}
+	finish(counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+	if (!counter) return;
+
+	// 1. not the last job: a plain decrement
+	uint32_t pending = counter->pending.load(std::memory_order_relaxed);
+	while (pending > 1)
+	{
+		if (counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+			return;
+	}
+
+	// 2. the last one decrements under the lock, so wait() cannot return and
+	// free the counter before we are done with it, and takes the parked jobs
+	std::vector<Job*> ready;
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter->lock);
+		if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			ready.swap(counter->waiters);
+			error = counter->error;
+		}
+	}
+	for (Job* waiter : ready)
+	{
+		if (error)
+			cancel(waiter, error);
+		else
+			schedule(waiter);
+	}
+}
+
+
+///// benchmark
+void benchmarkJobs(std::ostream& out)
+{
+	using Clock = std::chrono::steady_clock;
+	const uint32_t SPAWNS = 1000000, BATCH = 1024, ELEMENTS = 1 << 24, GRAIN = 1024, RUNS = 5;
+	const uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+
+	out << std::fixed << std::setprecision(3);
+	out << "Jobs: " << hardware << " hardware threads, mean of " << RUNS << " runs" << std::endl;
+
+	// 1. spawn overhead: batches of empty jobs from worker 0, small enough to
+	// stay in its deque, then the wait that runs them
+	{
+		JobSystem jobs;
+		jobs.init();
+		double spawnNs = 0.0, drainNs = 0.0;
+		for (uint32_t run = 0; run < RUNS; run++)
+		{
+			for (uint32_t spawned = 0; spawned < SPAWNS; spawned += BATCH)
+			{
+				JobCounter counter;
+				auto t0 = Clock::now();
+				for (uint32_t i = 0; i < BATCH; i++)
+					jobs.run([]() {}, &counter);
+				auto t1 = Clock::now();
+				jobs.wait(counter);
+				auto t2 = Clock::now();
+				spawnNs += std::chrono::duration<double, std::nano>(t1 - t0).count();
+				drainNs += std::chrono::duration<double, std::nano>(t2 - t1).count();
+			}
+		}
+		const double total = static_cast<double>(RUNS) * ((SPAWNS + BATCH - 1) / BATCH * BATCH);
+		out << "\tspawn: " << spawnNs / total << " ns/job, wait: " << drainNs / total
+			<< " ns/job (" << SPAWNS << " empty jobs in batches of " << BATCH << ")" << std::endl;
+	}
+
+	// 2. scaling: sqrt sum over a large array in fine-grained chunks
+	std::vector<float> values(ELEMENTS);
+	for (uint32_t i = 0; i < ELEMENTS; i++)
+		values[i] = static_cast<float>(i % 1000);
+
+	const uint32_t chunks = (ELEMENTS + GRAIN - 1) / GRAIN;
+	std::vector<double> partial(chunks);
+	std::vector<uint32_t> workerCounts;
+	for (uint32_t n = 1; n < hardware; n *= 2)
+		workerCounts.push_back(n);
+	workerCounts.push_back(hardware);
+
+	double baseMs = 0.0;
+	for (uint32_t workerCount : workerCounts)
+	{
+		JobSystem jobs;
+		jobs.init(workerCount);
+		double ms = 0.0;
+		for (uint32_t run = 0; run < RUNS; run++)
+		{
+			JobCounter counter;
+			auto t0 = Clock::now();
+			jobs.parallelFor(ELEMENTS, GRAIN, [&](uint32_t begin, uint32_t end) {
+				double sum = 0.0;
+				for (uint32_t i = begin; i < end; i++)
+					sum += std::sqrt(values[i]);
+				partial[begin / GRAIN] = sum;
+			}, &counter);
+			jobs.wait(counter);
+			auto t1 = Clock::now();
+			ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		}
+		ms /= RUNS;
+		if (workerCount == 1) baseMs = ms;
+		out << "\t" << workerCount << " workers: " << ms << " ms, " << baseMs / ms << "x ("
+			<< chunks << " jobs of " << GRAIN << " elements)" << std::endl;
+	}
+	out << std::defaultfloat;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef XZ_JOBS_H
+#define XZ_JOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+struct Job;
+
+// Counts unfinished jobs. A job can name a counter it decrements when done and
+// a counter it depends on: it is only scheduled once that one reaches zero.
+struct JobCounter
+{
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> pending{ 0 };
+	std::mutex lock;
+	std::vector<Job*> waiters;			// jobs depending on this counter
+	std::exception_ptr error;			// first exception thrown by one of its jobs
+};
+
+// Chase-Lev work-stealing deque with a fixed ring. The owning worker pushes and
+// pops at the bottom, every other thread steals from the top.
+class WorkStealingDeque
+{
+public:
+	static const int64_t CAPACITY = 4096;
+
+	bool push(Job* job);		// owner, false when full
+	Job* pop();					// owner
+	Job* steal();				// any thread
+
+private:
+	std::atomic<int64_t> top{ 0 };
+	std::atomic<int64_t> bottom{ 0 };
+	std::atomic<Job*> ring[CAPACITY] = {};
+};
+
+// Work-stealing scheduler. The thread calling init() is worker 0 and only runs
+// jobs while it waits; the others are dedicated threads. Threads that are not
+// workers may still run and wait, their jobs go through a shared queue.
+class JobSystem
+{
+public:
+	using Function = std::function<void()>;
+
+	~JobSystem() { shutdown(); }
+
+	// workerCount 0: one per hardware thread, at least two
+	void init(uint32_t workerCount = 0);
+	void shutdown();
+
+	// a job without a counter that throws is logged and dropped
+	void run(Function fn, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+	// fn(begin, end) over [0, count) in chunks of at most grain
+	void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn,
+		JobCounter* counter);
+	// runs other jobs until the counter reaches zero, rethrows the first job exception;
+	// jobs depending on a failed counter are skipped and fail with the same exception
+	void wait(JobCounter& counter);
+
+	uint32_t workerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+private:
+	struct Worker
+	{
+		WorkStealingDeque deque;
+		std::thread thread;
+		uint32_t rng = 0;
+	};
+
+	void workerLoop(uint32_t index);
+	void schedule(Job* job);
+	bool runOne();
+	Job* findJob();
+	void execute(Job* job);
+	void cancel(Job* job, std::exception_ptr error);
+	void finish(JobCounter* counter);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<bool> stopping{ false };
+
+	std::mutex injectLock;				// jobs from non-worker threads
+	std::deque<Job*> injected;
+	std::atomic<uint32_t> injectedCount{ 0 };
+
+	// bumped after every published job, idle workers sleep until it changes
+	std::atomic<uint64_t> published{ 0 };
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<uint32_t> sleeping{ 0 };
+};
+
+// --bench-jobs: spawn overhead and fine-grained scaling
+void benchmarkJobs(std::ostream& out);
+
+#endif // !XZ_JOBS_H
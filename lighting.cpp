@@ -0,0 +1,393 @@
+#include "lighting.h"
+
+#include "const.h"
+#include "shaders.h"
+#include "specialization.h"
+#include "util.h"
+
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+	// layout must match the light struct of shader/light_bin.comp and lit.frag
+	struct GpuLight
+	{
+		float positionRadius[4];
+		float color[4];				// w: 1 / (cos inner - cos outer)
+		float direction[4];			// w: cos outer, below -1 for point lights
+	};
+
+	// the light buffer: a header, then the lights, 16-byte aligned as in std430
+	struct GpuLightHeader
+	{
+		uint32_t count;
+		float ambient;
+		uint32_t pad[2];
+	};
+}
+
+
+///// ClusteredLighting
+void ClusteredLighting::init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily,
+	uint32_t framesInFlight, const VkAllocationCallbacks* allocator)
+{
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+	this->allocator = allocator;
+	clusterGrid = { LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z, LIGHT_CLUSTER_CAPACITY };
+
+	// 1. timestamps, when the queue has them
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+	if (validBits > 0)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	}
+
+	// 2. binning writes what the scene's fragment shader reads: lights, counts, indices
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	}
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create lighting descriptor set layout!");
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create lighting pipeline layout!");
+
+	// 3. the binning pass, the grid folded in
+	auto code = ShaderLibrary::get().load("light_bin.comp.spv");
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code.size();
+	moduleInfo.pCode = code.data();
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &moduleInfo, allocator, &shaderModule) != VK_SUCCESS)
+		throw std::runtime_error("failed to create shader module light_bin.comp.spv");
+
+	SpecializationInfo<ClusterGrid> specialization(clusterGrid);
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = specialization.get();
+	pipelineInfo.layout = pipelineLayout;
+	VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &binPipeline);
+	vkDestroyShaderModule(device, shaderModule, allocator);
+	if (result != VK_SUCCESS)
+		throw std::runtime_error("failed to create compute pipeline for light_bin.comp.spv");
+
+	// 4. the cluster lists only depend on the grid; the set is rewritten by setLightCount
+	VkDeviceSize clusters = static_cast<VkDeviceSize>(clusterGrid.x) * clusterGrid.y * clusterGrid.z;
+	createBuffer(clusters * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, countBuffer, countMemory);
+	createBuffer(clusters * clusterGrid.capacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexMemory);
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 3;
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(device, &poolInfo, allocator, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create lighting descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate lighting descriptor set!");
+
+	// 5. a command buffer per frame in flight, re-recorded every frame
+	VkCommandPoolCreateInfo commandPoolInfo{};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	commandPoolInfo.queueFamilyIndex = queueFamily;
+	if (vkCreateCommandPool(device, &commandPoolInfo, allocator, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create lighting command pool!");
+
+	commandBuffers.resize(framesInFlight);
+	VkCommandBufferAllocateInfo cmdInfo{};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.commandPool = commandPool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = framesInFlight;
+	if (vkAllocateCommandBuffers(device, &cmdInfo, commandBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate lighting command buffers!");
+	submitted.assign(framesInFlight, 0);
+
+	if (timestampMask != 0)
+	{
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = QUERIES_PER_FRAME * framesInFlight;
+		if (vkCreateQueryPool(device, &queryPoolInfo, allocator, &queryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create lighting query pool!");
+	}
+}
+
+void ClusteredLighting::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+	VkBuffer& buffer, VkDeviceMemory& memory)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create lighting buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
+	if (vkAllocateMemory(device, &allocInfo, allocator, &memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate lighting memory!");
+	vkBindBufferMemory(device, buffer, memory, 0);
+}
+
+void ClusteredLighting::setLightCount(uint32_t count)
+{
+	destroyLightBuffers();
+
+	// 1. the same lights on every run: centres spread past the screen so panning finds
+	// more, half of them spots pointing into the scene
+	std::mt19937 rng(count);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	const float pi = 3.14159265f;
+	lights.resize(count);
+	for (auto& light : lights)
+	{
+		light.center[0] = (unit(rng) * 2.0f - 1.0f) * LIGHT_SPREAD;
+		light.center[1] = (unit(rng) * 2.0f - 1.0f) * LIGHT_SPREAD;
+		light.center[2] = unit(rng) * 0.9f;
+		light.orbit = 0.05f + 0.25f * unit(rng);
+		light.speed = (0.2f + 0.8f * unit(rng)) * (unit(rng) < 0.5f ? -1.0f : 1.0f);
+		light.phase = 2.0f * pi * unit(rng);
+		light.radius = LIGHT_RADIUS_MIN + (LIGHT_RADIUS_MAX - LIGHT_RADIUS_MIN) * unit(rng);
+		for (float& channel : light.color)
+			channel = 0.2f + 0.8f * unit(rng);
+
+		bool spot = unit(rng) < LIGHT_SPOT_FRACTION;
+		float angle = 2.0f * pi * unit(rng);
+		float tilt = 0.6f * unit(rng);
+		light.direction[0] = std::sin(tilt) * std::cos(angle);
+		light.direction[1] = std::sin(tilt) * std::sin(angle);
+		light.direction[2] = std::cos(tilt);
+		float outer = 0.4f + 0.4f * unit(rng);
+		light.cosOuter = spot ? std::cos(outer) : -2.0f;
+		light.spread = spot ? 1.0f / (std::cos(0.7f * outer) - light.cosOuter) : 1.0f;
+	}
+
+	// 2. a device local copy the shaders read, and a mapped staging buffer per frame
+	lightBytes = sizeof(GpuLightHeader) + static_cast<VkDeviceSize>(count) * sizeof(GpuLight);
+	createBuffer(lightBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lightBuffer, lightMemory);
+	size_t frames = commandBuffers.size();
+	stagingBuffers.assign(frames, VK_NULL_HANDLE);
+	stagingMemory.assign(frames, VK_NULL_HANDLE);
+	stagingData.assign(frames, nullptr);
+	for (size_t i = 0; i < frames; i++)
+	{
+		createBuffer(lightBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffers[i], stagingMemory[i]);
+		if (vkMapMemory(device, stagingMemory[i], 0, lightBytes, 0, &stagingData[i]) != VK_SUCCESS)
+			throw std::runtime_error("failed to map lighting staging memory!");
+	}
+
+	// 3. the same set, pointed at the new light buffer; whatever bound it is recorded again
+	VkDescriptorBufferInfo bufferInfos[3]{};
+	bufferInfos[0] = { lightBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { countBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { indexBuffer, 0, VK_WHOLE_SIZE };
+	VkWriteDescriptorSet writes[3]{};
+	for (uint32_t binding = 0; binding < 3; binding++)
+	{
+		writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[binding].dstSet = set;
+		writes[binding].dstBinding = binding;
+		writes[binding].descriptorCount = 1;
+		writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[binding].pBufferInfo = &bufferInfos[binding];
+	}
+	vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+}
+
+void ClusteredLighting::destroyLightBuffers()
+{
+	for (size_t i = 0; i < stagingBuffers.size(); i++)
+	{
+		if (stagingData[i])
+			vkUnmapMemory(device, stagingMemory[i]);
+		vkDestroyBuffer(device, stagingBuffers[i], allocator);
+		vkFreeMemory(device, stagingMemory[i], allocator);
+	}
+	stagingBuffers.clear();
+	stagingMemory.clear();
+	stagingData.clear();
+	vkDestroyBuffer(device, lightBuffer, allocator);
+	vkFreeMemory(device, lightMemory, allocator);
+	lightBuffer = VK_NULL_HANDLE;
+	lightMemory = VK_NULL_HANDLE;
+	lightBytes = 0;
+	lights.clear();
+}
+
+void ClusteredLighting::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+	destroyLightBuffers();
+	vkDestroyBuffer(device, countBuffer, allocator);
+	vkFreeMemory(device, countMemory, allocator);
+	vkDestroyBuffer(device, indexBuffer, allocator);
+	vkFreeMemory(device, indexMemory, allocator);
+	vkDestroyQueryPool(device, queryPool, allocator);
+	vkDestroyCommandPool(device, commandPool, allocator);
+	vkDestroyDescriptorPool(device, descriptorPool, allocator);
+	vkDestroyPipeline(device, binPipeline, allocator);
+	vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	vkDestroyDescriptorSetLayout(device, setLayout, allocator);
+	countBuffer = indexBuffer = VK_NULL_HANDLE;
+	countMemory = indexMemory = VK_NULL_HANDLE;
+	queryPool = VK_NULL_HANDLE;
+	commandPool = VK_NULL_HANDLE;
+	commandBuffers.clear();
+	descriptorPool = VK_NULL_HANDLE;
+	set = VK_NULL_HANDLE;
+	binPipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	setLayout = VK_NULL_HANDLE;
+}
+
+VkCommandBuffer ClusteredLighting::record(uint32_t frame, double time, const float camera[2], bool binned)
+{
+	// 1. every light where it is now, in the clip space the scene is drawn in; the
+	// frame's fence has signalled, its staging buffer is free
+	auto* header = static_cast<GpuLightHeader*>(stagingData[frame]);
+	header->count = lightCount();
+	header->ambient = LIGHT_AMBIENT;
+	auto* out = reinterpret_cast<GpuLight*>(header + 1);
+	for (const auto& light : lights)
+	{
+		float angle = light.phase + light.speed * static_cast<float>(time);
+		GpuLight gpu;
+		gpu.positionRadius[0] = light.center[0] + light.orbit * std::cos(angle) - camera[0];
+		gpu.positionRadius[1] = light.center[1] + light.orbit * std::sin(angle) - camera[1];
+		gpu.positionRadius[2] = light.center[2];
+		gpu.positionRadius[3] = light.radius;
+		gpu.color[0] = light.color[0];
+		gpu.color[1] = light.color[1];
+		gpu.color[2] = light.color[2];
+		gpu.color[3] = light.spread;
+		gpu.direction[0] = light.direction[0];
+		gpu.direction[1] = light.direction[1];
+		gpu.direction[2] = light.direction[2];
+		gpu.direction[3] = light.cosOuter;
+		*out++ = gpu;
+	}
+
+	VkCommandBuffer commandBuffer = commandBuffers[frame];
+	vkResetCommandBuffer(commandBuffer, 0);
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording lighting command buffer!");
+
+	uint32_t query = QUERIES_PER_FRAME * frame;
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, query, QUERIES_PER_FRAME);
+		submitted[frame] = 1;
+	}
+
+	// 2. the last frame's fragments are done reading what this one overwrites
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+
+	VkBufferCopy copy{};
+	copy.size = lightBytes;
+	vkCmdCopyBuffer(commandBuffer, stagingBuffers[frame], lightBuffer, 1, &copy);
+
+	// 3. a workgroup per cluster lists the lights whose sphere reaches its box
+	if (binned)
+	{
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, binPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+		vkCmdDispatch(commandBuffer, clusterGrid.x, clusterGrid.y, clusterGrid.z);
+	}
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_SHADER_READ_BIT);
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query + 1);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record lighting command buffer!");
+	return commandBuffer;
+}
+
+void ClusteredLighting::collect(uint32_t frame)
+{
+	if (queryPool == VK_NULL_HANDLE || !submitted[frame]) return;
+	submitted[frame] = 0;
+
+	uint64_t timestamps[QUERIES_PER_FRAME] = {};
+	if (vkGetQueryPoolResults(device, queryPool, QUERIES_PER_FRAME * frame, QUERIES_PER_FRAME, sizeof(timestamps),
+		timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+	binNs += ((timestamps[1] - timestamps[0]) & timestampMask) * static_cast<double>(timestampPeriod);
+	binFrames++;
+}
+
+void ClusteredLighting::report(std::ostream& out, bool binned)
+{
+	out << "Lights: " << lightCount() << (binned ? " clustered" : " naive loop") << ", " << clusterGrid.x << 'x'
+		<< clusterGrid.y << 'x' << clusterGrid.z << " clusters of up to " << clusterGrid.capacity;
+	if (binFrames > 0)
+	{
+		out << std::fixed << std::setprecision(3) << ", " << (binned ? "upload and bin " : "upload ")
+			<< binNs / binFrames / 1e6 << " ms GPU" << std::defaultfloat;
+	}
+	out << '\n';
+	binNs = 0.0;
+	binFrames = 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef XZ_LIGHTING_H
+#define XZ_LIGHTING_H
+
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// The froxel grid over the clip volume: x and y tiles over [-1, 1], depth slices
+// over [0, 1], each listing at most capacity lights. Specialization constants
+// 0-3 of shader/light_bin.comp.
+struct ClusterGrid
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t z;
+	uint32_t capacity;
+};
+
+// specialization constants of shader/lit.frag, field i is constant_id i: those of
+// tri.frag, then the lighting path and the grid it reads
+struct LitVariant
+{
+	uint32_t quantizeLevels;
+	float intensity;
+	VkBool32 clustered;				// else every fragment loops over every light
+	ClusterGrid grid;
+};
+
+// Clustered forward lighting for many dynamic point and spot lights. Every frame
+// one command buffer uploads the animated lights and a compute pass bins them:
+// a workgroup per cluster tests every light's sphere against the cluster's box and
+// writes the cluster's list of light indices. The scene's fragment shader then
+// only loops over its own cluster's list. Light upload and binning are timed with
+// timestamps; the naive path uploads the lights only.
+class ClusteredLighting
+{
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight,
+		const VkAllocationCallbacks* allocator = nullptr);
+	// (re)creates the light buffers for a new set of lights, device idle; rewrites the
+	// descriptor set, so command buffers that bound it must be recorded again
+	void setLightCount(uint32_t count);
+	void destroy();
+
+	uint32_t lightCount() const { return static_cast<uint32_t>(lights.size()); }
+	const ClusterGrid& grid() const { return clusterGrid; }
+	// set 0 of the scene pipelines: lights, cluster counts, cluster light indices
+	VkDescriptorSetLayout descriptorSetLayout() const { return setLayout; }
+	VkDescriptorSet descriptorSet() const { return set; }
+
+	// render thread: the lights at simulated time, relative to the camera, binned
+	// unless the scene loops over all of them; submitted ahead of every window
+	VkCommandBuffer record(uint32_t frame, double time, const float camera[2], bool binned);
+	// the frame's fence has signalled, accumulate its GPU time
+	void collect(uint32_t frame);
+	// light count, path and average upload and binning time, then starts a new interval
+	void report(std::ostream& out, bool binned);
+
+private:
+	// queries per frame in flight: upload begin, binning end
+	static const uint32_t QUERIES_PER_FRAME = 2;
+
+	// where a light is at time 0 and how it moves: a circle around its centre
+	struct LightSource
+	{
+		float center[3];
+		float orbit;
+		float speed;				// radians per second
+		float phase;
+		float radius;
+		float color[3];
+		float direction[3];			// spot lights only
+		float cosOuter;				// below -1 for point lights
+		float spread;				// 1 / (cos inner - cos outer)
+	};
+
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkBuffer& buffer, VkDeviceMemory& memory);
+	void destroyLightBuffers();
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	float timestampPeriod = 0.0f;
+	uint64_t timestampMask = 0;
+
+	ClusterGrid clusterGrid{};
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline binPipeline = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> commandBuffers;		// per frame in flight
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	std::vector<uint8_t> submitted;						// per frame in flight: its queries were reset
+
+	// per cluster: how many lights it lists, and the list, capacity entries each
+	VkBuffer countBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory countMemory = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+
+	// the lights as the shaders read them: written to the frame's staging buffer,
+	// copied to the device local one
+	std::vector<LightSource> lights;
+	VkDeviceSize lightBytes = 0;
+	VkBuffer lightBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory lightMemory = VK_NULL_HANDLE;
+	std::vector<VkBuffer> stagingBuffers;				// per frame in flight, persistently mapped
+	std::vector<VkDeviceMemory> stagingMemory;
+	std::vector<void*> stagingData;
+
+	double binNs = 0.0;
+	uint32_t binFrames = 0;
+};
+
+#endif // !XZ_LIGHTING_H
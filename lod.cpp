@@ -0,0 +1,260 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	struct Vec3
+	{
+		double x, y, z;
+
+		Vec3 operator-(const Vec3& o) const { return { x - o.x, y - o.y, z - o.z }; }
+	};
+
+	double dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	Vec3 cross(const Vec3& a, const Vec3& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	// symmetric 4x4 sum of plane outer products, upper triangle row by row
+	struct Quadric
+	{
+		double a[10] = {};
+
+		void addPlane(const Vec3& n, double d)
+		{
+			a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+			a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+			a[7] += n.z * n.z; a[8] += n.z * d;
+			a[9] += d * d;
+		}
+		void add(const Quadric& o)
+		{
+			for (int i = 0; i < 10; i++) a[i] += o.a[i];
+		}
+		// summed squared distance of p to the planes
+		double evaluate(const Vec3& p) const
+		{
+			return a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x
+				+ a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y
+				+ a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+}
+
+
+///// LodChain
+uint32_t LodChain::select(float pixelsPerUnit, float maxPixels, float hysteresis, uint32_t current) const
+{
+	for (auto level = static_cast<uint32_t>(levels.size()); level-- > 1;)
+	{
+		float limit = level > current ? maxPixels * (1.0f - hysteresis) : maxPixels;
+		if (levels[level].error * pixelsPerUnit <= limit)
+			return level;
+	}
+	return 0;
+}
+
+
+///// simplification
+std::vector<uint32_t> simplifyMesh(const float* positions, uint32_t vertexCount,
+	const std::vector<uint32_t>& source, uint32_t targetIndexCount, float maxError, float* resultError)
+{
+	auto position = [positions](uint32_t v) {
+		return Vec3{ positions[3 * v], positions[3 * v + 1], positions[3 * v + 2] };
+	};
+	std::vector<uint32_t> indices = source;
+	std::vector<uint32_t> offsets(vertexCount + 1), adjacency;
+
+	// triangles around each vertex, offsets into adjacency
+	auto buildAdjacency = [&]() {
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint32_t v : indices)
+			offsets[v + 1]++;
+		for (uint32_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	};
+	// triangles having both vertices: 1 on a boundary edge, 2 inside
+	auto shared = [&](uint32_t a, uint32_t b) {
+		uint32_t count = 0;
+		for (uint32_t i = offsets[a]; i < offsets[a + 1]; i++)
+		{
+			const uint32_t* t = &indices[3 * adjacency[i]];
+			count += (t[0] == b || t[1] == b || t[2] == b) ? 1 : 0;
+		}
+		return count;
+	};
+
+	// 1. boundary vertices, on an edge only one triangle uses
+	buildAdjacency();
+	std::vector<uint8_t> boundary(vertexCount, 0);
+	for (size_t t = 0; t < indices.size(); t += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t a = indices[t + e], b = indices[t + (e + 1) % 3];
+			if (shared(a, b) == 1)
+				boundary[a] = boundary[b] = 1;
+		}
+	}
+
+	// 2. quadrics: the plane of every triangle around a vertex, and for a boundary
+	// edge the plane through it at right angles to its triangle
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < indices.size(); t += 3)
+	{
+		uint32_t corners[3] = { indices[t], indices[t + 1], indices[t + 2] };
+		Vec3 p[3] = { position(corners[0]), position(corners[1]), position(corners[2]) };
+		Vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+		double length = std::sqrt(dot(n, n));
+		if (length == 0.0) continue;
+		n = { n.x / length, n.y / length, n.z / length };
+		for (uint32_t corner : corners)
+			quadrics[corner].addPlane(n, -dot(n, p[0]));
+
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t a = corners[e], b = corners[(e + 1) % 3];
+			if (!boundary[a] || !boundary[b] || shared(a, b) != 1) continue;
+			Vec3 side = cross(p[(e + 1) % 3] - p[e], n);
+			double sideLength = std::sqrt(dot(side, side));
+			if (sideLength == 0.0) continue;
+			side = { side.x / sideLength, side.y / sideLength, side.z / sideLength };
+			quadrics[a].addPlane(side, -dot(side, p[e]));
+			quadrics[b].addPlane(side, -dot(side, p[e]));
+		}
+	}
+
+	// a collapse must not turn any remaining triangle around from over, nor flatten it
+	// to a line
+	auto flips = [&](uint32_t from, uint32_t to) {
+		Vec3 target = position(to);
+		for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++)
+		{
+			const uint32_t* t = &indices[3 * adjacency[i]];
+			if (t[0] == to || t[1] == to || t[2] == to) continue;		// collapses away
+			Vec3 before[3] = { position(t[0]), position(t[1]), position(t[2]) };
+			Vec3 after[3] = { before[0], before[1], before[2] };
+			for (int c = 0; c < 3; c++)
+			{
+				if (t[c] == from) after[c] = target;
+			}
+			Vec3 nBefore = cross(before[1] - before[0], before[2] - before[0]);
+			Vec3 nAfter = cross(after[1] - after[0], after[2] - after[0]);
+			if (dot(nBefore, nAfter) <= 1e-8 * dot(nBefore, nBefore))
+				return true;
+		}
+		return false;
+	};
+
+	// 3. passes of independent collapses, cheapest first, until the target is met
+	double maxCost = static_cast<double>(maxError) * maxError;
+	double worst = 0.0;
+	auto targetTriangles = targetIndexCount / 3;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint8_t> locked(vertexCount);
+	while (indices.size() / 3 > targetTriangles)
+	{
+		// 3a. both directions of every edge; a boundary vertex only along the boundary
+		collapses.clear();
+		for (size_t t = 0; t < indices.size(); t += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				uint32_t a = indices[t + e], b = indices[t + (e + 1) % 3];
+				bool boundaryEdge = boundary[a] && boundary[b] && shared(a, b) == 1;
+				Quadric q = quadrics[a];
+				q.add(quadrics[b]);
+				if (!boundary[a] || boundaryEdge)
+					collapses.push_back({ a, b, q.evaluate(position(b)) });
+				if (!boundary[b] || boundaryEdge)
+					collapses.push_back({ b, a, q.evaluate(position(a)) });
+			}
+		}
+		std::stable_sort(collapses.begin(), collapses.end(),
+			[](const Collapse& l, const Collapse& r) { return l.cost < r.cost; });
+
+		// 3b. a collapse locks the triangles around its source for the rest of the pass,
+		// so every later check in the pass still sees current triangles
+		for (uint32_t v = 0; v < vertexCount; v++)
+			remap[v] = v;
+		std::fill(locked.begin(), locked.end(), 0);
+		auto triangles = static_cast<uint32_t>(indices.size() / 3);
+		uint32_t collapsed = 0;
+		for (const auto& collapse : collapses)
+		{
+			if (triangles <= targetTriangles || collapse.cost > maxCost) break;
+			if (locked[collapse.from] || locked[collapse.to] || flips(collapse.from, collapse.to)) continue;
+
+			for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++)
+			{
+				const uint32_t* t = &indices[3 * adjacency[i]];
+				locked[t[0]] = locked[t[1]] = locked[t[2]] = 1;
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			triangles -= shared(collapse.from, collapse.to);
+			worst = std::max(worst, collapse.cost);
+			collapsed++;
+		}
+		if (collapsed == 0) break;
+
+		// 3c. apply, dropping the triangles that lost a corner
+		size_t kept = 0;
+		for (size_t t = 0; t < indices.size(); t += 3)
+		{
+			uint32_t a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+			if (a == b || b == c || a == c) continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+		buildAdjacency();
+	}
+
+	if (resultError)
+		*resultError = static_cast<float>(std::sqrt(worst));
+	return indices;
+}
+
+LodChain buildLodChain(std::vector<float> positions, std::vector<uint32_t> indices, uint32_t maxLevels)
+{
+	LodChain chain;
+	chain.positions = std::move(positions);
+	auto vertexCount = static_cast<uint32_t>(chain.positions.size() / 3);
+
+	// each level simplifies the one before, so its error adds to theirs
+	float error = 0.0f;
+	for (;;)
+	{
+		chain.levels.push_back({ static_cast<uint32_t>(chain.indices.size()),
+			static_cast<uint32_t>(indices.size()), error });
+		chain.indices.insert(chain.indices.end(), indices.begin(), indices.end());
+		if (chain.levels.size() >= maxLevels) break;
+
+		float levelError = 0.0f;
+		auto next = simplifyMesh(chain.positions.data(), vertexCount, indices,
+			static_cast<uint32_t>(indices.size() / 6 * 3), FLT_MAX, &levelError);
+		// a level that saves less than a quarter is not worth the switch
+		if (next.size() > indices.size() * 3 / 4) break;
+		error += levelError;
+		indices.swap(next);
+	}
+	return chain;
+}
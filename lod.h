@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef XZ_LOD_H
+#define XZ_LOD_H
+
+#include <cstdint>
+#include <vector>
+
+// One level of a chain: a range of the chain's indices, and how far its surface
+// is at most from the full detail mesh, in mesh units.
+struct LodLevel
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+
+// Levels of detail of one triangle mesh, finest first. They only differ in their
+// indices: simplification keeps a subset of the original vertices, so one vertex
+// array and one index buffer hold the whole chain.
+struct LodChain
+{
+	std::vector<float> positions;		// x, y, z per vertex
+	std::vector<uint32_t> indices;		// every level, back to back
+	std::vector<LodLevel> levels;
+
+	// coarsest level whose error, scaled by pixelsPerUnit, stays within maxPixels;
+	// going coarser than current also needs the hysteresis margin (a fraction of
+	// maxPixels), so a draw hovering at the limit does not switch every frame
+	uint32_t select(float pixelsPerUnit, float maxPixels, float hysteresis, uint32_t current) const;
+};
+
+// Quadric error edge collapse (Garland and Heckbert), each vertex collapsing into
+// one of its neighbours. Boundary edges add a plane at right angles to their
+// triangle, so open and flat meshes keep their outline; boundary vertices only
+// move along the boundary, and no collapse may flip a triangle. Stops at
+// targetIndexCount or when the next collapse would cost more than maxError.
+// resultError gets the largest error of a collapse done, in mesh units.
+std::vector<uint32_t> simplifyMesh(const float* positions, uint32_t vertexCount,
+	const std::vector<uint32_t>& indices, uint32_t targetIndexCount, float maxError, float* resultError);
+
+// Halves the triangle count level after level, until maxLevels or until
+// simplification cannot go on without breaking the outline.
+LodChain buildLodChain(std::vector<float> positions, std::vector<uint32_t> indices, uint32_t maxLevels);
+
+#endif // !XZ_LOD_H
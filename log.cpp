@@ -0,0 +1,189 @@
+#include "log.h"
+
+#include "const.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+///// Logger
+Logger& Logger::get()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger()
+	: origin(std::chrono::steady_clock::now())
+{
+	for (uint32_t i = 0; i < RING_SIZE; i++)
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void Logger::start()
+{
+	if (running.exchange(true)) return;
+	flushThread = std::thread(&Logger::flushLoop, this);
+}
+
+void Logger::stop()
+{
+	if (!running.exchange(false)) return;
+	flushThread.join();
+}
+
+void Logger::write(LogLevel level, int64_t key, const char* format, ...)
+{
+	// 1. cheap rejections first: severity, then the per-key rate
+	if (!enabled(level)) return;
+	if (key != NO_KEY && !allow(key)) return;
+
+	// 2. format straight into the ring slot
+	Record* record = claim();
+	if (!record) return;
+	record->level = level;
+	va_list args;
+	va_start(args, format);
+	std::vsnprintf(record->text, MESSAGE_SIZE, format, args);
+	va_end(args);
+	publish(record);
+}
+
+void Logger::write(LogLevel level, const std::string& text, int64_t key)
+{
+	if (!enabled(level)) return;
+	if (key != NO_KEY && !allow(key)) return;
+
+	// a record per line and per MESSAGE_SIZE chunk of it, so nothing is cut
+	const size_t chunk = MESSAGE_SIZE - 1;
+	size_t begin = 0;
+	while (begin < text.size())
+	{
+		size_t lineEnd = text.find('\n', begin);
+		if (lineEnd == std::string::npos) lineEnd = text.size();
+		size_t end = std::min(lineEnd, begin + chunk);
+		write(level, NO_KEY, "%.*s", static_cast<int>(end - begin), text.c_str() + begin);
+		begin = end == lineEnd ? end + 1 : end;
+	}
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level)
+{
+	if (name == "debug") level = LogLevel::Debug;
+	else if (name == "info") level = LogLevel::Info;
+	else if (name == "warning") level = LogLevel::Warning;
+	else if (name == "error") level = LogLevel::Error;
+	else return false;
+	return true;
+}
+
+Logger::Record* Logger::claim()
+{
+	// bounded MPMC ring: a slot is free for position pos when its sequence equals pos
+	uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		Record& record = ring[pos & (RING_SIZE - 1)];
+		uint64_t sequence = record.sequence.load(std::memory_order_acquire);
+		int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+		if (diff == 0)
+		{
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				return &record;
+		}
+		else if (diff < 0)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		else
+			pos = enqueuePos.load(std::memory_order_relaxed);
+	}
+}
+
+void Logger::publish(Record* record)
+{
+	uint64_t pos = record->sequence.load(std::memory_order_relaxed);
+	record->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool Logger::allow(int64_t key)
+{
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - origin).count();
+
+	// 1. find or take the key's slot; a full neighbourhood lets the message through
+	uint64_t hash = (static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ull) >> 32;
+	RateSlot* slot = nullptr;
+	for (uint32_t probe = 0; probe < RATE_PROBES && !slot; probe++)
+	{
+		RateSlot& candidate = rateSlots[(hash + probe) & (RATE_SLOTS - 1)];
+		int64_t current = candidate.key.load(std::memory_order_acquire);
+		if (current == key
+			|| (current == NO_KEY && (candidate.key.compare_exchange_strong(current, key) || current == key)))
+			slot = &candidate;
+	}
+	if (!slot) return true;
+
+	// 2. a new window resets the count and reports what the last one swallowed
+	int64_t windowStart = slot->windowStart.load(std::memory_order_relaxed);
+	if (now - windowStart >= static_cast<int64_t>(LOG_RATE_WINDOW_MS)
+		&& slot->windowStart.compare_exchange_strong(windowStart, now))
+	{
+		uint32_t previous = slot->count.exchange(1, std::memory_order_relaxed);
+		if (previous > LOG_RATE_LIMIT)
+		{
+			if (Record* record = claim())
+			{
+				record->level = LogLevel::Info;
+				std::snprintf(record->text, MESSAGE_SIZE, "log: %u repeats of message 0x%llx suppressed",
+					previous - LOG_RATE_LIMIT, static_cast<unsigned long long>(key));
+				publish(record);
+			}
+		}
+		return true;
+	}
+	return slot->count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT;
+}
+
+void Logger::flushLoop()
+{
+	while (running.load(std::memory_order_relaxed))
+	{
+		if (!drain())
+			std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+	}
+	drain();
+}
+
+bool Logger::drain()
+{
+	// one flush per batch, not per line
+	bool wroteOut = false, wroteErr = false;
+	for (;;)
+	{
+		Record& record = ring[dequeuePos & (RING_SIZE - 1)];
+		if (record.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+			break;
+
+		bool error = record.level >= LogLevel::Warning;
+		(error ? std::cerr : std::cout) << record.text << '\n';
+		wroteErr |= error;
+		wroteOut |= !error;
+
+		record.sequence.store(dequeuePos + RING_SIZE, std::memory_order_release);
+		dequeuePos++;
+	}
+
+	uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+	if (lost > 0)
+	{
+		std::cerr << "log: " << lost << " messages dropped, ring full\n";
+		wroteErr = true;
+	}
+	if (wroteOut) std::cout.flush();
+	if (wroteErr) std::cerr.flush();
+	return wroteOut || wroteErr;
+}
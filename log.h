@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef XZ_LOG_H
+#define XZ_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+enum class LogLevel : uint32_t
+{
+	Debug,
+	Info,
+	Warning,
+	Error,
+};
+
+// Asynchronous logger. Callers format into a slot of a bounded lock-free ring
+// and return; a background thread writes the slots out in batches, warnings
+// and errors to stderr, the rest to stdout. A full ring drops the message and
+// counts it, so a call never blocks and never allocates. Keyed messages are
+// rate limited per key, the flush thread reports how many were suppressed.
+class Logger
+{
+public:
+	static const int64_t NO_KEY = INT64_MIN;
+
+	static Logger& get();
+
+	void start();
+	void stop();		// flushes what is queued
+
+	void setLevel(LogLevel level) { minLevel.store(static_cast<uint32_t>(level), std::memory_order_relaxed); }
+	bool enabled(LogLevel level) const
+	{
+		return static_cast<uint32_t>(level) >= minLevel.load(std::memory_order_relaxed);
+	}
+
+	// printf-style, truncated to MESSAGE_SIZE
+	void write(LogLevel level, int64_t key, const char* format, ...);
+	// one record per line of text, long lines continue in further records;
+	// the key rate limits the text as a whole
+	void write(LogLevel level, const std::string& text, int64_t key = NO_KEY);
+
+	static bool parseLevel(const std::string& name, LogLevel& level);
+
+private:
+	static const uint32_t RING_SIZE = 1024;			// power of two
+	static const uint32_t MESSAGE_SIZE = 256;
+	static const uint32_t RATE_SLOTS = 256;			// power of two
+	static const uint32_t RATE_PROBES = 8;
+
+	struct Record
+	{
+		std::atomic<uint64_t> sequence{ 0 };
+		LogLevel level = LogLevel::Info;
+		char text[MESSAGE_SIZE] = {};
+	};
+
+	struct RateSlot
+	{
+		std::atomic<int64_t> key{ NO_KEY };
+		std::atomic<int64_t> windowStart{ 0 };
+		std::atomic<uint32_t> count{ 0 };
+	};
+
+	Logger();
+
+	Record* claim();
+	void publish(Record* record);
+	bool allow(int64_t key);
+	void flushLoop();
+	bool drain();
+
+	Record ring[RING_SIZE];
+	std::atomic<uint64_t> enqueuePos{ 0 };
+	uint64_t dequeuePos = 0;						// flush thread only
+
+	RateSlot rateSlots[RATE_SLOTS];
+	std::chrono::steady_clock::time_point origin;
+
+	std::atomic<uint32_t> minLevel{ static_cast<uint32_t>(LogLevel::Info) };
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<bool> running{ false };
+	std::thread flushThread;
+};
+
+#endif // !XZ_LOG_H
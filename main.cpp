@@ -1,15 +1,38 @@
 #include "app.h"
 
-int main()
+int main(int argc, char** argv)
 {
 	BaseVulkanApplication app;
 
 	try
 	{
-		app.run();
+		auto options = util_LaunchOptions::parse(argc, argv);
+		if (options.benchSortDraws > 0)
+		{
+			benchmarkDrawList(options.benchSortDraws, std::cout);
+			return EXIT_SUCCESS;
+		}
+		if (options.benchJobs)
+		{
+			benchmarkJobs(std::cout);
+			return EXIT_SUCCESS;
+		}
+		if (options.benchCullObjects > 0)
+		{
+			benchmarkCulling(options.benchCullObjects, std::cout);
+			return EXIT_SUCCESS;
+		}
+		if (options.benchTransformNodes > 0)
+		{
+			benchmarkTransforms(options.benchTransformNodes, std::cout);
+			return EXIT_SUCCESS;
+		}
+		app.run(options);
 	}
 	catch (const std::exception& e)
 	{
+		// let queued messages out first, they usually explain the failure
+		Logger::get().stop();
 		std::cerr << e.what() << std::endl;
 		return EXIT_FAILURE;
 	}
@@ -0,0 +1,116 @@
+#include "membudget.h"
+
+#include "const.h"
+
+#include <algorithm>
+#include <iomanip>
+
+///// MemoryBudget
+void MemoryBudget::init(VkPhysicalDevice physicalDevice, bool extensionEnabled)
+{
+	this->physicalDevice = physicalDevice;
+	enabled = extensionEnabled;
+
+	VkPhysicalDeviceMemoryProperties properties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &properties);
+	heaps.assign(properties.memoryHeapCount, Heap{});
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+	{
+		heaps[i].size = properties.memoryHeaps[i].size;
+		heaps[i].budget = properties.memoryHeaps[i].size;
+		heaps[i].deviceLocal = (properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+	}
+	update();
+}
+
+void MemoryBudget::update()
+{
+	if (!enabled) return;
+
+	// 1. usage and budget come back chained to the regular memory properties
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	properties.pNext = &budgetProperties;
+	vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+	for (uint32_t i = 0; i < heaps.size(); i++)
+	{
+		auto& heap = heaps[i];
+		heap.budget = budgetProperties.heapBudget[i];
+		heap.usage = budgetProperties.heapUsage[i];
+
+		float fraction = heap.budget > 0 ? static_cast<float>(static_cast<double>(heap.usage) / heap.budget) : 0.0f;
+		heap.minFraction = std::min(heap.minFraction, fraction);
+		heap.maxFraction = std::max(heap.maxFraction, fraction);
+
+		// 2. tell the listeners when the heap changes level
+		MemoryPressure level = classify(fraction, heap.pressure);
+		if (level != heap.pressure)
+		{
+			heap.pressure = level;
+			for (auto& listener : listeners)
+				listener(i, heap);
+		}
+	}
+}
+
+MemoryPressure MemoryBudget::pressure() const
+{
+	MemoryPressure worst = MemoryPressure::Normal;
+	for (const auto& heap : heaps)
+		worst = std::max(worst, heap.pressure);
+	return worst;
+}
+
+void MemoryBudget::report(std::ostream& out)
+{
+	if (!enabled) return;
+
+	out << std::fixed << std::setprecision(1);
+	for (uint32_t i = 0; i < heaps.size(); i++)
+	{
+		auto& heap = heaps[i];
+		float fraction = heap.budget > 0 ? static_cast<float>(static_cast<double>(heap.usage) / heap.budget) : 0.0f;
+		out << "Budget: heap " << i << (heap.deviceLocal ? " device-local, " : " host, ")
+			<< heap.usage / 1048576.0 << '/' << heap.budget / 1048576.0 << " MiB (" << 100.0f * fraction
+			<< "%), interval " << 100.0f * heap.minFraction << '-' << 100.0f * heap.maxFraction
+			<< "%, " << pressureName(heap.pressure);
+
+		// peaks of earlier intervals, oldest first
+		heap.history.push_back(heap.maxFraction);
+		if (heap.history.size() > MEMORY_BUDGET_HISTORY)
+			heap.history.erase(heap.history.begin());
+		out << ", history";
+		for (float peak : heap.history)
+			out << ' ' << 100.0f * peak;
+		out << "%\n";
+
+		heap.minFraction = 1.0f;
+		heap.maxFraction = 0.0f;
+	}
+}
+
+const char* MemoryBudget::pressureName(MemoryPressure pressure)
+{
+	switch (pressure)
+	{
+	case MemoryPressure::Warning: return "warning";
+	case MemoryPressure::Critical: return "critical";
+	default: return "normal";
+	}
+}
+
+MemoryPressure MemoryBudget::classify(float fraction, MemoryPressure current) const
+{
+	// going up takes the threshold, coming down takes the threshold minus hysteresis
+	float warning = MEMORY_BUDGET_WARNING;
+	float critical = MEMORY_BUDGET_CRITICAL;
+	if (current >= MemoryPressure::Warning) warning -= MEMORY_BUDGET_HYSTERESIS;
+	if (current >= MemoryPressure::Critical) critical -= MEMORY_BUDGET_HYSTERESIS;
+
+	if (fraction >= critical) return MemoryPressure::Critical;
+	if (fraction >= warning) return MemoryPressure::Warning;
+	return MemoryPressure::Normal;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef XZ_MEMBUDGET_H
+#define XZ_MEMBUDGET_H
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+enum class MemoryPressure : uint32_t
+{
+	Normal,
+	Warning,		// usage past MEMORY_BUDGET_WARNING of the budget
+	Critical,		// past MEMORY_BUDGET_CRITICAL, the driver is about to page
+};
+
+// Per-heap memory usage against the budget VK_EXT_memory_budget reports.
+// update() once a frame; listeners hear about every change of a heap's
+// pressure level and shed what they keep in that heap. Levels drop again
+// only MEMORY_BUDGET_HYSTERESIS below their threshold, so they do not flap.
+// Without the extension there is nothing to read and every heap stays normal.
+class MemoryBudget
+{
+public:
+	struct Heap
+	{
+		VkDeviceSize size = 0;
+		VkDeviceSize budget = 0;
+		VkDeviceSize usage = 0;
+		bool deviceLocal = false;
+		MemoryPressure pressure = MemoryPressure::Normal;
+
+		// since the last report
+		float minFraction = 1.0f;
+		float maxFraction = 0.0f;
+		std::vector<float> history;		// peak fraction of each past report, oldest first
+	};
+
+	using Listener = std::function<void(uint32_t heapIndex, const Heap& heap)>;
+
+	void init(VkPhysicalDevice physicalDevice, bool extensionEnabled);
+	void update();
+	void subscribe(Listener listener) { listeners.push_back(std::move(listener)); }
+
+	bool available() const { return enabled; }
+	const std::vector<Heap>& heapStates() const { return heaps; }
+	MemoryPressure pressure() const;			// worst heap
+
+	// one line per heap with its history, then starts a new interval
+	void report(std::ostream& out);
+
+	static const char* pressureName(MemoryPressure pressure);
+
+private:
+	MemoryPressure classify(float fraction, MemoryPressure current) const;
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	bool enabled = false;
+	std::vector<Heap> heaps;
+	std::vector<Listener> listeners;
+};
+
+#endif // !XZ_MEMBUDGET_H
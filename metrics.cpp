@@ -0,0 +1,298 @@
+#include "metrics.h"
+
+#include "const.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // !MSG_NOSIGNAL
+#endif // !_WIN32
+
+namespace
+{
+	// name{labels} or just name, with an extra label appended when given
+	void writeSeries(std::ostream& out, const std::string& name, const std::string& labels,
+		const std::string& extra = "")
+	{
+		out << name;
+		if (!labels.empty() || !extra.empty())
+		{
+			out << '{' << labels;
+			if (!labels.empty() && !extra.empty()) out << ',';
+			out << extra << '}';
+		}
+		out << ' ';
+	}
+}
+
+
+///// MetricHistogram
+MetricHistogram::MetricHistogram(std::vector<double> upperBounds)
+	: bounds(std::move(upperBounds)), buckets(new std::atomic<uint64_t>[bounds.size() + 1])
+{
+	std::sort(bounds.begin(), bounds.end());
+	for (size_t i = 0; i <= bounds.size(); i++)
+		buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::observe(double v)
+{
+	// a handful of bounds, a linear scan beats anything clever
+	size_t i = 0;
+	while (i < bounds.size() && v > bounds[i])
+		i++;
+	buckets[i].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+
+	double sum = sumValue.load(std::memory_order_relaxed);
+	while (!sumValue.compare_exchange_weak(sum, sum + v, std::memory_order_relaxed))
+		;
+}
+
+
+///// MetricsRegistry
+MetricCounter* MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+	auto& entry = add(name, help, labels, Type::Counter);
+	entry.counter = std::make_unique<MetricCounter>();
+	return entry.counter.get();
+}
+
+MetricGauge* MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+	auto& entry = add(name, help, labels, Type::Gauge);
+	entry.gauge = std::make_unique<MetricGauge>();
+	return entry.gauge.get();
+}
+
+MetricHistogram* MetricsRegistry::histogram(const std::string& name, const std::string& help,
+	std::vector<double> bounds, const std::string& labels)
+{
+	auto& entry = add(name, help, labels, Type::Histogram);
+	entry.histogram = std::make_unique<MetricHistogram>(std::move(bounds));
+	return entry.histogram.get();
+}
+
+MetricsRegistry::Entry& MetricsRegistry::add(const std::string& name, const std::string& help,
+	const std::string& labels, Type type)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (const auto& entry : entries)
+	{
+		if (entry->name == name && (entry->type != type || entry->labels == labels))
+			throw std::runtime_error("metric " + name + " registered twice");
+	}
+	entries.push_back(std::make_unique<Entry>());
+	auto& entry = *entries.back();
+	entry.name = name;
+	entry.help = help;
+	entry.labels = labels;
+	entry.type = type;
+	return entry;
+}
+
+void MetricsRegistry::write(std::ostream& out) const
+{
+	static const char* typeNames[] = { "counter", "gauge", "histogram" };
+	std::lock_guard<std::mutex> guard(lock);
+	out << std::setprecision(9);
+
+	// families in registration order of their first member, HELP and TYPE once each
+	std::vector<const std::string*> written;
+	for (const auto& first : entries)
+	{
+		if (std::find_if(written.begin(), written.end(),
+			[&](const std::string* name) { return *name == first->name; }) != written.end())
+			continue;
+		written.push_back(&first->name);
+		out << "# HELP " << first->name << ' ' << first->help << '\n';
+		out << "# TYPE " << first->name << ' ' << typeNames[static_cast<int>(first->type)] << '\n';
+
+		for (const auto& entry : entries)
+		{
+			if (entry->name != first->name) continue;
+			switch (entry->type)
+			{
+			case Type::Counter:
+				writeSeries(out, entry->name, entry->labels);
+				out << entry->counter->get() << '\n';
+				break;
+			case Type::Gauge:
+				writeSeries(out, entry->name, entry->labels);
+				out << entry->gauge->get() << '\n';
+				break;
+			case Type::Histogram:
+			{
+				// buckets are exported cumulative, the last one is +Inf
+				const auto& histogram = *entry->histogram;
+				const auto& bounds = histogram.upperBounds();
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i <= bounds.size(); i++)
+				{
+					cumulative += histogram.bucket(i);
+					std::ostringstream le;
+					le << std::setprecision(9) << "le=\"";
+					if (i < bounds.size()) le << bounds[i];
+					else le << "+Inf";
+					le << '"';
+					writeSeries(out, entry->name + "_bucket", entry->labels, le.str());
+					out << cumulative << '\n';
+				}
+				writeSeries(out, entry->name + "_sum", entry->labels);
+				out << histogram.sum() << '\n';
+				writeSeries(out, entry->name + "_count", entry->labels);
+				out << cumulative << '\n';
+				break;
+			}
+			}
+		}
+	}
+}
+
+
+///// MetricsExporter
+void MetricsExporter::start(const MetricsRegistry& registry, const std::string& filePath, const std::string& socketPath)
+{
+	if (filePath.empty() && socketPath.empty()) return;
+	this->registry = &registry;
+	this->filePath = filePath;
+	this->socketPath = socketPath;
+
+	if (!socketPath.empty())
+	{
+#ifndef _WIN32
+		// 1. a stale socket file from an earlier run would make bind fail
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+			throw std::runtime_error("metrics socket path is too long");
+		std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath.c_str());
+		::unlink(socketPath.c_str());
+
+		listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenSocket < 0
+			|| ::bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+			|| ::listen(listenSocket, 4) != 0)
+		{
+			if (listenSocket >= 0) ::close(listenSocket);
+			listenSocket = -1;
+			throw std::runtime_error("failed to listen on metrics socket " + socketPath);
+		}
+#else
+		throw std::runtime_error("metrics socket needs Unix domain sockets, use a metrics file");
+#endif // !_WIN32
+	}
+
+	// 2. the export thread
+	running = true;
+	exportThread = std::thread(&MetricsExporter::exportLoop, this);
+}
+
+void MetricsExporter::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!running) return;
+		running = false;
+	}
+	wake.notify_all();
+	exportThread.join();
+
+	// one last file with the final values
+	if (!filePath.empty())
+		writeFile();
+#ifndef _WIN32
+	if (listenSocket >= 0)
+	{
+		::close(listenSocket);
+		::unlink(socketPath.c_str());
+		listenSocket = -1;
+	}
+#endif // !_WIN32
+}
+
+void MetricsExporter::exportLoop()
+{
+	auto interval = std::chrono::milliseconds(METRICS_EXPORT_INTERVAL_MS);
+	auto nextFile = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!running) return;
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (!filePath.empty() && now >= nextFile)
+		{
+			writeFile();
+			nextFile = now + interval;
+		}
+
+		// the socket is served between file writes, a short poll keeps stop() prompt
+		if (listenSocket >= 0)
+			serveSocket(static_cast<int>(std::min<uint32_t>(METRICS_EXPORT_INTERVAL_MS, METRICS_SOCKET_POLL_MS)));
+		else
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait_until(guard, nextFile, [this] { return !running; });
+		}
+	}
+}
+
+void MetricsExporter::writeFile()
+{
+	std::ostringstream text;
+	registry->write(text);
+
+	// write aside and rename over, so a scraper never reads a partial file
+	std::string temporary = filePath + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file) return;
+		file << text.str();
+	}
+#ifdef _WIN32
+	std::remove(filePath.c_str());		// rename does not replace an existing file here
+#endif // _WIN32
+	std::rename(temporary.c_str(), filePath.c_str());
+}
+
+void MetricsExporter::serveSocket(int timeoutMs)
+{
+#ifndef _WIN32
+	pollfd request{};
+	request.fd = listenSocket;
+	request.events = POLLIN;
+	if (::poll(&request, 1, timeoutMs) <= 0 || (request.revents & POLLIN) == 0)
+		return;
+
+	int client = ::accept(listenSocket, nullptr, nullptr);
+	if (client < 0) return;
+
+	std::ostringstream out;
+	registry->write(out);
+	std::string text = out.str();
+	size_t sent = 0;
+	while (sent < text.size())
+	{
+		ssize_t n = ::send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) break;
+		sent += static_cast<size_t>(n);
+	}
+	::close(client);
+#else
+	(void)timeoutMs;
+#endif // !_WIN32
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef XZ_METRICS_H
+#define XZ_METRICS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Monotonic count, add() from any thread.
+class MetricCounter
+{
+public:
+	void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> value{ 0 };
+};
+
+// Last value set, from any thread.
+class MetricGauge
+{
+public:
+	void set(double v) { value.store(v, std::memory_order_relaxed); }
+	double get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<double> value{ 0.0 };
+};
+
+// Observations counted into buckets with fixed upper bounds, plus their sum.
+class MetricHistogram
+{
+public:
+	explicit MetricHistogram(std::vector<double> bounds);
+
+	void observe(double v);
+
+	const std::vector<double>& upperBounds() const { return bounds; }
+	uint64_t bucket(size_t i) const { return buckets[i].load(std::memory_order_relaxed); }	// not cumulative
+	uint64_t count() const { return total.load(std::memory_order_relaxed); }
+	double sum() const { return sumValue.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<double> bounds;							// ascending, +Inf is implied
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets;	// one per bound and one for +Inf
+	std::atomic<uint64_t> total{ 0 };
+	std::atomic<double> sumValue{ 0.0 };
+};
+
+// Named metrics, registered once at startup and then updated lock-free from
+// the hot path through the returned pointers, which stay valid for the
+// registry's lifetime. write() renders all of them in the Prometheus text
+// exposition format; metrics sharing a name form one family and differ in
+// their labels, e.g. R"(result="suboptimal")".
+class MetricsRegistry
+{
+public:
+	MetricCounter* counter(const std::string& name, const std::string& help, const std::string& labels = "");
+	MetricGauge* gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+	MetricHistogram* histogram(const std::string& name, const std::string& help, std::vector<double> bounds,
+		const std::string& labels = "");
+
+	void write(std::ostream& out) const;
+
+private:
+	enum class Type { Counter, Gauge, Histogram };
+
+	struct Entry
+	{
+		std::string name;
+		std::string help;
+		std::string labels;
+		Type type = Type::Counter;
+		std::unique_ptr<MetricCounter> counter;
+		std::unique_ptr<MetricGauge> gauge;
+		std::unique_ptr<MetricHistogram> histogram;
+	};
+
+	Entry& add(const std::string& name, const std::string& help, const std::string& labels, Type type);
+
+	mutable std::mutex lock;		// registration and write(), never the updates
+	std::vector<std::unique_ptr<Entry>> entries;
+};
+
+// Writes a registry out every METRICS_EXPORT_INTERVAL_MS from its own thread:
+// to a file, replaced whole so a reader never sees half of it, and/or to
+// every client connecting to a Unix domain socket (not on Windows), which
+// gets the current text and is disconnected.
+class MetricsExporter
+{
+public:
+	~MetricsExporter() { stop(); }
+
+	void start(const MetricsRegistry& registry, const std::string& filePath, const std::string& socketPath);
+	void stop();
+
+private:
+	void exportLoop();
+	void writeFile();
+	void serveSocket(int timeoutMs);
+
+	const MetricsRegistry* registry = nullptr;
+	std::string filePath;
+	std::string socketPath;
+	int listenSocket = -1;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	bool running = false;
+	std::thread exportThread;
+};
+
+#endif // !XZ_METRICS_H
@@ -0,0 +1,421 @@
+#include "particles.h"
+
+#include "const.h"
+#include "shaders.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <stdexcept>
+
+namespace
+{
+	// layout must match the particle struct of shader/particle_*.comp and particle.vert
+	struct GpuParticle
+	{
+		float position[2];
+		float velocity[2];
+		float life;				// seconds lived
+		float maxLife;			// seconds it dies at
+	};
+
+	// layout must match the push constants of shader/particle_*.comp
+	struct ParticleConstants
+	{
+		uint32_t live;			// half emitted into and simulated
+		uint32_t capacity;		// particles per half
+		uint32_t emitCount;
+		uint32_t seed;
+		float dt;
+		float lifetime;
+		float gravity;
+		float speed;
+		float emitter[2];
+		uint32_t prefill;		// emitted with a random part of their life already spent
+	};
+
+	// the state buffer: live count per half, then the draw arguments
+	const VkDeviceSize STATE_COUNTS = 0;
+	const VkDeviceSize STATE_DRAW = 2 * sizeof(uint32_t);
+	const VkDeviceSize STATE_SIZE = STATE_DRAW + sizeof(VkDrawIndirectCommand);
+
+	const uint32_t GROUP_SIZE = 256;		// local_size_x of every particle pass
+	const float MAX_STEP = 0.1f;			// seconds; a stall must not emit a burst
+}
+
+
+///// ParticleSystem
+void ParticleSystem::init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily,
+	uint32_t framesInFlight, const VkAllocationCallbacks* allocator)
+{
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+	this->allocator = allocator;
+
+	// 1. timestamps, when the queue has them
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+	if (validBits > 0)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	}
+
+	// 2. binding 0 is the particles, which the vertex shader reads too; binding 1 the state
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ParticleConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle pipeline layout!");
+
+	emitPipeline = createPipeline("particle_emit.comp.spv");
+	simulatePipeline = createPipeline("particle_simulate.comp.spv");
+	compactPipeline = createPipeline("particle_compact.comp.spv");
+
+	// 3. the one set, rewritten by resize
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 2;
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(device, &poolInfo, allocator, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate particle descriptor set!");
+
+	// 4. a command buffer per frame in flight, re-recorded every frame
+	VkCommandPoolCreateInfo commandPoolInfo{};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	commandPoolInfo.queueFamilyIndex = queueFamily;
+	if (vkCreateCommandPool(device, &commandPoolInfo, allocator, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle command pool!");
+
+	commandBuffers.resize(framesInFlight);
+	VkCommandBufferAllocateInfo cmdInfo{};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.commandPool = commandPool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = framesInFlight;
+	if (vkAllocateCommandBuffers(device, &cmdInfo, commandBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate particle command buffers!");
+	submitted.assign(framesInFlight, 0);
+
+	// 5. timestamps around the simulation and around one window's draw
+	if (timestampMask != 0)
+	{
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = QUERIES_PER_FRAME * framesInFlight;
+		if (vkCreateQueryPool(device, &queryPoolInfo, allocator, &queryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create particle query pool!");
+	}
+}
+
+VkPipeline ParticleSystem::createPipeline(const char* path)
+{
+	auto code = ShaderLibrary::get().load(path);
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code.size();
+	moduleInfo.pCode = code.data();
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &moduleInfo, allocator, &shaderModule) != VK_SUCCESS)
+		throw std::runtime_error(std::string("failed to create shader module ") + path);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &pipeline);
+	vkDestroyShaderModule(device, shaderModule, allocator);
+	if (result != VK_SUCCESS)
+		throw std::runtime_error(std::string("failed to create compute pipeline for ") + path);
+	return pipeline;
+}
+
+void ParticleSystem::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkAllocateMemory(device, &allocInfo, allocator, &memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate particle memory!");
+	vkBindBufferMemory(device, buffer, memory, 0);
+}
+
+void ParticleSystem::resize(uint32_t capacity)
+{
+	destroyBuffers();
+	particleCapacity = capacity;
+
+	// 1. both halves back to back; the state is only ever written on the GPU
+	createBuffer(2 * static_cast<VkDeviceSize>(capacity) * sizeof(GpuParticle), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		particleBuffer, particleMemory);
+	createBuffer(STATE_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+		| VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, stateBuffer, stateMemory);
+
+	// 2. the set keeps its handle, cached draws that bind it stay valid
+	VkDescriptorBufferInfo bufferInfos[2]{};
+	bufferInfos[0] = { particleBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { stateBuffer, 0, VK_WHOLE_SIZE };
+	VkWriteDescriptorSet writes[2]{};
+	for (uint32_t binding = 0; binding < 2; binding++)
+	{
+		writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[binding].dstSet = descriptorSet;
+		writes[binding].dstBinding = binding;
+		writes[binding].descriptorCount = 1;
+		writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[binding].pBufferInfo = &bufferInfos[binding];
+	}
+	vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+	live = 0;
+	prefill = true;
+	emitBacklog = 0.0;
+}
+
+void ParticleSystem::destroyBuffers()
+{
+	vkDestroyBuffer(device, particleBuffer, allocator);
+	vkFreeMemory(device, particleMemory, allocator);
+	vkDestroyBuffer(device, stateBuffer, allocator);
+	vkFreeMemory(device, stateMemory, allocator);
+	particleBuffer = stateBuffer = VK_NULL_HANDLE;
+	particleMemory = stateMemory = VK_NULL_HANDLE;
+	particleCapacity = 0;
+}
+
+void ParticleSystem::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+	destroyBuffers();
+	vkDestroyQueryPool(device, queryPool, allocator);
+	vkDestroyCommandPool(device, commandPool, allocator);
+	vkDestroyDescriptorPool(device, descriptorPool, allocator);
+	for (auto pipeline : { emitPipeline, simulatePipeline, compactPipeline })
+		vkDestroyPipeline(device, pipeline, allocator);
+	vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	vkDestroyDescriptorSetLayout(device, setLayout, allocator);
+	queryPool = VK_NULL_HANDLE;
+	commandPool = VK_NULL_HANDLE;
+	commandBuffers.clear();
+	descriptorPool = VK_NULL_HANDLE;
+	descriptorSet = VK_NULL_HANDLE;
+	emitPipeline = simulatePipeline = compactPipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	setLayout = VK_NULL_HANDLE;
+}
+
+VkCommandBuffer ParticleSystem::record(uint32_t frame)
+{
+	// 1. the step since the last simulation, and what it owes the emitter: capacity
+	// over the lifetime per second keeps the live count steady at about three quarters
+	auto now = std::chrono::steady_clock::now();
+	float dt = 0.0f;
+	if (lastRecord != std::chrono::steady_clock::time_point{})
+		dt = std::min(std::chrono::duration<float>(now - lastRecord).count(), MAX_STEP);
+	lastRecord = now;
+
+	ParticleConstants constants{};
+	constants.live = live;
+	constants.capacity = particleCapacity;
+	constants.seed = seed++;
+	constants.dt = dt;
+	constants.lifetime = PARTICLE_LIFETIME;
+	constants.gravity = PARTICLE_GRAVITY;
+	constants.speed = PARTICLE_SPEED;
+	constants.emitter[1] = PARTICLE_EMITTER_Y;
+	constants.prefill = prefill ? 1 : 0;
+	if (prefill)
+		constants.emitCount = particleCapacity / 4 * 3;
+	else
+	{
+		emitBacklog += particleCapacity / PARTICLE_LIFETIME * dt;
+		constants.emitCount = std::min(static_cast<uint32_t>(emitBacklog), particleCapacity);
+		emitBacklog -= constants.emitCount;
+	}
+
+	VkCommandBuffer commandBuffer = commandBuffers[frame];
+	vkResetCommandBuffer(commandBuffer, 0);
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording particle command buffer!");
+
+	uint32_t query = QUERIES_PER_FRAME * frame;
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, query, QUERIES_PER_FRAME);
+		submitted[frame] = 1;
+	}
+
+	// 2. the last frame's draws and argument copies are done with what this one rewrites;
+	// fresh buffers start with no particles and a quad per instance
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+		| VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+		| VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+	if (prefill)
+	{
+		uint32_t state[STATE_SIZE / sizeof(uint32_t)] = { 0, 0, VERTICES_PER_PARTICLE, 0, 0, 0 };
+		vkCmdUpdateBuffer(commandBuffer, stateBuffer, STATE_COUNTS, sizeof(state), state);
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+
+	// 3. emit appends to the live half, simulate integrates it in place
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	if (constants.emitCount > 0)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, emitPipeline);
+		vkCmdDispatch(commandBuffer, groups(constants.emitCount, GROUP_SIZE), 1, 1);
+		computeBarrier(commandBuffer);
+	}
+	// the live count stays on the GPU, so these cover the whole half and end early past it
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, simulatePipeline);
+	vkCmdDispatch(commandBuffer, groups(particleCapacity, GROUP_SIZE), 1, 1);
+	computeBarrier(commandBuffer);
+
+	// 4. the survivors move to the other half, which becomes live
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compactPipeline);
+	vkCmdDispatch(commandBuffer, groups(particleCapacity, GROUP_SIZE), 1, 1);
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	// 5. draw arguments from the new count; the old half starts empty next frame
+	uint32_t next = 1 - live;
+	VkBufferCopy countCopy{};
+	countCopy.srcOffset = STATE_COUNTS + next * sizeof(uint32_t);
+	countCopy.dstOffset = STATE_DRAW + offsetof(VkDrawIndirectCommand, instanceCount);
+	countCopy.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(commandBuffer, stateBuffer, stateBuffer, 1, &countCopy);
+	vkCmdFillBuffer(commandBuffer, stateBuffer, STATE_COUNTS + live * sizeof(uint32_t), sizeof(uint32_t), 0);
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query + 1);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record particle command buffer!");
+	live = next;
+	prefill = false;
+	return commandBuffer;
+}
+
+void ParticleSystem::recordDraw(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frame, bool timed)
+{
+	uint32_t query = QUERIES_PER_FRAME * frame;
+	timed = timed && queryPool != VK_NULL_HANDLE;
+	if (timed)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query + 2);
+	// firstInstance stays 0, drawIndirectFirstInstance is optional: the live half's
+	// first particle follows the draw constants instead
+	uint32_t first = live * particleCapacity;
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(util_DrawCommand),
+		sizeof(first), &first);
+	vkCmdDrawIndirect(commandBuffer, stateBuffer, STATE_DRAW, 1, sizeof(VkDrawIndirectCommand));
+	if (timed)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query + 3);
+}
+
+void ParticleSystem::collect(uint32_t frame)
+{
+	if (queryPool == VK_NULL_HANDLE || !submitted[frame]) return;
+	submitted[frame] = 0;
+
+	// the draw pair stays unavailable when the timed window did not draw that frame
+	uint64_t timestamps[2] = {};
+	uint32_t query = QUERIES_PER_FRAME * frame;
+	if (vkGetQueryPoolResults(device, queryPool, query, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		simulateNs += ((timestamps[1] - timestamps[0]) & timestampMask) * static_cast<double>(timestampPeriod);
+		simulateFrames++;
+	}
+	if (vkGetQueryPoolResults(device, queryPool, query + 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		drawNs += ((timestamps[1] - timestamps[0]) & timestampMask) * static_cast<double>(timestampPeriod);
+		drawFrames++;
+	}
+}
+
+void ParticleSystem::report(std::ostream& out)
+{
+	out << "Particles: capacity " << particleCapacity << std::fixed << std::setprecision(3);
+	if (simulateFrames > 0)
+		out << ", simulate " << simulateNs / simulateFrames / 1e6 << " ms";
+	if (drawFrames > 0)
+		out << ", draw " << drawNs / drawFrames / 1e6 << " ms";
+	out << (simulateFrames > 0 || drawFrames > 0 ? " GPU" : ", no timestamps") << '\n' << std::defaultfloat;
+	simulateNs = drawNs = 0.0;
+	simulateFrames = drawFrames = 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef XZ_PARTICLES_H
+#define XZ_PARTICLES_H
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Particle system that lives on the GPU only. The particle buffer has two halves:
+// each frame one command buffer emits into the live half, integrates it in place,
+// compacts the survivors into the other half and writes the indirect draw
+// arguments from their count, which the CPU never reads back. The scene then
+// draws a quad per particle with vkCmdDrawIndirect. Simulation and draw are timed
+// with timestamps.
+class ParticleSystem
+{
+public:
+	static const uint32_t VERTICES_PER_PARTICLE = 6;		// a quad, two triangles
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight,
+		const VkAllocationCallbacks* allocator = nullptr);
+	// (re)creates the buffers, device idle; the first frame after fills them to the
+	// steady state, so timings hold from the start
+	void resize(uint32_t capacity);
+	void destroy();
+
+	uint32_t capacity() const { return particleCapacity; }
+	// set 0 of the graphics pipeline drawing them: binding 0 is the particle buffer
+	VkDescriptorSetLayout descriptorSetLayout() const { return setLayout; }
+
+	// render thread: the frame's simulation, submitted ahead of every window that draws
+	VkCommandBuffer record(uint32_t frame);
+	// inside a render pass, with a pipeline drawing them bound, after record(); pushes the
+	// first particle's index as a uint after util_DrawCommand; timed for one window only
+	void recordDraw(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frame, bool timed);
+	// the frame's fence has signalled, accumulate its GPU times
+	void collect(uint32_t frame);
+	// capacity and average simulation and draw times, then starts a new interval
+	void report(std::ostream& out);
+
+private:
+	// queries per frame in flight: simulation begin and end, draw begin and end
+	static const uint32_t QUERIES_PER_FRAME = 4;
+
+	VkPipeline createPipeline(const char* path);
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory);
+	void destroyBuffers();
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	float timestampPeriod = 0.0f;
+	uint64_t timestampMask = 0;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline emitPipeline = VK_NULL_HANDLE;
+	VkPipeline simulatePipeline = VK_NULL_HANDLE;
+	VkPipeline compactPipeline = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> commandBuffers;		// per frame in flight
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	std::vector<uint8_t> submitted;						// per frame in flight: its queries were reset
+
+	// both halves of particles, and the state: live count per half, then the draw arguments
+	uint32_t particleCapacity = 0;
+	VkBuffer particleBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory particleMemory = VK_NULL_HANDLE;
+	VkBuffer stateBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stateMemory = VK_NULL_HANDLE;
+
+	uint32_t live = 0;					// half the next frame emits into
+	bool prefill = true;
+	double emitBacklog = 0.0;			// fractional particles owed by earlier frames
+	uint32_t seed = 0;
+	std::chrono::steady_clock::time_point lastRecord{};
+
+	double simulateNs = 0.0;
+	double drawNs = 0.0;
+	uint32_t simulateFrames = 0;
+	uint32_t drawFrames = 0;
+};
+
+#endif // !XZ_PARTICLES_H
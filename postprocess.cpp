@@ -0,0 +1,538 @@
+#include "postprocess.h"
+
+#include "const.h"
+#include "shaders.h"
+#include "specialization.h"
+#include "util.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+namespace
+{
+	// layout must match the push constants of shader/post_*.comp
+	struct PostConstants
+	{
+		int32_t direction[2];		// blur axis
+		float threshold;			// bloom prefilter, first downsample only
+		float intensity;			// bloom added by the tonemap
+		float exposure;
+		float sharpness;
+	};
+
+	const uint32_t GROUP_SIZE = 8;			// 8x8 for the per-pixel passes
+	const uint32_t BLUR_GROUP_SIZE = 128;	// one row segment per workgroup
+
+	// specialization constants of post_down.comp, post_blur.comp and post_sharpen.comp,
+	// field i is constant_id i
+	struct DownVariant
+	{
+		VkBool32 prefilter;
+	};
+	struct BlurVariant
+	{
+		uint32_t groupSize;			// local_size_x
+		uint32_t radius;
+	};
+	struct SharpenVariant
+	{
+		VkBool32 encodeSrgb;		// storage writes and blits to UNORM images do not encode
+	};
+	constexpr DownVariant DOWN_PREFILTER{ VK_TRUE };	// first level
+	constexpr DownVariant DOWN_PLAIN{ VK_FALSE };		// the rest
+	constexpr BlurVariant BLUR{ BLUR_GROUP_SIZE, POST_BLUR_RADIUS };
+
+	VkImageMemoryBarrier imageBarrier(VkImage image, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+		VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t levels = 1)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1 };
+		return barrier;
+	}
+}
+
+
+///// PostProcess
+void PostProcess::init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, bool directOutput,
+	bool encodeSrgb, const VkAllocationCallbacks* allocator)
+{
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+	this->allocator = allocator;
+	direct = directOutput;
+
+	// 1. timestamps, when the queue has them
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+	if (validBits > 0)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	}
+
+	// 2. every pass reads binding 0 (and 2) and writes binding 1
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post-processing descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PostConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post-processing pipeline layout!");
+
+	// 3. one pipeline per pass and variant, all built up front
+	downPrefilterPipeline = createPipeline("post_down.comp.spv",
+		SpecializationInfo<DownVariant>(DOWN_PREFILTER).get());
+	downPipeline = createPipeline("post_down.comp.spv", SpecializationInfo<DownVariant>(DOWN_PLAIN).get());
+	blurPipeline = createPipeline("post_blur.comp.spv", SpecializationInfo<BlurVariant>(BLUR).get());
+	upPipeline = createPipeline("post_up.comp.spv");
+	tonemapPipeline = createPipeline("post_tonemap.comp.spv");
+	sharpenPipeline = createPipeline("post_sharpen.comp.spv",
+		SpecializationInfo<SharpenVariant>({ encodeSrgb ? VK_TRUE : VK_FALSE }).get());
+}
+
+VkPipeline PostProcess::createPipeline(const char* path, const VkSpecializationInfo* specialization)
+{
+	auto code = ShaderLibrary::get().load(path);
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code.size();
+	moduleInfo.pCode = code.data();
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &moduleInfo, allocator, &shaderModule) != VK_SUCCESS)
+		throw std::runtime_error(std::string("failed to create shader module ") + path);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = specialization;
+	pipelineInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &pipeline);
+	vkDestroyShaderModule(device, shaderModule, allocator);
+	if (result != VK_SUCCESS)
+		throw std::runtime_error(std::string("failed to create compute pipeline for ") + path);
+	return pipeline;
+}
+
+void PostProcess::resize(uint32_t targetId, VkExtent2D extent, const std::vector<VkImage>& images,
+	const std::vector<VkImageView>& imageViews)
+{
+	if (targets.size() <= targetId)
+		targets.resize(targetId + 1);
+	if (targets[targetId])
+		destroyTarget(*targets[targetId]);
+	targets[targetId] = std::make_unique<Target>();
+	auto& target = *targets[targetId];
+	target.extent = extent;
+	target.images = images;
+
+	// 1. images: the bloom chain starts at half size and stops before it gets too small to blur
+	VkExtent2D half = { std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u) };
+	uint32_t levels = 1;
+	while (levels < POST_BLOOM_LEVELS && (std::min(half.width, half.height) >> levels) >= POST_BLOOM_MIN_SIZE)
+		levels++;
+	target.levels = levels;
+
+	createImage(extent, 1, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT, target.scene);
+	createImage(half, levels, VK_IMAGE_USAGE_STORAGE_BIT, target.bloom);
+	createImage(half, levels, VK_IMAGE_USAGE_STORAGE_BIT, target.bloomTemp);
+	createImage(extent, 1, VK_IMAGE_USAGE_STORAGE_BIT, target.ldr);
+	if (!direct)
+		createImage(extent, 1, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, target.output);
+
+	// 2. descriptor sets never change until the next resize
+	uint32_t sharpenCount = direct ? static_cast<uint32_t>(imageViews.size()) : 1;
+	uint32_t setCount = levels + 2 * levels + (levels - 1) + 1 + sharpenCount;
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSize.descriptorCount = 3 * setCount;
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = setCount;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	if (vkCreateDescriptorPool(device, &poolInfo, allocator, &target.descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post-processing descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, setLayout);
+	std::vector<VkDescriptorSet> sets(setCount);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = target.descriptorPool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate post-processing descriptor sets!");
+
+	auto next = sets.begin();
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		target.downSets.push_back(*next++);
+		writeSet(target.downSets.back(), level == 0 ? target.scene.view : target.bloom.levelViews[level - 1],
+			target.bloom.levelViews[level], VK_NULL_HANDLE);
+	}
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		target.blurSets.push_back(*next++);
+		writeSet(target.blurSets.back(), target.bloom.levelViews[level], target.bloomTemp.levelViews[level], VK_NULL_HANDLE);
+		target.blurSets.push_back(*next++);
+		writeSet(target.blurSets.back(), target.bloomTemp.levelViews[level], target.bloom.levelViews[level], VK_NULL_HANDLE);
+	}
+	for (uint32_t level = 0; level + 1 < levels; level++)
+	{
+		target.upSets.push_back(*next++);
+		writeSet(target.upSets.back(), target.bloom.levelViews[level + 1], target.bloom.levelViews[level], VK_NULL_HANDLE);
+	}
+	target.tonemapSet = *next++;
+	writeSet(target.tonemapSet, target.scene.view, target.ldr.view, target.bloom.levelViews[0]);
+	for (uint32_t i = 0; i < sharpenCount; i++)
+	{
+		target.sharpenSets.push_back(*next++);
+		writeSet(target.sharpenSets.back(), target.ldr.view, direct ? imageViews[i] : target.output.view, VK_NULL_HANDLE);
+	}
+
+	// 3. timestamps around each pass
+	if (timestampMask != 0)
+	{
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = (PASS_COUNT + 1) * static_cast<uint32_t>(images.size());
+		if (vkCreateQueryPool(device, &queryPoolInfo, allocator, &target.queryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create post-processing query pool!");
+	}
+}
+
+void PostProcess::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+	for (auto& target : targets)
+	{
+		if (target)
+			destroyTarget(*target);
+	}
+	targets.clear();
+
+	for (auto pipeline : { downPrefilterPipeline, downPipeline, blurPipeline, upPipeline, tonemapPipeline, sharpenPipeline })
+		vkDestroyPipeline(device, pipeline, allocator);
+	downPrefilterPipeline = downPipeline = blurPipeline = upPipeline = tonemapPipeline = sharpenPipeline = VK_NULL_HANDLE;
+	vkDestroyPipelineLayout(device, pipelineLayout, allocator);
+	vkDestroyDescriptorSetLayout(device, setLayout, allocator);
+	pipelineLayout = VK_NULL_HANDLE;
+	setLayout = VK_NULL_HANDLE;
+}
+
+void PostProcess::destroyTarget(Target& target)
+{
+	vkDestroyQueryPool(device, target.queryPool, allocator);
+	vkDestroyDescriptorPool(device, target.descriptorPool, allocator);
+	for (auto* image : { &target.scene, &target.bloom, &target.bloomTemp, &target.ldr, &target.output })
+		destroyImage(*image);
+	target.queryPool = VK_NULL_HANDLE;
+	target.descriptorPool = VK_NULL_HANDLE;
+}
+
+void PostProcess::createImage(VkExtent2D extent, uint32_t levels, VkImageUsageFlags usage, Image& image)
+{
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = levels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = HDR_FORMAT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateImage(device, &imageInfo, allocator, &image.image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post-processing image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image.image, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkAllocateMemory(device, &allocInfo, allocator, &image.memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate post-processing memory!");
+	vkBindImageMemory(device, image.image, image.memory, 0);
+
+	// the first level, and with a mip chain one view per level as well
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = HDR_FORMAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	if (vkCreateImageView(device, &viewInfo, allocator, &image.view) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post-processing image view!");
+	if (levels == 1)
+		image.levelViews.push_back(image.view);
+	for (uint32_t level = 0; levels > 1 && level < levels; level++)
+	{
+		viewInfo.subresourceRange.baseMipLevel = level;
+		image.levelViews.push_back(VK_NULL_HANDLE);
+		if (vkCreateImageView(device, &viewInfo, allocator, &image.levelViews.back()) != VK_SUCCESS)
+			throw std::runtime_error("failed to create post-processing image view!");
+	}
+}
+
+void PostProcess::destroyImage(Image& image)
+{
+	for (auto view : image.levelViews)
+	{
+		if (view != image.view)
+			vkDestroyImageView(device, view, allocator);
+	}
+	vkDestroyImageView(device, image.view, allocator);
+	vkDestroyImage(device, image.image, allocator);
+	vkFreeMemory(device, image.memory, allocator);
+	image = Image{};
+}
+
+void PostProcess::writeSet(VkDescriptorSet set, VkImageView src, VkImageView dst, VkImageView aux)
+{
+	// bindings a pass does not use stay unwritten
+	VkImageView views[3] = { src, dst, aux };
+	VkDescriptorImageInfo imageInfos[3]{};
+	VkWriteDescriptorSet writes[3]{};
+	uint32_t count = 0;
+	for (uint32_t binding = 0; binding < 3; binding++)
+	{
+		if (views[binding] == VK_NULL_HANDLE) continue;
+		imageInfos[count].imageView = views[binding];
+		imageInfos[count].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		writes[count].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[count].dstSet = set;
+		writes[count].dstBinding = binding;
+		writes[count].descriptorCount = 1;
+		writes[count].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[count].pImageInfo = &imageInfos[count];
+		count++;
+	}
+	vkUpdateDescriptorSets(device, count, writes, 0, nullptr);
+}
+
+void PostProcess::dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet set,
+	uint32_t groupsX, uint32_t groupsY, int32_t dirX, int32_t dirY, float threshold)
+{
+	PostConstants constants{};
+	constants.direction[0] = dirX;
+	constants.direction[1] = dirY;
+	constants.threshold = threshold;
+	constants.intensity = POST_BLOOM_INTENSITY;
+	constants.exposure = POST_EXPOSURE;
+	constants.sharpness = POST_SHARPNESS;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+}
+
+void PostProcess::record(VkCommandBuffer commandBuffer, uint32_t targetId, uint32_t imageIndex, bool captured)
+{
+	auto& target = *targets[targetId];
+	VkImage swapImage = target.images[imageIndex];
+	uint32_t query = (PASS_COUNT + 1) * imageIndex;
+	auto timestamp = [&](uint32_t pass) {
+		if (target.queryPool != VK_NULL_HANDLE)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, target.queryPool, query + pass);
+	};
+	if (target.queryPool != VK_NULL_HANDLE)
+		vkCmdResetQueryPool(commandBuffer, target.queryPool, query, PASS_COUNT + 1);
+	timestamp(0);
+
+	// 1. intermediates are rewritten whole every frame; the previous frame's writes
+	// (and the blit reading output) still have to finish before the new ones
+	std::vector<VkImageMemoryBarrier> barriers = {
+		imageBarrier(target.bloom.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, target.levels),
+		imageBarrier(target.bloomTemp.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, target.levels),
+		imageBarrier(target.ldr.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL),
+	};
+	if (!direct)
+		barriers.push_back(imageBarrier(target.output.image, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL));
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	// 2. downsample: 2x2 box per level, the first one keeps only what is above the threshold
+	for (uint32_t level = 0; level < target.levels; level++)
+	{
+		uint32_t width = std::max(target.extent.width / 2 >> level, 1u);
+		uint32_t height = std::max(target.extent.height / 2 >> level, 1u);
+		dispatch(commandBuffer, level == 0 ? downPrefilterPipeline : downPipeline, target.downSets[level],
+			groups(width, GROUP_SIZE), groups(height, GROUP_SIZE), 0, 0, POST_BLOOM_THRESHOLD);
+		computeBarrier(commandBuffer);
+	}
+	timestamp(1);
+
+	// 3. separable blur, every level at once: horizontal into the temp chain, vertical back
+	for (uint32_t pass = 0; pass < 2; pass++)
+	{
+		for (uint32_t level = 0; level < target.levels; level++)
+		{
+			uint32_t width = std::max(target.extent.width / 2 >> level, 1u);
+			uint32_t height = std::max(target.extent.height / 2 >> level, 1u);
+			if (pass == 0)
+				dispatch(commandBuffer, blurPipeline, target.blurSets[2 * level], groups(width, BLUR_GROUP_SIZE),
+					height, 1, 0, 0.0f);
+			else
+				dispatch(commandBuffer, blurPipeline, target.blurSets[2 * level + 1], groups(height, BLUR_GROUP_SIZE),
+					width, 0, 1, 0.0f);
+		}
+		computeBarrier(commandBuffer);
+	}
+	timestamp(2);
+
+	// 4. upsample from the smallest level, each adds itself onto the next larger one
+	for (uint32_t level = target.levels - 1; level > 0; level--)
+	{
+		uint32_t width = std::max(target.extent.width / 2 >> (level - 1), 1u);
+		uint32_t height = std::max(target.extent.height / 2 >> (level - 1), 1u);
+		dispatch(commandBuffer, upPipeline, target.upSets[level - 1], groups(width, GROUP_SIZE),
+			groups(height, GROUP_SIZE), 0, 0, 0.0f);
+		computeBarrier(commandBuffer);
+	}
+	timestamp(3);
+
+	// 5. scene plus bloom, exposed and tonemapped
+	dispatch(commandBuffer, tonemapPipeline, target.tonemapSet, groups(target.extent.width, GROUP_SIZE),
+		groups(target.extent.height, GROUP_SIZE), 0, 0, 0.0f);
+	computeBarrier(commandBuffer);
+	timestamp(4);
+
+	// 6. sharpen into the swap chain image, or into the output image and blit that over;
+	// the acquire semaphore is waited on at outputStage(), the barriers chain from there
+	VkAccessFlags presentAccess = captured ? VK_ACCESS_TRANSFER_READ_BIT : 0;
+	VkPipelineStageFlags presentStage = captured ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	if (direct)
+	{
+		auto toStorage = imageBarrier(swapImage, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &toStorage);
+		dispatch(commandBuffer, sharpenPipeline, target.sharpenSets[imageIndex], groups(target.extent.width, GROUP_SIZE),
+			groups(target.extent.height, GROUP_SIZE), 0, 0, 0.0f);
+
+		auto toPresent = imageBarrier(swapImage, VK_ACCESS_SHADER_WRITE_BIT, presentAccess,
+			VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, presentStage,
+			0, 0, nullptr, 0, nullptr, 1, &toPresent);
+	}
+	else
+	{
+		dispatch(commandBuffer, sharpenPipeline, target.sharpenSets[0], groups(target.extent.width, GROUP_SIZE),
+			groups(target.extent.height, GROUP_SIZE), 0, 0, 0.0f);
+
+		VkImageMemoryBarrier toTransfer[2] = {
+			imageBarrier(target.output.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
+			imageBarrier(swapImage, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
+		};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, toTransfer);
+
+		// same size, the blit only converts the format (and encodes sRGB)
+		VkImageBlit blit{};
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		blit.srcOffsets[1] = { static_cast<int32_t>(target.extent.width), static_cast<int32_t>(target.extent.height), 1 };
+		blit.dstSubresource = blit.srcSubresource;
+		blit.dstOffsets[1] = blit.srcOffsets[1];
+		vkCmdBlitImage(commandBuffer, target.output.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			swapImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+
+		auto toPresent = imageBarrier(swapImage, VK_ACCESS_TRANSFER_WRITE_BIT, presentAccess,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, presentStage,
+			0, 0, nullptr, 0, nullptr, 1, &toPresent);
+	}
+	timestamp(5);
+}
+
+void PostProcess::collect(uint32_t targetId, uint32_t imageIndex)
+{
+	auto& target = *targets[targetId];
+	if (target.queryPool == VK_NULL_HANDLE) return;
+
+	uint64_t timestamps[PASS_COUNT + 1] = {};
+	if (vkGetQueryPoolResults(device, target.queryPool, (PASS_COUNT + 1) * imageIndex, PASS_COUNT + 1,
+		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+	for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+		target.passNs[pass] += ((timestamps[pass + 1] - timestamps[pass]) & timestampMask) * static_cast<double>(timestampPeriod);
+	target.frames++;
+}
+
+void PostProcess::report(std::ostream& out)
+{
+	static const char* passNames[PASS_COUNT] = { "down", "blur", "up", "tonemap", "sharpen" };
+	out << std::fixed << std::setprecision(3);
+	for (uint32_t id = 0; id < targets.size(); id++)
+	{
+		if (!targets[id] || targets[id]->frames == 0) continue;
+		auto& target = *targets[id];
+
+		double totalMs = 0.0;
+		out << "Post: window " << id << ", " << target.levels << " bloom levels";
+		for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+		{
+			double ms = target.passNs[pass] / target.frames / 1e6;
+			out << ", " << passNames[pass] << ' ' << ms;
+			totalMs += ms;
+			target.passNs[pass] = 0.0;
+		}
+		out << ", " << totalMs << " ms GPU" << (direct ? " (storage output)" : " (blit output)") << '\n';
+		target.frames = 0;
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#ifndef XZ_POSTPROCESS_H
+#define XZ_POSTPROCESS_H
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Compute post-processing chain on storage images, one set of images per window:
+// the scene renders into an HDR image, then bloom downsample, a separable blur
+// through workgroup shared memory, bloom upsample, tonemap and sharpen, whose
+// output is written to the swap chain image directly when it has STORAGE usage
+// and blitted to it otherwise. Every pass is timed with timestamps.
+class PostProcess
+{
+public:
+	static constexpr VkFormat HDR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+	static constexpr uint32_t PASS_COUNT = 5;		// down, blur, up, tonemap, sharpen
+
+	// directOutput: sharpen writes the swap chain image, else it is blitted;
+	// encodeSrgb: sharpen encodes sRGB itself, the swap chain format does not
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, bool directOutput,
+		bool encodeSrgb, const VkAllocationCallbacks* allocator = nullptr);
+	// (re)creates the window's images and descriptors, after its swap chain image views
+	void resize(uint32_t targetId, VkExtent2D extent, const std::vector<VkImage>& images,
+		const std::vector<VkImageView>& imageViews);
+	void destroy();
+
+	// what the scene renders into instead of the swap chain image
+	VkImage sceneImage(uint32_t targetId) const { return targets[targetId]->scene.image; }
+	VkImageView sceneView(uint32_t targetId) const { return targets[targetId]->scene.view; }
+	// where the swap chain image is first touched: the acquire semaphore waits there
+	VkPipelineStageFlags outputStage() const
+	{
+		return direct ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	VkImageUsageFlags outputUsage() const
+	{
+		return direct ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+
+	// after the scene, with the scene image in GENERAL; leaves the swap chain image
+	// in PRESENT_SRC, visible to the capture copy when captured
+	void record(VkCommandBuffer commandBuffer, uint32_t targetId, uint32_t imageIndex, bool captured);
+	// the image's submission has finished, accumulate its pass times
+	void collect(uint32_t targetId, uint32_t imageIndex);
+	// one line per window with per-pass GPU times, then starts a new interval
+	void report(std::ostream& out);
+
+private:
+	struct Image
+	{
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		std::vector<VkImageView> levelViews;		// one per mip level, or just view without a chain
+	};
+
+	struct Target
+	{
+		VkExtent2D extent{};
+		uint32_t levels = 0;
+		std::vector<VkImage> images;				// swap chain
+
+		Image scene;			// HDR, full size
+		Image bloom;			// half size mip chain, blurred in place
+		Image bloomTemp;		// horizontal blur output, same chain
+		Image ldr;				// tonemapped
+		Image output;			// sharpened, blit path only
+
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		std::vector<VkDescriptorSet> downSets;		// per level
+		std::vector<VkDescriptorSet> blurSets;		// horizontal then vertical, per level
+		std::vector<VkDescriptorSet> upSets;		// level + 1 into level
+		VkDescriptorSet tonemapSet = VK_NULL_HANDLE;
+		std::vector<VkDescriptorSet> sharpenSets;	// per swap chain image, or one for the blit
+
+		VkQueryPool queryPool = VK_NULL_HANDLE;		// PASS_COUNT + 1 timestamps per swap chain image
+		double passNs[PASS_COUNT] = {};
+		uint32_t frames = 0;
+	};
+
+	void createImage(VkExtent2D extent, uint32_t levels, VkImageUsageFlags usage, Image& image);
+	void destroyImage(Image& image);
+	void destroyTarget(Target& target);
+	VkPipeline createPipeline(const char* path, const VkSpecializationInfo* specialization = nullptr);
+	void writeSet(VkDescriptorSet set, VkImageView src, VkImageView dst, VkImageView aux);
+	void dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet set,
+		uint32_t groupsX, uint32_t groupsY, int32_t dirX, int32_t dirY, float threshold);
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+	bool direct = false;
+	float timestampPeriod = 0.0f;
+	uint64_t timestampMask = 0;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline downPrefilterPipeline = VK_NULL_HANDLE;
+	VkPipeline downPipeline = VK_NULL_HANDLE;
+	VkPipeline blurPipeline = VK_NULL_HANDLE;
+	VkPipeline upPipeline = VK_NULL_HANDLE;
+	VkPipeline tonemapPipeline = VK_NULL_HANDLE;
+	VkPipeline sharpenPipeline = VK_NULL_HANDLE;
+
+	std::vector<std::unique_ptr<Target>> targets;	// by window id
+};
+
+#endif // !XZ_POSTPROCESS_H
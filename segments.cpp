@@ -0,0 +1,123 @@
+#include "segments.h"
+
+#include <chrono>
+#include <stdexcept>
+
+void SegmentCache::init(VkDevice device, VkCommandPool commandPool, const std::vector<std::string>& segmentNames,
+	uint32_t framesInFlight)
+{
+	this->device = device;
+	this->commandPool = commandPool;
+	this->framesInFlight = framesInFlight;
+	segments.resize(segmentNames.size());
+	for (size_t i = 0; i < segmentNames.size(); i++)
+		segments[i].name = segmentNames[i];
+}
+
+void SegmentCache::invalidate(uint32_t targetId)
+{
+	if (targetId >= entries.size()) return;
+	for (auto& entry : entries[targetId])
+		entry.valid = false;
+}
+
+void SegmentCache::destroy()
+{
+	if (device == VK_NULL_HANDLE) return;
+	for (auto& target : entries)
+	{
+		for (auto& entry : target)
+		{
+			if (entry.commandBuffer != VK_NULL_HANDLE)
+				vkFreeCommandBuffers(device, commandPool, 1, &entry.commandBuffer);
+		}
+	}
+	entries.clear();
+}
+
+VkCommandBuffer SegmentCache::get(uint32_t targetId, uint32_t segment, uint64_t version, uint64_t frame,
+	const VkCommandBufferInheritanceInfo& inheritance, const Recorder& record)
+{
+	if (targetId >= entries.size())
+		entries.resize(targetId + 1);
+	auto& target = entries[targetId];
+	target.resize(segments.size() * framesInFlight);
+	auto& stats = segments[segment];
+
+	// 1. still up to date: replay it, also while earlier frames are still executing it
+	Entry* free = nullptr;
+	for (uint32_t i = 0; i < framesInFlight; i++)
+	{
+		auto& entry = target[segment * framesInFlight + i];
+		if (entry.valid && entry.version == version)
+		{
+			entry.lastFrame = frame;
+			stats.reuses++;
+			if (stats.reuseCounter) stats.reuseCounter->add();
+			return entry.commandBuffer;
+		}
+		if (!free && (!entry.valid || entry.lastFrame + framesInFlight <= frame))
+			free = &entry;
+	}
+	// one buffer per frame in flight, so the oldest one has always finished
+	if (!free)
+		throw std::runtime_error("no idle command buffer for segment " + stats.name);
+
+	// 2. re-record into a buffer no pending submission uses
+	auto begin = std::chrono::steady_clock::now();
+	if (free->commandBuffer == VK_NULL_HANDLE)
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &free->commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate segment command buffer!");
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+	if (vkBeginCommandBuffer(free->commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording segment " + stats.name);
+	record(free->commandBuffer);
+	if (vkEndCommandBuffer(free->commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record segment " + stats.name);
+
+	free->version = version;
+	free->lastFrame = frame;
+	free->valid = true;
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+	stats.records++;
+	stats.recordNs += elapsed.count();
+	stats.totalRecords++;
+	stats.totalRecordNs += elapsed.count();
+	if (stats.recordCounter) stats.recordCounter->add();
+	return free->commandBuffer;
+}
+
+void SegmentCache::countInto(uint32_t segment, MetricCounter* records, MetricCounter* reuses)
+{
+	segments[segment].recordCounter = records;
+	segments[segment].reuseCounter = reuses;
+}
+
+void SegmentCache::report(std::ostream& out, uint32_t frames)
+{
+	if (segments.empty() || frames == 0) return;
+	double savedNs = 0.0;
+	out << "Segments:";
+	for (auto& segment : segments)
+	{
+		out << ' ' << segment.name << ' ' << segment.records << " recorded ("
+			<< segment.recordNs / frames / 1000.0 << " us/frame) " << segment.reuses << " reused,";
+		if (segment.totalRecords > 0)
+			savedNs += segment.reuses * segment.totalRecordNs / segment.totalRecords;
+		segment.records = 0;
+		segment.reuses = 0;
+		segment.recordNs = 0.0;
+	}
+	out << " ~" << savedNs / frames / 1000.0 << " us/frame of recording saved\n";
+}
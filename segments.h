@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef XZ_SEGMENTS_H
+#define XZ_SEGMENTS_H
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "metrics.h"
+
+// Stable parts of a frame, each recorded into a secondary command buffer per
+// window and replayed by every primary until its inputs change. What a segment
+// depends on is summed up by a version: a matching version reuses the cached
+// buffer, any other is recorded into a buffer no frame in flight still uses.
+class SegmentCache
+{
+public:
+	using Recorder = std::function<void(VkCommandBuffer)>;
+
+	// framesInFlight: a buffer last used by frame f is free again from frame f + framesInFlight
+	void init(VkDevice device, VkCommandPool commandPool, const std::vector<std::string>& segmentNames,
+		uint32_t framesInFlight);
+	// the window's attachments or size changed, nothing cached for it is valid; device idle
+	void invalidate(uint32_t targetId);
+	void destroy();
+
+	// render thread, between begin and end of the render pass of the primary it goes into
+	VkCommandBuffer get(uint32_t targetId, uint32_t segment, uint64_t version, uint64_t frame,
+		const VkCommandBufferInheritanceInfo& inheritance, const Recorder& record);
+
+	// also count re-records and reuses into these, null to stop
+	void countInto(uint32_t segment, MetricCounter* records, MetricCounter* reuses);
+	// per segment re-records and reuses over the interval, and the recording time saved
+	// per frame at the segment's average cost, then starts a new interval
+	void report(std::ostream& out, uint32_t frames);
+
+private:
+	struct Entry
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint64_t version = 0;
+		uint64_t lastFrame = 0;
+		bool valid = false;
+	};
+
+	struct Segment
+	{
+		std::string name;
+		uint64_t records = 0;			// this interval
+		uint64_t reuses = 0;
+		double recordNs = 0.0;
+		uint64_t totalRecords = 0;		// for the average cost
+		double totalRecordNs = 0.0;
+		MetricCounter* recordCounter = nullptr;
+		MetricCounter* reuseCounter = nullptr;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	uint32_t framesInFlight = 0;
+	std::vector<Segment> segments;
+	std::vector<std::vector<Entry>> entries;		// by window, framesInFlight per segment
+};
+
+#endif // !XZ_SEGMENTS_H
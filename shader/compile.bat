@@ -1,2 +1,31 @@
-glslc.exe tri.vert -o tri.vert.spv
-glslc.exe tri.frag -o tri.frag.spv 
\ No newline at end of file
+@echo off
+rem Windows counterpart of compile.sh: compiles every shader to SPIR-V next to its
+rem source and embeds the results into embedded.h with embed.ps1, in the same layout.
+rem
+rem   shader\compile.bat [release|debug]
+rem
+rem release (the default) optimizes with spirv-opt -O and strips debug info; debug
+rem keeps it, unoptimized. Needs glslc and spirv-opt from the Vulkan SDK on the PATH.
+setlocal
+cd /d "%~dp0"
+
+set mode=%1
+if "%mode%"=="" set mode=release
+if not "%mode%"=="release" if not "%mode%"=="debug" (
+	echo usage: %~nx0 [release^|debug] 1>&2
+	exit /b 1
+)
+
+set SOURCES=tri.vert tri.frag post_down.comp post_blur.comp post_up.comp post_tonemap.comp post_sharpen.comp particle_emit.comp particle_simulate.comp particle_compact.comp particle.vert light_bin.comp lit.frag
+
+for %%s in (%SOURCES%) do (
+	if "%mode%"=="debug" (
+		glslc.exe -g -O0 %%s -o %%s.spv || exit /b 1
+	) else (
+		glslc.exe %%s -o %%s.spv.tmp || exit /b 1
+		spirv-opt.exe -O --strip-debug %%s.spv.tmp -o %%s.spv || exit /b 1
+		del %%s.spv.tmp
+	)
+)
+
+powershell -NoProfile -ExecutionPolicy Bypass -File embed.ps1 %mode% %SOURCES% || exit /b 1
@@ -0,0 +1,93 @@
+#!/bin/sh
+# Compiles every shader to SPIR-V next to its source and embeds the results into
+# embedded.h as constexpr arrays, which shaders.cpp includes: the binary loads no
+# shader files, wherever it is started from. The .spv files and embedded.h are
+# committed with their sources, so a build needs no shader tools; rerun this after
+# editing a shader and commit all three.
+#
+#   shader/compile.sh [release|debug|check]
+#
+# release (the default) optimizes with spirv-opt -O and strips debug info; debug
+# keeps it, unoptimized, for capture tools and readable validation messages (do
+# not commit that). check compiles a release build into a temporary directory and
+# fails when the committed .spv files or embedded.h differ from it.
+# Needs glslc and spirv-opt (Vulkan SDK, or the shaderc and spirv-tools packages).
+# compile.bat does the same on Windows and writes the same embedded.h.
+set -e
+cd "$(dirname "$0")"
+
+mode="${1:-release}"
+case "$mode" in
+	release|debug|check) ;;
+	*) echo "usage: $0 [release|debug|check]" >&2; exit 1 ;;
+esac
+
+SOURCES="tri.vert tri.frag
+	post_down.comp post_blur.comp post_up.comp post_tonemap.comp post_sharpen.comp
+	particle_emit.comp particle_simulate.comp particle_compact.comp particle.vert
+	light_bin.comp lit.frag"
+
+# compile <source> <output> <mode>
+compile() {
+	if [ "$3" = debug ]; then
+		glslc -g -O0 "$1" -o "$2"
+	else
+		glslc "$1" -o "$2.tmp"
+		spirv-opt -O --strip-debug "$2.tmp" -o "$2"
+		rm -f "$2.tmp"
+	fi
+}
+
+# embed <directory with the .spv files> <output header> <mode>
+embed() {
+	table=""
+	{
+		echo "// generated by shader/compile.sh or compile.bat ($3), do not edit; included by shaders.cpp"
+		echo
+	} > "$2"
+	for source in $SOURCES; do
+		# words in host order, as the loader reads them
+		symbol="SHADER_$(echo "$source" | tr 'a-z.' 'A-Z_')"
+		{
+			echo "alignas(16) constexpr uint32_t $symbol[] = {"
+			od -An -v -tx4 "$1/$source.spv" | sed -e '/^ *$/d' -e 's/^ */\t/' -e 's/ *$//' \
+				-e 's/\([0-9a-f]\{8\}\)/0x\1,/g'
+			echo "};"
+			echo
+		} >> "$2"
+		table="$table	{ \"$source.spv\", $symbol, sizeof($symbol) },
+"
+	done
+	{
+		echo "constexpr EmbeddedShader EMBEDDED_SHADERS[] = {"
+		printf '%s' "$table"
+		echo "};"
+	} >> "$2"
+}
+
+if [ "$mode" = check ]; then
+	dir="$(mktemp -d)"
+	trap 'rm -rf "$dir"' EXIT
+	for source in $SOURCES; do
+		compile "$source" "$dir/$source.spv" release
+	done
+	embed "$dir" "$dir/embedded.h" release
+
+	stale=""
+	for file in $(for source in $SOURCES; do echo "$source.spv"; done) embedded.h; do
+		cmp -s "$file" "$dir/$file" || stale="$stale $file"
+	done
+	if [ -n "$stale" ]; then
+		echo "out of date:$stale; run shader/compile.sh and commit the results" >&2
+		exit 1
+	fi
+	echo "embedded.h and the .spv files match their sources"
+	exit 0
+fi
+
+for source in $SOURCES; do
+	compile "$source" "$source.spv" "$mode"
+done
+embed . embedded.h.tmp "$mode"
+mv embedded.h.tmp embedded.h
+echo "embedded $(echo $SOURCES | wc -w) shaders ($mode) into shader/embedded.h"
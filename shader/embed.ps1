@@ -0,0 +1,38 @@
+# Writes embedded.h from the compiled .spv files for compile.bat, byte for byte
+# what compile.sh writes: four words per line in host order, then the table.
+#
+#   embed.ps1 <release|debug> <source>...
+param(
+	[string]$Mode,
+	[Parameter(ValueFromRemainingArguments = $true)][string[]]$Sources
+)
+$ErrorActionPreference = 'Stop'
+Set-Location $PSScriptRoot
+
+$out = New-Object System.Text.StringBuilder
+$table = New-Object System.Text.StringBuilder
+[void]$out.Append("// generated by shader/compile.sh or compile.bat ($Mode), do not edit; included by shaders.cpp`n`n")
+
+foreach ($source in $Sources) {
+	$bytes = [IO.File]::ReadAllBytes("$PSScriptRoot\$source.spv")
+	$symbol = 'SHADER_' + $source.ToUpperInvariant().Replace('.', '_')
+	[void]$out.Append("alignas(16) constexpr uint32_t $symbol[] = {`n")
+	for ($line = 0; $line -lt $bytes.Length; $line += 16) {
+		$words = @()
+		for ($i = $line; $i -lt [Math]::Min($line + 16, $bytes.Length); $i += 4) {
+			$words += '0x{0:x8},' -f [BitConverter]::ToUInt32($bytes, $i)
+		}
+		[void]$out.Append("`t" + ($words -join ' ') + "`n")
+	}
+	[void]$out.Append("};`n`n")
+	[void]$table.Append("`t{ `"$source.spv`", $symbol, sizeof($symbol) },`n")
+}
+
+[void]$out.Append("constexpr EmbeddedShader EMBEDDED_SHADERS[] = {`n")
+[void]$out.Append($table.ToString())
+[void]$out.Append("};`n")
+
+# no BOM and LF line ends, as compile.sh writes it
+[IO.File]::WriteAllText("$PSScriptRoot\embedded.h.tmp", $out.ToString(), (New-Object System.Text.UTF8Encoding $false))
+Move-Item -Force "$PSScriptRoot\embedded.h.tmp" "$PSScriptRoot\embedded.h"
+Write-Output "embedded $($Sources.Count) shaders ($Mode) into shader/embedded.h"
@@ -0,0 +1,73 @@
+#version 450
+
+// tri.frag lit by the dynamic lights; variants are prebuilt per SCENE_VARIANTS in
+// util.h for both lighting paths, the driver folds these in
+layout(constant_id = 0) const uint QUANTIZE_LEVELS = 0;
+layout(constant_id = 1) const float INTENSITY = 1.0;
+layout(constant_id = 2) const bool CLUSTERED = true;
+// the grid, ClusterGrid in lighting.h
+layout(constant_id = 3) const uint CLUSTERS_X = 16;
+layout(constant_id = 4) const uint CLUSTERS_Y = 9;
+layout(constant_id = 5) const uint CLUSTERS_Z = 24;
+layout(constant_id = 6) const uint CLUSTER_CAPACITY = 256;
+
+// layout matches GpuLight in lighting.cpp
+struct Light {
+    vec4 positionRadius;
+    vec4 color;             // w: 1 / (cos inner - cos outer)
+    vec4 direction;         // w: cos outer, below -1 for point lights
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Lights {
+    uint lightCount;
+    float ambient;
+    Light lights[];
+};
+layout(std430, set = 0, binding = 1) readonly buffer ClusterCounts {
+    uint clusterCounts[];
+};
+layout(std430, set = 0, binding = 2) readonly buffer ClusterLights {
+    uint clusterLights[];
+};
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragPosition;
+
+layout(location = 0) out vec4 outColor;
+
+// the surfaces face the viewer, down -z
+vec3 shade(Light light) {
+    vec3 toLight = light.positionRadius.xyz - fragPosition;
+    float distanceSq = dot(toLight, toLight);
+    float radiusSq = light.positionRadius.w * light.positionRadius.w;
+    if (distanceSq >= radiusSq)
+        return vec3(0.0);
+    float falloff = 1.0 - distanceSq / radiusSq;
+    vec3 l = toLight * inversesqrt(max(distanceSq, 1e-8));
+    float lambert = max(-l.z, 0.0);
+    float spot = clamp((dot(-l, light.direction.xyz) - light.direction.w) * light.color.w, 0.0, 1.0);
+    return light.color.rgb * (falloff * falloff * lambert * spot);
+}
+
+void main() {
+    vec3 lit = vec3(0.0);
+    if (CLUSTERED) {
+        uvec3 grid = uvec3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+        vec3 cell = (fragPosition + vec3(1.0, 1.0, 0.0)) * vec3(0.5, 0.5, 1.0) * vec3(grid);
+        uvec3 id = min(uvec3(max(cell, vec3(0.0))), grid - 1);
+        uint cluster = (id.z * CLUSTERS_Y + id.y) * CLUSTERS_X + id.x;
+        uint count = clusterCounts[cluster];
+        for (uint i = 0; i < count; i++)
+            lit += shade(lights[clusterLights[cluster * CLUSTER_CAPACITY + i]]);
+    } else {
+        for (uint i = 0; i < lightCount; i++)
+            lit += shade(lights[i]);
+    }
+
+    vec3 color = fragColor * (ambient + lit);
+    if (QUANTIZE_LEVELS > 0) {
+        float levels = float(QUANTIZE_LEVELS);
+        color = floor(color * levels + 0.5) / levels;
+    }
+    outColor = vec4(color * INTENSITY, 1.0);
+}
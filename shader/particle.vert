@@ -0,0 +1,37 @@
+#version 450
+
+// a quad per particle: the instance is the particle, first selects the half
+struct Particle {
+    vec2 position;
+    vec2 velocity;
+    float life;
+    float maxLife;
+};
+
+layout(std430, binding = 0) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// per-draw constants, layout matches util_DrawCommand; scale is the half size,
+// first the live half's first particle
+layout(push_constant) uniform DrawConstants {
+    vec2 offset;
+    float depth;
+    float scale;
+    uint first;
+} draw;
+
+// two clockwise triangles
+const vec2 CORNERS[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+    Particle p = particles[draw.first + gl_InstanceIndex];
+    gl_Position = vec4(p.position + draw.offset + CORNERS[gl_VertexIndex] * draw.scale, draw.depth, 1.0);
+    // hot when emitted, cooling towards the end of its life
+    float age = clamp(p.life / p.maxLife, 0.0, 1.0);
+    fragColor = mix(vec3(1.0, 0.8, 0.3), vec3(0.5, 0.08, 0.02), age);
+}
@@ -1,9 +1,18 @@
 #version 450
 
+// variants are prebuilt per SCENE_VARIANTS in util.h, the driver folds these in
+layout(constant_id = 0) const uint QUANTIZE_LEVELS = 0;
+layout(constant_id = 1) const float INTENSITY = 1.0;
+
 layout(location = 0) in vec3 fragColor;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    vec3 color = fragColor;
+    if (QUANTIZE_LEVELS > 0) {
+        float levels = float(QUANTIZE_LEVELS);
+        color = floor(color * levels + 0.5) / levels;
+    }
+    outColor = vec4(color * INTENSITY, 1.0);
+}
@@ -1,21 +1,25 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec2 inPosition;
 
-vec2 position[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) out vec3 fragColor;
+// clip space, where lit.frag finds its cluster and the lights are placed
+layout(location = 1) out vec3 fragPosition;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// per-draw constants, layout matches util_DrawCommand
+layout(push_constant) uniform DrawConstants {
+    vec2 offset;
+    float depth;
+    float scale;
+} draw;
 
 
 void main() {
-    gl_Position = vec4(position[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    gl_Position = vec4(inPosition * draw.scale + draw.offset, draw.depth, 1.0);
+    fragPosition = gl_Position.xyz;
+    // red, green and blue at the corners of the triangle (0, -0.5), (0.5, 0.5), (-0.5, 0.5)
+    // the mesh is rounded from: linear in the position, so every LOD shades the same
+    fragColor = vec3(0.5 - inPosition.y,
+                     0.25 + inPosition.x + 0.5 * inPosition.y,
+                     0.25 - inPosition.x + 0.5 * inPosition.y);
 }
\ No newline at end of file
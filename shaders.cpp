@@ -0,0 +1,62 @@
+#include "shaders.h"
+
+#include "util.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// generated by shader/compile.sh and committed: constexpr SPIR-V arrays and the
+// EMBEDDED_SHADERS table; shader/compile.sh check tells whether it is up to date
+#include "shader/embedded.h"
+
+namespace
+{
+	const size_t EMBEDDED_COUNT = sizeof(EMBEDDED_SHADERS) / sizeof(EMBEDDED_SHADERS[0]);
+
+	ShaderCode loadFile(const std::string& path)
+	{
+		auto bytes = readFile(path);
+		if (bytes.empty() || bytes.size() % sizeof(uint32_t) != 0)
+			throw std::runtime_error("failed to load shader " + path + ", not SPIR-V!");
+		ShaderCode code;
+		code.loaded.resize(bytes.size() / sizeof(uint32_t));
+		std::memcpy(code.loaded.data(), bytes.data(), bytes.size());
+		return code;
+	}
+}
+
+
+///// ShaderLibrary
+ShaderLibrary& ShaderLibrary::get()
+{
+	static ShaderLibrary library;
+	return library;
+}
+
+size_t ShaderLibrary::embeddedCount()
+{
+	return EMBEDDED_COUNT;
+}
+
+ShaderCode ShaderLibrary::load(const std::string& name) const
+{
+	// 1. the override directory, when it has the file
+	if (!overrideDir.empty())
+	{
+		std::string path = overrideDir + '/' + name;
+		if (std::ifstream(path, std::ios::binary).good())
+			return loadFile(path);
+	}
+
+	// 2. compiled into the binary
+	for (size_t i = 0; i < EMBEDDED_COUNT; i++)
+	{
+		if (std::strcmp(EMBEDDED_SHADERS[i].name, name.c_str()) != 0) continue;
+		ShaderCode code;
+		code.embedded = EMBEDDED_SHADERS[i].words;
+		code.embeddedSize = EMBEDDED_SHADERS[i].size;
+		return code;
+	}
+	throw std::runtime_error("failed to find shader " + name + ", not embedded!");
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef XZ_SHADERS_H
+#define XZ_SHADERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One entry of the table shader/compile.sh generates into the committed shader/embedded.h.
+struct EmbeddedShader
+{
+	const char* name;				// file name it was compiled to, e.g. "tri.vert.spv"
+	const uint32_t* words;
+	size_t size;					// bytes
+};
+
+// SPIR-V of one shader: points into the binary when embedded, owns the words when
+// read from a file.
+struct ShaderCode
+{
+	const uint32_t* embedded = nullptr;
+	size_t embeddedSize = 0;
+	std::vector<uint32_t> loaded;
+
+	const uint32_t* data() const { return embedded ? embedded : loaded.data(); }
+	size_t size() const { return embedded ? embeddedSize : loaded.size() * sizeof(uint32_t); }
+};
+
+// Shaders by file name, compiled into the binary: shader/compile.sh optimizes and
+// embeds them, and every build includes the header it writes, so no shader files
+// are read. A file of the same name in the override directory (--shader-dir)
+// still wins, for editing shaders without a rebuild.
+class ShaderLibrary
+{
+public:
+	static ShaderLibrary& get();
+
+	// before the first load, empty for none
+	void setOverrideDir(const std::string& dir) { overrideDir = dir; }
+	const std::string& overrideDirectory() const { return overrideDir; }
+	// any thread
+	ShaderCode load(const std::string& name) const;
+
+	// shaders compiled into the binary
+	static size_t embeddedCount();
+
+private:
+	std::string overrideDir;
+};
+
+#endif // !XZ_SHADERS_H
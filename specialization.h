@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef XZ_SPECIALIZATION_H
+#define XZ_SPECIALIZATION_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include <vulkan/vulkan.h>
+
+// Specialization constants taken from a plain struct of 32-bit fields, field i
+// being constant_id i of the shader. Variants are described as constexpr
+// values of such structs, so every permutation is known when compiling and
+// the driver folds the constants in when the pipeline is built at startup.
+template <typename T>
+class SpecializationInfo
+{
+public:
+	static_assert(std::is_trivially_copyable<T>::value, "specialization data is copied byte for byte");
+	static_assert(sizeof(T) % 4 == 0, "every specialization constant is 32-bit");
+	static const uint32_t COUNT = sizeof(T) / 4;
+
+	explicit SpecializationInfo(const T& values)
+		: data(values)
+	{
+		for (uint32_t i = 0; i < COUNT; i++)
+			entries[i] = { i, 4 * i, 4 };
+		info.mapEntryCount = COUNT;
+		info.pMapEntries = entries;
+		info.dataSize = sizeof(T);
+		info.pData = &data;
+	}
+	// info points into the object, a copy points into itself
+	SpecializationInfo(const SpecializationInfo& other) : SpecializationInfo(other.data) {}
+	SpecializationInfo& operator=(const SpecializationInfo&) = delete;
+
+	const VkSpecializationInfo* get() const { return &info; }
+
+private:
+	T data;
+	VkSpecializationMapEntry entries[COUNT];
+	VkSpecializationInfo info{};
+};
+
+#endif // !XZ_SPECIALIZATION_H
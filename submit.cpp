@@ -0,0 +1,143 @@
+#include "submit.h"
+
+#include <chrono>
+
+void SubmitQueue::init(VkQueue queue, PFN_vkQueueSubmit2KHR submit2)
+{
+	this->queue = queue;
+	this->submit2 = submit2;
+}
+
+void SubmitQueue::enqueue(VkCommandBuffer commandBuffer, std::initializer_list<SubmitSemaphore> waitList,
+	std::initializer_list<SubmitSemaphore> signalList)
+{
+	// 1. a new batch when joining the last one would make more work wait or signal later
+	bool join = !batches.empty() && batches.back().signalCount == 0
+		&& (waitList.size() == 0 || batches.back().commandBufferCount == 0);
+	if (!join)
+	{
+		Batch batch;
+		batch.firstWait = static_cast<uint32_t>(waits.size());
+		batch.firstCommandBuffer = static_cast<uint32_t>(commandBuffers.size());
+		batch.firstSignal = static_cast<uint32_t>(signals.size());
+		batches.push_back(batch);
+	}
+
+	// 2. only the last batch grows, so each one's infos stay contiguous
+	auto& batch = batches.back();
+	for (const auto& wait : waitList)
+	{
+		VkSemaphoreSubmitInfoKHR info{};
+		info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		info.semaphore = wait.semaphore;
+		info.stageMask = wait.stage;
+		waits.push_back(info);
+		batch.waitCount++;
+	}
+	if (commandBuffer != VK_NULL_HANDLE)
+	{
+		VkCommandBufferSubmitInfoKHR info{};
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+		info.commandBuffer = commandBuffer;
+		commandBuffers.push_back(info);
+		batch.commandBufferCount++;
+	}
+	for (const auto& signal : signalList)
+	{
+		VkSemaphoreSubmitInfoKHR info{};
+		info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		info.semaphore = signal.semaphore;
+		info.stageMask = signal.stage;
+		signals.push_back(info);
+		batch.signalCount++;
+	}
+}
+
+VkResult SubmitQueue::flush(VkFence fence)
+{
+	auto begin = std::chrono::steady_clock::now();
+	VkResult result = VK_SUCCESS;
+	if (!batches.empty() || fence != VK_NULL_HANDLE)
+	{
+		if (submit2)
+		{
+			submitInfos.resize(batches.size());
+			for (size_t i = 0; i < batches.size(); i++)
+			{
+				const auto& batch = batches[i];
+				auto& info = submitInfos[i];
+				info = {};
+				info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+				info.waitSemaphoreInfoCount = batch.waitCount;
+				info.pWaitSemaphoreInfos = waits.data() + batch.firstWait;
+				info.commandBufferInfoCount = batch.commandBufferCount;
+				info.pCommandBufferInfos = commandBuffers.data() + batch.firstCommandBuffer;
+				info.signalSemaphoreInfoCount = batch.signalCount;
+				info.pSignalSemaphoreInfos = signals.data() + batch.firstSignal;
+			}
+			result = submit2(queue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), fence);
+		}
+		else
+		{
+			// stages fit the 32-bit flags as long as nobody asks for a synchronization2-only one
+			legacyWaits.resize(waits.size());
+			legacyStages.resize(waits.size());
+			for (size_t i = 0; i < waits.size(); i++)
+			{
+				legacyWaits[i] = waits[i].semaphore;
+				legacyStages[i] = static_cast<VkPipelineStageFlags>(waits[i].stageMask);
+			}
+			legacyCommandBuffers.resize(commandBuffers.size());
+			for (size_t i = 0; i < commandBuffers.size(); i++)
+				legacyCommandBuffers[i] = commandBuffers[i].commandBuffer;
+			legacySignals.resize(signals.size());
+			for (size_t i = 0; i < signals.size(); i++)
+				legacySignals[i] = signals[i].semaphore;
+
+			legacyInfos.resize(batches.size());
+			for (size_t i = 0; i < batches.size(); i++)
+			{
+				const auto& batch = batches[i];
+				auto& info = legacyInfos[i];
+				info = {};
+				info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				info.waitSemaphoreCount = batch.waitCount;
+				info.pWaitSemaphores = legacyWaits.data() + batch.firstWait;
+				info.pWaitDstStageMask = legacyStages.data() + batch.firstWait;
+				info.commandBufferCount = batch.commandBufferCount;
+				info.pCommandBuffers = legacyCommandBuffers.data() + batch.firstCommandBuffer;
+				info.signalSemaphoreCount = batch.signalCount;
+				info.pSignalSemaphores = legacySignals.data() + batch.firstSignal;
+			}
+			result = vkQueueSubmit(queue, static_cast<uint32_t>(legacyInfos.size()), legacyInfos.data(), fence);
+		}
+		statSubmits++;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+	lastFlush = elapsed.count();
+	lastBatches = static_cast<uint32_t>(batches.size());
+	statBatches += batches.size();
+	statCommandBuffers += commandBuffers.size();
+	statSeconds += lastFlush;
+
+	batches.clear();
+	waits.clear();
+	commandBuffers.clear();
+	signals.clear();
+	return result;
+}
+
+void SubmitQueue::report(std::ostream& out, uint32_t frames)
+{
+	if (frames == 0) return;
+	out << "Submit: " << (submit2 ? "vkQueueSubmit2" : "vkQueueSubmit") << ", "
+		<< static_cast<double>(statSubmits) / frames << " calls, "
+		<< static_cast<double>(statBatches) / frames << " batches, "
+		<< static_cast<double>(statCommandBuffers) / frames << " command buffers, "
+		<< statSeconds * 1e6 / frames << " us CPU per frame\n";
+	statSubmits = 0;
+	statBatches = 0;
+	statCommandBuffers = 0;
+	statSeconds = 0.0;
+}
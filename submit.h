@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef XZ_SUBMIT_H
+#define XZ_SUBMIT_H
+
+#include <cstdint>
+#include <initializer_list>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// A binary semaphore to wait on before a stage, or to signal once the work is done.
+struct SubmitSemaphore
+{
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+};
+
+// Collects the command buffers every subsystem wants on one queue during a frame,
+// with their semaphore dependencies, and hands them over in a single submit.
+// Work joins the batch before it unless that would add a false dependency:
+// its waits would hold back command buffers already in the batch, or the batch's
+// signals would wait for it. The flush uses vkQueueSubmit2 when the device has
+// synchronization2, vkQueueSubmit with the same batches otherwise.
+class SubmitQueue
+{
+public:
+	// submit2: vkQueueSubmit2 or vkQueueSubmit2KHR, null for the 1.0 path
+	void init(VkQueue queue, PFN_vkQueueSubmit2KHR submit2);
+
+	// render thread, in the order the work has to run
+	void enqueue(VkCommandBuffer commandBuffer, std::initializer_list<SubmitSemaphore> waits = {},
+		std::initializer_list<SubmitSemaphore> signals = {});
+	// one submit for everything enqueued since the last flush, fence signaled after all of it
+	VkResult flush(VkFence fence);
+
+	// submit calls, batches and command buffers per frame and the CPU time spent in
+	// the flush, then starts a new interval
+	void report(std::ostream& out, uint32_t frames);
+	double lastFlushSeconds() const { return lastFlush; }
+	uint32_t lastBatchCount() const { return lastBatches; }
+
+private:
+	struct Batch
+	{
+		uint32_t firstWait = 0, waitCount = 0;
+		uint32_t firstCommandBuffer = 0, commandBufferCount = 0;
+		uint32_t firstSignal = 0, signalCount = 0;
+	};
+
+	VkQueue queue = VK_NULL_HANDLE;
+	PFN_vkQueueSubmit2KHR submit2 = nullptr;
+
+	// the frame's work, flattened; the infos stay allocated from frame to frame
+	std::vector<Batch> batches;
+	std::vector<VkSemaphoreSubmitInfoKHR> waits;
+	std::vector<VkCommandBufferSubmitInfoKHR> commandBuffers;
+	std::vector<VkSemaphoreSubmitInfoKHR> signals;
+	std::vector<VkSubmitInfo2KHR> submitInfos;
+	// the same for vkQueueSubmit, indexed like the above
+	std::vector<VkSemaphore> legacyWaits;
+	std::vector<VkPipelineStageFlags> legacyStages;
+	std::vector<VkCommandBuffer> legacyCommandBuffers;
+	std::vector<VkSemaphore> legacySignals;
+	std::vector<VkSubmitInfo> legacyInfos;
+
+	double lastFlush = 0.0;
+	uint32_t lastBatches = 0;
+	uint64_t statSubmits = 0;
+	uint64_t statBatches = 0;
+	uint64_t statCommandBuffers = 0;
+	double statSeconds = 0.0;
+};
+
+#endif // !XZ_SUBMIT_H
@@ -0,0 +1,278 @@
+#include "transforms.h"
+
+#include "const.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XZ_TRANSFORMS_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// out = a * b, column-major: each column of out mixes a's columns by one column of b
+	void multiplyScalar(const float* a, const float* b, float* out)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				out[4 * column + row] = a[row] * b[4 * column] + a[4 + row] * b[4 * column + 1]
+					+ a[8 + row] * b[4 * column + 2] + a[12 + row] * b[4 * column + 3];
+			}
+		}
+	}
+
+	void multiply(const float* a, const float* b, float* out, bool simd)
+	{
+#ifdef XZ_TRANSFORMS_SSE
+		if (simd)
+		{
+			__m128 a0 = _mm_load_ps(a), a1 = _mm_load_ps(a + 4), a2 = _mm_load_ps(a + 8), a3 = _mm_load_ps(a + 12);
+			for (int column = 0; column < 4; column++)
+			{
+				const float* c = b + 4 * column;
+				__m128 r = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(c[0])), _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+				r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(c[2])), _mm_mul_ps(a3, _mm_set1_ps(c[3]))));
+				_mm_store_ps(out + 4 * column, r);
+			}
+			return;
+		}
+#else
+		(void)simd;
+#endif // XZ_TRANSFORMS_SSE
+		multiplyScalar(a, b, out);
+	}
+}
+
+
+///// TransformMatrix
+TransformMatrix TransformMatrix::identity()
+{
+	return translateScale(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+TransformMatrix TransformMatrix::translateScale(float x, float y, float z, float scale)
+{
+	TransformMatrix matrix{};
+	matrix.m[0] = matrix.m[5] = matrix.m[10] = scale;
+	matrix.m[12] = x;
+	matrix.m[13] = y;
+	matrix.m[14] = z;
+	matrix.m[15] = 1.0f;
+	return matrix;
+}
+
+
+///// TransformHierarchy
+uint32_t TransformHierarchy::create(uint32_t parent, const TransformMatrix& local, uint32_t instance)
+{
+	// appended for now, update() sorts it into its level
+	auto handle = static_cast<uint32_t>(handleIndex.size());
+	auto index = static_cast<uint32_t>(locals.size());
+	uint32_t depth = parent == NONE ? 0 : depths[parent] + 1;
+	handleIndex.push_back(index);
+	depths.push_back(depth);
+	locals.push_back(local);
+	worlds.push_back(local);
+	parents.push_back(parent == NONE ? NONE : handleIndex[parent]);
+	instances.push_back(instance);
+	dirty.push_back(1);
+	changed.push_back(0);
+	if (levelDirty.size() <= depth)
+		levelDirty.resize(depth + 1, 0);
+	levelDirty[depth] = 1;
+	unsorted = true;
+	return handle;
+}
+
+void TransformHierarchy::setLocal(uint32_t handle, const TransformMatrix& local)
+{
+	uint32_t index = handleIndex[handle];
+	locals[index] = local;
+	dirty[index] = 1;
+	levelDirty[depths[handle]] = 1;
+}
+
+void TransformHierarchy::setInstanceOutput(void* base, size_t stride)
+{
+	instanceBase = static_cast<uint8_t*>(base);
+	instanceStride = stride;
+}
+
+void TransformHierarchy::sortByDepth()
+{
+	// 1. counting sort by depth, stable, so parents stay ahead of their children
+	auto count = static_cast<uint32_t>(locals.size());
+	auto levels = static_cast<uint32_t>(levelDirty.size());
+	std::vector<uint32_t> handles(count);
+	for (uint32_t handle = 0; handle < count; handle++)
+		handles[handleIndex[handle]] = handle;
+
+	levelBegin.assign(levels + 1, 0);
+	for (uint32_t handle = 0; handle < count; handle++)
+		levelBegin[depths[handle] + 1]++;
+	for (uint32_t level = 0; level < levels; level++)
+		levelBegin[level + 1] += levelBegin[level];
+
+	std::vector<uint32_t> cursor(levelBegin.begin(), levelBegin.end() - 1);
+	std::vector<uint32_t> sorted(count);
+	for (uint32_t index = 0; index < count; index++)
+		sorted[index] = cursor[depths[handles[index]]]++;
+
+	// 2. move every array, parents and handles follow
+	auto permute = [&](auto& values) {
+		std::remove_reference_t<decltype(values)> moved(values.size());
+		for (uint32_t index = 0; index < count; index++)
+			moved[sorted[index]] = values[index];
+		values.swap(moved);
+	};
+	permute(locals);
+	permute(worlds);
+	permute(instances);
+	permute(dirty);
+	permute(parents);
+	for (auto& parent : parents)
+	{
+		if (parent != NONE)
+			parent = sorted[parent];
+	}
+	for (auto& index : handleIndex)
+		index = sorted[index];
+	changed.assign(count, 0);
+	unsorted = false;
+}
+
+uint32_t TransformHierarchy::update(JobSystem* jobs, bool simd)
+{
+	if (unsorted)
+		sortByDepth();
+
+	// level by level: every parent is final before its children read it
+	uint32_t updated = 0;
+	bool parentsChanged = false;
+	for (uint32_t level = 0; level < levelCount(); level++)
+	{
+		if (!levelDirty[level] && !parentsChanged)
+			continue;
+		levelDirty[level] = 0;
+
+		uint32_t begin = levelBegin[level];
+		uint32_t count = levelBegin[level + 1] - begin;
+		uint32_t levelUpdated = 0;
+		if (jobs == nullptr || count <= TRANSFORM_JOB_GRAIN)
+			levelUpdated = updateRange(begin, begin + count, parentsChanged, simd);
+		else
+		{
+			std::atomic<uint32_t> total{ 0 };
+			JobCounter counter;
+			jobs->parallelFor(count, TRANSFORM_JOB_GRAIN, [&](uint32_t first, uint32_t last) {
+				total.fetch_add(updateRange(begin + first, begin + last, parentsChanged, simd),
+					std::memory_order_relaxed);
+			}, &counter);
+			jobs->wait(counter);
+			levelUpdated = total.load(std::memory_order_relaxed);
+		}
+		parentsChanged = levelUpdated > 0;
+		updated += levelUpdated;
+	}
+	return updated;
+}
+
+uint32_t TransformHierarchy::updateRange(uint32_t begin, uint32_t end, bool parentsChanged, bool simd)
+{
+	uint32_t updated = 0;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		// changed flags of the level above are only current when it was updated at all
+		uint32_t parent = parents[i];
+		bool recompute = dirty[i] || (parentsChanged && parent != NONE && changed[parent]);
+		changed[i] = recompute ? 1 : 0;
+		if (!recompute) continue;
+		dirty[i] = 0;
+
+		if (parent == NONE)
+			worlds[i] = locals[i];
+		else
+			multiply(worlds[parent].m, locals[i].m, worlds[i].m, simd);
+		if (instanceBase != nullptr && instances[i] != NONE)
+			std::memcpy(instanceBase + instances[i] * instanceStride, worlds[i].m, sizeof(worlds[i].m));
+		updated++;
+	}
+	return updated;
+}
+
+
+///// benchmark
+void benchmarkTransforms(uint32_t nodeCount, std::ostream& out)
+{
+	using Clock = std::chrono::steady_clock;
+	const uint32_t RUNS = 10;
+	const float PARTIAL = 0.01f;		// share of nodes moved in the partial update
+
+	// 1. random tree, each node under one in the first quarter before it: a dozen or so levels
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f), scale(0.9f, 1.1f);
+	TransformHierarchy hierarchy;
+	std::vector<uint32_t> handles;
+	std::vector<TransformMatrix> locals;
+	handles.reserve(nodeCount);
+	locals.reserve(nodeCount);
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		uint32_t parent = i < 16 ? TransformHierarchy::NONE
+			: handles[rng() % (i / 4)];
+		locals.push_back(TransformMatrix::translateScale(offset(rng), offset(rng), offset(rng), scale(rng)));
+		handles.push_back(hierarchy.create(parent, locals.back(), i));
+	}
+
+	// every node has an instance slot, like a mapped per-instance buffer
+	std::vector<TransformMatrix> instances(nodeCount);
+	hierarchy.setInstanceOutput(instances.data(), sizeof(TransformMatrix));
+	hierarchy.update(nullptr);
+
+	JobSystem jobs;
+	jobs.init();
+	out << std::fixed << std::setprecision(3);
+	out << "Transforms: " << nodeCount << " nodes in " << hierarchy.levelCount() << " levels, "
+		<< jobs.workerCount() << " workers, mean of " << RUNS << " runs" << std::endl;
+
+	// 2. everything dirty, then a few random subtrees, per configuration
+	struct Config { const char* name; bool simd; bool parallel; };
+	for (const auto& config : { Config{ "scalar", false, false }, Config{ "SSE", true, false },
+		Config{ "SSE parallel", true, true } })
+	{
+		double fullMs = 0.0, partialMs = 0.0;
+		uint32_t partialNodes = 0;
+		for (uint32_t run = 0; run < RUNS; run++)
+		{
+			for (uint32_t i = 0; i < nodeCount; i++)
+				hierarchy.setLocal(handles[i], locals[i]);
+			auto t0 = Clock::now();
+			hierarchy.update(config.parallel ? &jobs : nullptr, config.simd);
+			auto t1 = Clock::now();
+
+			for (uint32_t moved = 0; moved < static_cast<uint32_t>(nodeCount * PARTIAL); moved++)
+			{
+				uint32_t i = rng() % nodeCount;
+				hierarchy.setLocal(handles[i], locals[i]);
+			}
+			auto t2 = Clock::now();
+			partialNodes += hierarchy.update(config.parallel ? &jobs : nullptr, config.simd);
+			auto t3 = Clock::now();
+			fullMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			partialMs += std::chrono::duration<double, std::milli>(t3 - t2).count();
+		}
+		out << "\t" << config.name << ": full " << fullMs / RUNS << " ms (" << fullMs * 1e6 / RUNS / nodeCount
+			<< " ns/node), " << PARTIAL * 100.0f << "% moved " << partialMs / RUNS << " ms ("
+			<< partialNodes / RUNS << " nodes in their subtrees)" << std::endl;
+	}
+	out << std::defaultfloat;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef XZ_TRANSFORMS_H
+#define XZ_TRANSFORMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "jobs.h"
+
+// Column-major 4x4, aligned for SSE loads.
+struct TransformMatrix
+{
+	alignas(16) float m[16];
+
+	static TransformMatrix identity();
+	// translation then uniform scale, all the demo scene needs
+	static TransformMatrix translateScale(float x, float y, float z, float scale);
+
+	float translation(int axis) const { return m[12 + axis]; }
+};
+
+// Scene graph as flat arrays sorted by hierarchy depth: every parent comes before
+// its children, so one linear pass per level computes the world matrices. Levels
+// are split over the job system. Only nodes whose local matrix changed, and their
+// subtrees, are recomputed; a level with nothing changed above it is skipped whole.
+// Nodes with an instance slot also get their world matrix written to the instance
+// output, e.g. a persistently mapped buffer.
+class TransformHierarchy
+{
+public:
+	static constexpr uint32_t NONE = ~0u;
+
+	// parent NONE for a root, the parent has to exist already; returns a stable handle
+	uint32_t create(uint32_t parent, const TransformMatrix& local, uint32_t instance = NONE);
+	void setLocal(uint32_t handle, const TransformMatrix& local);
+	const TransformMatrix& world(uint32_t handle) const { return worlds[handleIndex[handle]]; }
+
+	// stride bytes between instance slots, null to stop writing
+	void setInstanceOutput(void* base, size_t stride);
+
+	// jobs null for the calling thread only; returns the number of nodes recomputed
+	uint32_t update(JobSystem* jobs, bool simd = true);
+
+	uint32_t size() const { return static_cast<uint32_t>(handleIndex.size()); }
+	uint32_t levelCount() const { return static_cast<uint32_t>(levelBegin.size()) - 1; }
+
+private:
+	void sortByDepth();
+	uint32_t updateRange(uint32_t begin, uint32_t end, bool parentsChanged, bool simd);
+
+	// by sorted index
+	std::vector<TransformMatrix> locals;
+	std::vector<TransformMatrix> worlds;
+	std::vector<uint32_t> parents;			// sorted index, NONE for roots
+	std::vector<uint32_t> instances;
+	std::vector<uint8_t> dirty;				// local changed since the last update
+	std::vector<uint8_t> changed;			// world recomputed by the last update of its level
+
+	std::vector<uint32_t> handleIndex;		// handle to sorted index
+	std::vector<uint32_t> depths;			// by handle
+	std::vector<uint32_t> levelBegin{ 0 };	// sorted index of each level's first node, plus the end
+	std::vector<uint8_t> levelDirty;		// some local of the level changed
+	bool unsorted = false;					// nodes created since the last update
+
+	uint8_t* instanceBase = nullptr;
+	size_t instanceStride = 0;
+};
+
+// --bench-transforms: full and partial updates of a random hierarchy, scalar
+// against SSE and one thread against all
+void benchmarkTransforms(uint32_t nodeCount, std::ostream& out);
+
+#endif // !XZ_TRANSFORMS_H
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef XZ_TRIPLEBUFFER_H
+#define XZ_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free hand-off of the latest value from one writer thread to one reader
+// thread. The writer fills back() and publishes it, the reader picks up the
+// newest published value with acquire(); neither ever waits for the other.
+// Values the reader never saw are overwritten, slots keep their allocations.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// writer
+	T& back() { return slots[backIndex]; }
+	void publish()
+	{
+		backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// reader, false when nothing newer was published since the last call
+	bool acquire()
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+			return false;
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+	const T& front() const { return slots[frontIndex]; }
+
+private:
+	static const uint32_t INDEX = 3;
+	static const uint32_t FRESH = 4;		// middle holds a value the reader has not taken
+
+	T slots[3];
+	uint32_t backIndex = 0;						// writer only
+	std::atomic<uint32_t> middle{ 1 };
+	uint32_t frontIndex = 2;					// reader only
+};
+
+#endif // !XZ_TRIPLEBUFFER_H
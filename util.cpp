@@ -3,8 +3,23 @@
 #include "const.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 ///// util_QueueFamilyIndices
 bool util_QueueFamilyIndices::isComplete()
@@ -85,6 +100,225 @@ VkExtent2D util_SurfaceDetails::chooseExtent(uint32_t pixel_width, uint32_t pixe
 
 
 
+///// util_LaunchOptions
+auto util_LaunchOptions::parse(int argc, char** argv)->util_LaunchOptions
+{
+	util_LaunchOptions options;
+
+	// a malformed count names its option instead of escaping as std::invalid_argument
+	auto parseCount = [](const std::string& option, const char* value) {
+		size_t end = 0;
+		unsigned long count = 0;
+		if (std::isdigit(static_cast<unsigned char>(value[0])))
+		{
+			try { count = std::stoul(value, &end); }
+			catch (const std::exception&) { end = 0; }
+		}
+		if (end == 0 || value[end] != '\0' || count > std::numeric_limits<uint32_t>::max())
+			throw std::runtime_error(option + " expects a number, not \"" + value + "\"");
+		return static_cast<uint32_t>(count);
+	};
+
+	const char* envDevice = std::getenv(APP_ENV_DEVICE);
+	if (envDevice != nullptr)
+		options.deviceOverride = envDevice;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--device")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--device expects an index, UUID or name");
+			options.deviceOverride = argv[++i];
+		}
+		else if (arg == "--no-sort")
+			options.sortOpaque = false;
+		else if (arg == "--no-lod")
+			options.lod = false;
+		else if (arg == "--msaa")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--msaa expects a sample count");
+			options.msaaSamples = parseCount(arg, argv[++i]);
+			if (options.msaaSamples == 0 || (options.msaaSamples & (options.msaaSamples - 1)) != 0
+				|| options.msaaSamples > 64)
+				throw std::runtime_error("--msaa expects a power of two up to 64");
+		}
+		else if (arg == "--capture")
+			options.capture = true;
+		else if (arg == "--no-dynamic-rendering")
+			options.dynamicRendering = false;
+		else if (arg == "--windows")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--windows expects a count");
+			options.windowCount = parseCount(arg, argv[++i]);
+			if (options.windowCount == 0 || options.windowCount > APP_MAX_WINDOWS)
+				throw std::runtime_error("--windows expects 1 to " + std::to_string(APP_MAX_WINDOWS));
+		}
+		else if (arg == "--bench-sort")
+		{
+			options.benchSortDraws = BENCH_SORT_DRAWS;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				options.benchSortDraws = parseCount(arg, argv[++i]);
+		}
+		else if (arg == "--bench-jobs")
+			options.benchJobs = true;
+		else if (arg == "--bench-cull")
+		{
+			options.benchCullObjects = BENCH_CULL_OBJECTS;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				options.benchCullObjects = parseCount(arg, argv[++i]);
+		}
+		else if (arg == "--bench-transforms")
+		{
+			options.benchTransformNodes = BENCH_TRANSFORM_NODES;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				options.benchTransformNodes = parseCount(arg, argv[++i]);
+			if (options.benchTransformNodes < 16)
+				throw std::runtime_error("--bench-transforms expects at least 16 nodes");
+		}
+		else if (arg == "--particles")
+		{
+			options.particleCount = PARTICLE_DEFAULT_COUNT;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				options.particleCount = parseCount(arg, argv[++i]);
+			if (options.particleCount == 0)
+				throw std::runtime_error("--particles expects at least one particle");
+		}
+		else if (arg == "--bench-particles")
+		{
+			options.benchParticles = true;
+			options.particleCount = PARTICLE_BENCH_COUNTS[0];
+		}
+		else if (arg == "--lights")
+		{
+			options.lightCount = LIGHT_DEFAULT_COUNT;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				options.lightCount = parseCount(arg, argv[++i]);
+			if (options.lightCount == 0)
+				throw std::runtime_error("--lights expects at least one light");
+		}
+		else if (arg == "--lights-naive")
+		{
+			options.lightsNaive = true;
+			if (options.lightCount == 0)
+				options.lightCount = LIGHT_DEFAULT_COUNT;
+		}
+		else if (arg == "--bench-lights")
+		{
+			options.benchLights = true;
+			options.lightCount = LIGHT_BENCH_COUNTS[0];
+		}
+		else if (arg == "--on-demand")
+			options.onDemand = true;
+		else if (arg == "--fps")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--fps expects a frame rate");
+			options.targetFps = parseCount(arg, argv[++i]);
+		}
+		else if (arg == "--log-level")
+		{
+			if (i + 1 >= argc || !Logger::parseLevel(argv[i + 1], options.logLevel))
+				throw std::runtime_error("--log-level expects debug, info, warning or error");
+			i++;
+		}
+		else if (arg == "--host-alloc")
+		{
+			if (i + 1 >= argc || !HostAllocator::parseMode(argv[i + 1], options.hostAllocMode))
+				throw std::runtime_error("--host-alloc expects off, count or arena");
+			i++;
+		}
+		else if (arg == "--post")
+			options.post = true;
+		else if (arg == "--no-segment-cache")
+			options.segmentCache = false;
+		else if (arg == "--metrics-file")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--metrics-file expects a path");
+			options.metricsFile = argv[++i];
+		}
+		else if (arg == "--metrics-socket")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--metrics-socket expects a path");
+			options.metricsSocket = argv[++i];
+		}
+		else if (arg == "--shader-dir")
+		{
+			if (i + 1 >= argc)
+				throw std::runtime_error("--shader-dir expects a directory");
+			options.shaderDir = argv[++i];
+		}
+		else
+			throw std::runtime_error("unknown argument " + arg);
+	}
+
+	return options;
+}
+
+
+///// util_DeviceScore
+uint32_t util_DeviceScore::total() const
+{
+	return typeScore + heapScore + limitScore + queueScore;
+}
+
+
+
+///// util_StartupProfiler
+void util_StartupProfiler::start()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	stages.clear();
+	origin = Clock::now();
+	finished = false;
+}
+
+void util_StartupProfiler::record(const std::string& name, Clock::time_point begin, Clock::time_point end)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	stages.push_back({ name, begin, end, std::this_thread::get_id() });
+}
+
+void util_StartupProfiler::finish()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	firstFrame = Clock::now();
+	finished = true;
+}
+
+void util_StartupProfiler::report(std::ostream& out) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	using ms = std::chrono::duration<double, std::milli>;
+
+	// number threads in order of first appearance, the init thread is 0
+	std::map<std::thread::id, size_t> threadIndex;
+	for (const auto& stage : stages)
+		threadIndex.emplace(stage.thread, threadIndex.size());
+
+	out << DEBUG_SEGLINE;
+	out << "Startup Stages (ms):\n";
+	out << std::fixed << std::setprecision(2);
+	for (const auto& stage : stages)
+	{
+		out << '\t' << std::left << std::setw(24) << stage.name << std::right
+			<< " @" << std::setw(9) << ms(stage.begin - origin).count()
+			<< std::setw(9) << ms(stage.end - stage.begin).count()
+			<< "  thread " << threadIndex[stage.thread] << '\n';
+	}
+	if (finished)
+		out << "Time To First Frame: " << ms(firstFrame - origin).count() << " ms\n";
+	out << std::defaultfloat;
+	out.flush();
+}
+
+
+
 ///// utilities function
 std::vector<char> readFile(const std::string& filename)
 {
@@ -101,4 +335,175 @@ std::vector<char> readFile(const std::string& filename)
 
 	file.close();
 	return buffer;
-}
\ No newline at end of file
+}
+
+///// util_FrameLimiter
+void util_FrameLimiter::setTarget(uint32_t fps)
+{
+	period = fps > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))
+		: Clock::duration(0);
+	spin = std::chrono::microseconds(FRAME_LIMITER_MIN_SPIN_US);
+	next = Clock::time_point{};
+}
+
+void util_FrameLimiter::wait()
+{
+	if (period.count() == 0) return;
+
+	// 1. first frame, or a stall put us a whole period behind: restart the schedule
+	auto now = Clock::now();
+	if (next == Clock::time_point{} || now - next > period)
+		next = now;
+
+	// 2. coarse sleep up to the spin window, learning how late sleeps wake up
+	auto sleepUntil = next - spin;
+	if (now < sleepUntil)
+	{
+		std::this_thread::sleep_until(sleepUntil);
+		auto overshoot = Clock::now() - sleepUntil;
+		auto minSpin = std::chrono::duration_cast<Clock::duration>(std::chrono::microseconds(FRAME_LIMITER_MIN_SPIN_US));
+		spin = std::max(minSpin, std::max(spin - spin / 16, overshoot + minSpin));
+	}
+
+	// 3. spin out the rest
+	while (Clock::now() < next)
+		std::this_thread::yield();
+	next += period;
+}
+
+double processCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	auto toTicks = [](const FILETIME& time) {
+		return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+	};
+	return (toTicks(kernel) + toTicks(user)) * 1e-7;		// 100 ns units
+#else
+	timespec time{};
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+		return 0.0;
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+std::string formatUUID(const uint8_t uuid[VK_UUID_SIZE])
+{
+	std::ostringstream out;
+	out << std::hex << std::setfill('0');
+	for (size_t i = 0; i < VK_UUID_SIZE; i++)
+	{
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			out << '-';
+		out << std::setw(2) << static_cast<uint32_t>(uuid[i]);
+	}
+	return out.str();
+}
+
+uint32_t formatTexelSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+	case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+		return 4;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+bool formatIsSrgb(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+	case VK_FORMAT_B8G8R8_SRGB:
+	case VK_FORMAT_R8G8B8_SRGB:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool matchDeviceOverride(const std::string& selector, uint32_t index,
+	const VkPhysicalDeviceProperties& properties, const uint8_t uuid[VK_UUID_SIZE])
+{
+	if (selector.empty()) return false;
+
+	auto lower = [](std::string s) {
+		std::transform(s.begin(), s.end(), s.begin(),
+			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return s;
+	};
+
+	// 1. 32 hex digits, dashes optional: device UUID
+	std::string hex;
+	for (char c : selector)
+		if (c != '-') hex.push_back(c);
+	if (hex.size() == 2 * VK_UUID_SIZE
+		&& std::all_of(hex.begin(), hex.end(), [](unsigned char c) { return std::isxdigit(c); }))
+	{
+		std::string own = formatUUID(uuid);
+		own.erase(std::remove(own.begin(), own.end(), '-'), own.end());
+		return lower(hex) == own;
+	}
+
+	// 2. short plain number: enumeration index
+	if (selector.size() <= 4
+		&& std::all_of(selector.begin(), selector.end(), [](unsigned char c) { return std::isdigit(c); }))
+		return std::stoul(selector) == index;
+
+	// 3. otherwise: case-insensitive substring of the device name
+	return lower(properties.deviceName).find(lower(selector)) != std::string::npos;
+}
+
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties,
+	VkMemoryPropertyFlags preferred)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	// first pass with the preferred flags, second with the required ones only
+	for (auto wanted : { properties | preferred, properties })
+	{
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		{
+			if ((typeFilter & (1u << i))
+				&& (memProperties.memoryTypes[i].propertyFlags & wanted) == wanted)
+				return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+uint32_t groups(uint32_t size, uint32_t groupSize)
+{
+	return (size + groupSize - 1) / groupSize;
+}
+
+void memoryBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage,
+	VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+{
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void computeBarrier(VkCommandBuffer commandBuffer)
+{
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
@@ -3,13 +3,24 @@
 #ifndef XZ_UTIL_H
 #define XZ_UTIL_H
 
+#include <atomic>
 #include <optional>
 #include <string>
 #include <set>
 #include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <ostream>
 
 #include <vulkan/vulkan.h>
 
+#include "const.h"
+#include "drawlist.h"
+#include "hostalloc.h"
+#include "log.h"
+
+struct GLFWwindow;
 
 struct util_QueueFamilyIndices
 {
@@ -38,5 +49,217 @@ struct util_SurfaceDetails
 	VkExtent2D chooseExtent(uint32_t pixel_width, uint32_t pixel_height);
 };
 
+struct util_LaunchOptions
+{
+	std::string deviceOverride;		// index, UUID or name substring
+	bool sortOpaque = true;			// front-to-back opaque draws, --no-sort to disable
+	bool lod = true;				// screen-space LOD per draw, --no-lod for full detail everywhere
+	uint32_t msaaSamples = 1;		// requested sample count, clamped to the device
+	bool capture = false;			// --capture, read presented frames back to the host
+	bool dynamicRendering = true;	// use it when the device has it, --no-dynamic-rendering to disable
+	uint32_t windowCount = 1;		// --windows N, all rendered from one device and presented together
+	uint32_t benchSortDraws = 0;	// --bench-sort [N], run the draw list benchmark instead of the app
+	bool benchJobs = false;			// --bench-jobs, run the job system benchmark instead of the app
+	uint32_t benchCullObjects = 0;	// --bench-cull [N], run the culling benchmark instead of the app
+	uint32_t benchTransformNodes = 0;	// --bench-transforms [N], run the transform hierarchy benchmark instead
+	uint32_t particleCount = 0;		// --particles [N], GPU simulated particles in front of the scene
+	bool benchParticles = false;	// --bench-particles, step the app through PARTICLE_BENCH_COUNTS, then exit
+	uint32_t lightCount = 0;		// --lights [N], dynamic point and spot lights binned into clusters
+	bool lightsNaive = false;		// --lights-naive, every fragment loops over every light instead
+	bool benchLights = false;		// --bench-lights, step the app through LIGHT_BENCH_COUNTS, then exit
+	bool onDemand = false;			// --on-demand, redraw only on input, resize or a scene change
+	uint32_t targetFps = 0;			// --fps N, frame limiter target, 0 for uncapped
+	LogLevel logLevel = LogLevel::Info;	// --log-level debug|info|warning|error
+	HostAllocMode hostAllocMode = HostAllocMode::Count;	// --host-alloc off|count|arena
+	bool post = false;				// --post, HDR scene and compute post-processing chain
+	bool segmentCache = true;		// cache passes in secondary command buffers, --no-segment-cache to disable
+	std::string metricsFile;		// --metrics-file PATH, Prometheus text rewritten periodically
+	std::string metricsSocket;		// --metrics-socket PATH, Unix domain socket serving the same text
+	std::string shaderDir;			// --shader-dir PATH, .spv files there override the embedded shaders
+
+	static auto parse(int argc, char** argv)->util_LaunchOptions;
+};
+
+struct util_DeviceScore
+{
+	uint32_t index = 0;
+	uint8_t uuid[VK_UUID_SIZE] = {};
+	bool suitable = false;
+	std::string rejectReason;
+
+	uint32_t typeScore = 0;
+	uint32_t heapScore = 0;
+	uint32_t limitScore = 0;
+	uint32_t queueScore = 0;
+
+	VkDeviceSize deviceLocalBytes = 0;
+	bool dedicatedTransfer = false;
+	bool dedicatedCompute = false;
+
+	uint32_t total() const;
+};
+
+// image with its own dedicated allocation
+struct util_ImageAllocation
+{
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	bool lazy = false;				// backed by LAZILY_ALLOCATED memory
+};
+
+// Everything that belongs to one window: its surface and swap chain, the attachments
+// sized to it, per-image command buffers and queries, and its acquire/present semaphores.
+// Device, pipelines and in-flight fences are shared by all targets.
+struct util_RenderTarget
+{
+	uint32_t id = 0;
+	GLFWwindow* window = nullptr;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	void* owner = nullptr;				// the application, for GLFW callbacks
+
+	// written by GLFW callbacks on the main thread, read by the render thread
+	std::atomic<bool> framebufferResized{ false };
+	std::atomic<bool> minimized{ false };
+	std::atomic<uint32_t> framebufferWidth{ 0 };
+	std::atomic<uint32_t> framebufferHeight{ 0 };
+
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+	std::vector<VkImage> images;
+	std::vector<VkImageView> imageViews;
+	VkExtent2D extent{};
+
+	util_ImageAllocation colorAttachment;		// multisampled, only with MSAA
+	util_ImageAllocation depthAttachment;
+	std::vector<VkFramebuffer> framebuffers;	// render pass path only
+
+	std::vector<VkCommandBuffer> commandBuffers;
+	VkQueryPool statsQueryPool = VK_NULL_HANDLE;
+	VkQueryPool timingQueryPool = VK_NULL_HANDLE;
+
+	std::vector<VkSemaphore> imageAvailableSemaphores;		// per frame in flight
+	std::vector<VkSemaphore> renderFinishedSemaphores;
+	std::vector<VkFence> imagesInFlight;					// per swap chain image
+
+	uint32_t imageIndex = 0;		// acquired this frame
+	uint64_t statFragments = 0;
+	double statGpuNs = 0.0;
+	uint32_t statFrames = 0;
+};
+
+// per-draw push constants, layout must match shader/tri.vert
+struct util_DrawCommand
+{
+	float offset[2];
+	float depth;
+	float scale;
+};
+
+// specialization constants of shader/tri.frag, field i is constant_id i
+struct util_SceneVariant
+{
+	uint32_t quantizeLevels;		// steps per colour channel, 0 keeps the gradient
+	float intensity;				// above 1 only survives an HDR scene: it feeds --post bloom
+};
+
+// every scene pipeline, prebuilt at startup; the index is the DrawKey pipeline id
+constexpr util_SceneVariant SCENE_VARIANTS[] = {
+	{ 0, 1.0f },		// plain
+	{ 6, 1.0f },		// posterized
+	{ 0, 3.0f },		// emissive
+};
+constexpr uint32_t SCENE_VARIANT_COUNT = sizeof(SCENE_VARIANTS) / sizeof(SCENE_VARIANTS[0]);
+
+// what one update tick hands to the render thread
+struct util_FrameSnapshot
+{
+	uint64_t tick = 0;
+	double time = 0.0;					// simulated seconds
+	float camera[2] = {};				// pan, already applied to the draws
+	uint64_t passVersion[SCENE_PASS_COUNT] = {};	// changes whenever a pass's draws do
+	std::vector<util_DrawCommand> draws;
+	DrawList drawList;					// sorted, indexes draws; the material field is the LOD
+	uint64_t triangles = 0;				// what the draw list submits, at the selected LODs
+};
+
+class util_StartupProfiler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Stage
+	{
+		std::string name;
+		Clock::time_point begin;
+		Clock::time_point end;
+		std::thread::id thread;
+	};
+
+	void start();
+	void record(const std::string& name, Clock::time_point begin, Clock::time_point end);
+	void finish();
+	bool isFinished() const { return finished; }
+	void report(std::ostream& out) const;
+
+	// time fn as one stage; safe to call from any thread
+	template<typename F>
+	void time(const std::string& name, F&& fn)
+	{
+		auto begin = Clock::now();
+		fn();
+		record(name, begin, Clock::now());
+	}
+
+private:
+	mutable std::mutex lock;
+	std::vector<Stage> stages;
+	Clock::time_point origin;
+	Clock::time_point firstFrame;
+	bool finished = false;
+};
+
+// Paces a loop to a target rate: sleeps most of the way to the next slot, then
+// spins the rest, since sleeps overshoot by the scheduler's granularity. The
+// spin window follows the worst overshoot seen so it adapts to the platform.
+class util_FrameLimiter
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void setTarget(uint32_t fps);		// 0 disables
+	void wait();
+
+private:
+	Clock::duration period{ 0 };
+	Clock::duration spin{ 0 };
+	Clock::time_point next{};
+};
+
+// CPU time of the whole process so far, all threads
+double processCpuSeconds();
+
 std::vector<char> readFile(const std::string& filename);
+
+std::string formatUUID(const uint8_t uuid[VK_UUID_SIZE]);
+
+// bytes per texel of the 8-bit color formats a swap chain offers, 0 otherwise
+uint32_t formatTexelSize(VkFormat format);
+// views of the format encode sRGB on attachment writes and blits
+bool formatIsSrgb(VkFormat format);
+
+bool matchDeviceOverride(const std::string& selector, uint32_t index,
+	const VkPhysicalDeviceProperties& properties, const uint8_t uuid[VK_UUID_SIZE]);
+
+// first type in typeFilter with the required properties, one that also has the
+// preferred ones if there is any; throws when none fits
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties,
+	VkMemoryPropertyFlags preferred = 0);
+
+// workgroups covering size invocations
+uint32_t groups(uint32_t size, uint32_t groupSize);
+void memoryBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage,
+	VkAccessFlags srcAccess, VkAccessFlags dstAccess);
+// every compute write so far is visible to the next compute pass
+void computeBarrier(VkCommandBuffer commandBuffer);
 #endif // !XZ_UTIL_H
\ No newline at end of file